@@ -1,14 +1,122 @@
 #include <cstdint>
 #include <vector>
 #include <iostream>
+#include <iomanip>
 #include <thread>
 #include <chrono>
 #include <random>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <latch>
+#include <new>
+#include <cstring>
+#include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <fstream>
+#include <cstdlib>
+#include <string>
+#include <cctype>
+#include <future>
+#include <coroutine>
+#include <stop_token>
+#include <optional>
+
+#include "GaloisField.h"
+
+/* x86 SIMD intrinsics and CPU feature detection for the hardware backends */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AES_X86                 (1)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AES_TARGET(features)
+#else
+#include <cpuid.h>
+#define AES_TARGET(features)    __attribute__((target(features)))
+#endif
+#else
+#define AES_X86                 (0)
+#endif
+
+/* The unrolled round kernels are built from lambdas, flatten inlines all of them into the kernel */
+#if defined(__GNUC__)
+#define AES_FLATTEN             __attribute__((flatten))
+#else
+#define AES_FLATTEN
+#endif
+
+/* Memory-mapped file I/O for the file mode */
+#if defined(__unix__) || defined(__APPLE__)
+#define AES_POSIX               (1)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#define AES_POSIX               (0)
+#endif
+
+/* CPU affinity mask, used to size the worker pool */
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/* Set to 1 on Linux (5.1 or later) to run the file mode on io_uring instead of mmap */
+#ifndef AES_IO_URING
+#define AES_IO_URING            (0)
+#endif
+#if AES_IO_URING
+#if !defined(__linux__)
+#error "The io_uring backend is only available on Linux"
+#endif
+#include <linux/io_uring.h>
+/* The kernel headers define their own BLOCK_SIZE (the filesystem block size) */
+#undef BLOCK_SIZE
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 
 /********************************************************************
  *********************** Configurations *****************************
  ********************************************************************/
-#define CORES_NUMBER    (10U)
+/* Number of worker threads. 0 sizes the pool at startup from the CPUs the process can actually
+   use (affinity mask and cgroup CPU quota), any other value forces that many threads */
+#define CORES_NUMBER        (0U)
+/* Minimum number of consecutive states handed to a worker thread as a single range */
+#define BLOCKS_PER_BATCH    (256U)
+/* Placement of the worker threads of the global pool (see WorkerPlacement) */
+#define WORKER_PLACEMENT    WorkerPlacement::Automatic
+/* Buffers at least this large are first touched by the workers that will process them, so that
+   their pages land on the right NUMA node. Only done when the pool spans several nodes */
+#define FIRST_TOUCH_MIN_SIZE    (64ULL * 1024ULL * 1024ULL)
+/* Minimum amount of work per range in nanoseconds. Handing a range to a worker costs a few
+   microseconds, so inputs that cannot fill two such ranges stay on the calling thread */
+#define DISPATCH_GRAIN_NANOSECONDS  (50000U)
+/* Set to 1 to let the automatic backend selection prefer the constant-time bitsliced
+   backend over the T-table backend on CPUs without AES-NI */
+#define AES_CONSTANT_TIME_FALLBACK  (0U)
+/* Size of the input/output file windows mapped at once in file mode (multiple of the page size and of 16) */
+#define FILE_WINDOW_SIZE    (256ULL * 1024ULL * 1024ULL)
+/* Size of the buffers handed between the stages of the streaming pipeline */
+#define PIPELINE_BUFFER_SIZE    (1024U * 1024U)
+/* Number of buffers in flight in the streaming pipeline (bounds its memory) */
+#define PIPELINE_DEPTH          (4U)
+/* Number of PIPELINE_BUFFER_SIZE buffers cycling through the io_uring file backend */
+#define IO_URING_DEPTH          (8U)
+/* Number of blocks the PCLMULQDQ GHASH multiplies by powers of H before a single reduction */
+#define GHASH_AGGREGATION       (4U)
+/* Set to 1 to build the per-stage timers and counters. At exit they are written as JSON to the
+   file named by the AES_INSTRUMENTATION_FILE environment variable ("-" for stderr). With 0 the
+   instrumentation is compiled out entirely */
+#ifndef AES_INSTRUMENTATION
+#define AES_INSTRUMENTATION     (0)
+#endif
 
 
 /*******************************TBD*************************************/
@@ -18,9 +126,27 @@ using namespace std;
 #define NUM_COLUMN 4
 /* Number of Word Size */
 #define WORD_SIZE  4
+/* Maximum number of rounds (AES-256) */
+#define MAX_ROUNDS          (14U)
+/* Size of a single AES state (block) in bytes */
+#define BLOCK_SIZE          (16U)
+/* Alignment of the block buffers (a cache line) */
+#define BUFFER_ALIGNMENT    (64U)
+/* Number of blocks processed in parallel by the bitsliced kernel */
+#define BITSLICED_BLOCKS    (8U)
+/* Number of independent blocks the T-table backend runs through the rounds in lock-step */
+#define TTABLE_INTERLEAVE   (4U)
+/* Number of independent blocks kept in flight by the AES-NI backend (AESENC pipeline depth) */
+#define AESNI_INTERLEAVE    (8U)
+/* Number of keystream blocks generated at once by a worker (kept small enough to stay in L1) */
+#define KEYSTREAM_BLOCKS    (64U)
+/* Size of the GCM authentication tag in bytes */
+#define GCM_TAG_SIZE        (16U)
+/* Size of the GCM initialization vector taking the fast path (96 bits) */
+#define GCM_IV_SIZE         (12U)
 
 /* AES S-box */
-const uint8_t sBox[256] = 
+constexpr uint8_t sBox[256] = 
 {
     0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
     0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
@@ -41,7 +167,7 @@ const uint8_t sBox[256] =
 };
 
 // Inverse S-Box for InverseSubBytes step
-const uint8_t inv_sbox[256] ={
+constexpr uint8_t inv_sbox[256] ={
         0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38, 0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
         0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87, 0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB,
         0x54, 0x7B, 0x94, 0x32, 0xA6, 0xC2, 0x23, 0x3D, 0xEE, 0x4C, 0x95, 0x0B, 0x42, 0xFA, 0xC3, 0x4E,
@@ -61,768 +187,6095 @@ const uint8_t inv_sbox[256] ={
 };
 /* AES Rcon (Round constant) */
 const uint8_t Rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
-/*******************************//************************************/
-
 
+/********************************************************************
+ * Function: GenerateEncryptionTable
+ * Description:
+ *  Compile-time generation of the encryption T-tables. Entry x of
+ *  Te0 is the column {02}.S[x], S[x], S[x], {03}.S[x] i.e. the
+ *  SubBytes and MixColumns contribution of one byte to its column.
+ *  Te1..Te3 are the same column rotated right by 8, 16 and 24 bits
+ * Inputs:  rotation    - Index of the table (0 for Te0 to 3 for Te3)
+ * Returns: The 256-entry table
+ ********************************************************************/
+constexpr std::array<uint32_t, 256> GenerateEncryptionTable(int rotation)
+{
+    std::array<uint32_t, 256> table{};
+    for (int x = 0; x < 256; ++x)
+    {
+        uint8_t s1 = sBox[x];
+        uint8_t s2 = gfMul2[s1];
+        uint8_t s3 = gfMul3[s1];
+        uint32_t column = (static_cast<uint32_t>(s2) << 24) | (static_cast<uint32_t>(s1) << 16) |
+                          (static_cast<uint32_t>(s1) << 8) | static_cast<uint32_t>(s3);
+        table[x] = (rotation == 0) ? column : ((column >> (8 * rotation)) | (column << (32 - 8 * rotation)));
+    }
+    return table;
+}
 
 /********************************************************************
- ************************* Prototypes *******************************
+ * Function: GenerateDecryptionTable
+ * Description:
+ *  Compile-time generation of the decryption T-tables. Entry x of
+ *  Td0 is the column {0e}.IS[x], {09}.IS[x], {0d}.IS[x], {0b}.IS[x]
+ *  i.e. the InvSubBytes and InvMixColumns contribution of one byte to
+ *  its column. Td1..Td3 are the same column rotated right by 8, 16
+ *  and 24 bits
+ * Inputs:  rotation    - Index of the table (0 for Td0 to 3 for Td3)
+ * Returns: The 256-entry table
  ********************************************************************/
-/* Encryption Functions */
-void AddRoundKey(uint8_t state[4][4], const std::vector<uint8_t>& roundKey);
-void SubBytes(uint8_t state[4][4]);
-void ShiftRows(uint8_t state[4][4]);
-void MixColumns(uint8_t state[4][4]);
+constexpr std::array<uint32_t, 256> GenerateDecryptionTable(int rotation)
+{
+    std::array<uint32_t, 256> table{};
+    for (int x = 0; x < 256; ++x)
+    {
+        uint8_t s1 = inv_sbox[x];
+        uint8_t s9 = gfMul9[s1];
+        uint8_t s11 = gfMul11[s1];
+        uint8_t s13 = gfMul13[s1];
+        uint8_t s14 = gfMul14[s1];
+        uint32_t column = (static_cast<uint32_t>(s14) << 24) | (static_cast<uint32_t>(s9) << 16) |
+                          (static_cast<uint32_t>(s13) << 8) | static_cast<uint32_t>(s11);
+        table[x] = (rotation == 0) ? column : ((column >> (8 * rotation)) | (column << (32 - 8 * rotation)));
+    }
+    return table;
+}
 
-uint32_t SubWord(uint32_t word);
-uint32_t RotWord(uint32_t word);
-void KeyExpansion(const uint8_t* key, int Nk, int Nr, uint32_t* w) ;
-void PrintExpandedKey(const uint32_t* w, int size);
+/* AES T-tables (32-bit lookup tables), generated at compile time */
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Te0 = GenerateEncryptionTable(0);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Te1 = GenerateEncryptionTable(1);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Te2 = GenerateEncryptionTable(2);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Te3 = GenerateEncryptionTable(3);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Td0 = GenerateDecryptionTable(0);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Td1 = GenerateDecryptionTable(1);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Td2 = GenerateDecryptionTable(2);
+alignas(BUFFER_ALIGNMENT) constexpr std::array<uint32_t, 256> Td3 = GenerateDecryptionTable(3);
+
+/* Example key used by the program. Use 16 bytes for AES-128, 24 bytes for AES-192, 32 bytes for AES-256 */
+const uint8_t exampleKey[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+                                0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+                                0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+/*******************************//************************************/
 
+/********************************************************************
+ ***************************** Types ********************************
+ ********************************************************************/
+/* Implementations of the AES rounds. Automatic selects the fastest one available on the machine */
+enum class AesBackend
+{
+    Automatic,
+    Reference,
+    TTable,
+    AesNi,
+    Bitsliced
+};
 
-/* Decryption functions */
-void InvMixColumns(uint8_t state[4][4]);
+/* Implementations of GHASH. Automatic selects PCLMULQDQ when the CPU supports it */
+enum class GhashBackend
+{
+    Automatic,
+    Shoup,
+    Clmul
+};
 
-/* Prining Functions */
-void printState(uint8_t state[4][4]);
+/* Instruction set extensions of the CPU the program runs on */
+struct CpuFeatures
+{
+    bool aesNi;
+    bool ssse3;
+    bool avx2;
+    bool pclmul;
+};
 
-/* Utility Functions */
-uint8_t GaloisFieldMultiplication(uint8_t firstOperand, uint8_t secondOperand);
-void IncrementCounter(std::vector<uint8_t>& counter);
-void TextPreprocessor(const std::string& strText, std::vector<std::vector<std::vector<uint8_t>>>& states);
-void TextPostprocessor(const std::vector<std::vector<std::vector<uint8_t>>>& states, std::string& strText);
+/* Representation of the text handed to the text processors */
+enum class TextEncoding
+{
+    Raw,
+    Hex
+};
 
-/* Counter Mode Functions */
-void CounterModeInitializer(std::vector<uint8_t>& counter);
-void EncryptionDispatcher(const std::vector<std::vector<std::vector<uint8_t>>>& states, std::vector<uint8_t> counter, std::vector<std::vector<std::vector<uint8_t>>>& encryptedStates);
-void DecryptionDispatcher(const std::vector<std::vector<std::vector<uint8_t>>>& states, std::vector<uint8_t> counter, std::vector<std::vector<std::vector<uint8_t>>>& decryptedStates);
-void EncryptionWorker(const std::vector<std::vector<uint8_t>>& state, const std::vector<uint8_t> counter, std::vector<std::vector<uint8_t>>& encryptedState);
-void DecryptionWorker(const std::vector<std::vector<uint8_t>>& state, const std::vector<uint8_t> counter, std::vector<std::vector<uint8_t>>& decryptedState);
+/* 128-bit CTR counter block laid out as nonce (8 bytes) || counter (8 bytes), most significant byte first */
+using CounterBlock = std::array<uint8_t, 16>;
 
 /********************************************************************
- ************************* Main Function ****************************
+ * Struct: AesParameters
+ * Description:
+ *  Compile-time AES parameters of a key size in bytes. The rounds of
+ *  every backend are instantiated once per key size, so Nr is a
+ *  constant there and the round loops are unrolled at compile time
  ********************************************************************/
-int main() 
+template <size_t KeySize>
+struct AesParameters
 {
-    /* Declare a string to hold the plaintext */
-    std::string plainText;
+    static_assert((KeySize == 16) || (KeySize == 24) || (KeySize == 32), "AES key size must be 16, 24 or 32 bytes");
 
-    /* Declare a string to hold the plaintext */
-    std::string cipherText;
+    /* Number of 32-bit words in the key */
+    static constexpr int Nk = static_cast<int>(KeySize / WORD_SIZE);
+    /* Number of rounds */
+    static constexpr int Nr = Nk + 6;
+    /* Number of 32-bit words in the expanded key */
+    static constexpr int scheduleWords = NUM_COLUMN * (Nr + 1);
+};
 
-    /* Declare a string to hold the plaintext */
-    std::string decryptedText;
+/* Expanded key of a given key size as 32-bit words */
+template <size_t KeySize>
+using KeySchedule = std::array<uint32_t, AesParameters<KeySize>::scheduleWords>;
 
-    /* Plain States */
-    std::vector<std::vector<std::vector<uint8_t>>> plainStates;
+/* Key schedule storage of AesKey, sized for the largest number of rounds (AES-256) */
+using RoundKeyWords = std::array<uint32_t, NUM_COLUMN * (MAX_ROUNDS + 1)>;
+using RoundKeys = std::array<std::array<uint8_t, BLOCK_SIZE>, MAX_ROUNDS + 1>;
+using BitslicedRoundKeys = std::array<std::array<uint64_t, 8>, MAX_ROUNDS + 1>;
 
-    /* Encrypted States */
-    std::vector<std::vector<std::vector<uint8_t>>> encryptedStates;
+/********************************************************************
+ * Function: Unroll
+ * Description:
+ *  Compile-time loop calling function once per index in [First,
+ *  Last), used for the rounds and for the interleaved blocks. The
+ *  index is handed over as a std::integral_constant so the body is
+ *  expanded once per index with a constant value, which lets the
+ *  compiler keep arrays indexed by it in registers
+ * Inputs:  function    - Loop body, called with the index
+ * Returns: void
+ ********************************************************************/
+template <int First, typename Function, int... Offsets>
+inline void Unroll(Function&& function, std::integer_sequence<int, Offsets...>)
+{
+    (function(std::integral_constant<int, First + Offsets>{}), ...);
+}
 
-    /* Encrypted States */
-    std::vector<std::vector<std::vector<uint8_t>>> decryptedStates;
+template <int First, int Last, typename Function>
+inline void Unroll(Function&& function)
+{
+    Unroll<First>(function, std::make_integer_sequence<int, Last - First>{});
+}
+
+/********************************************************************
+ * Function: DispatchKeySize
+ * Description:
+ *  Single point where the runtime key size is turned into the
+ *  compile-time one. function is called with a
+ *  std::integral_constant holding the key size in bytes, so it can
+ *  instantiate the cipher templates for it
+ * Inputs:  keySize     - Size of the cipher key in bytes (16, 24 or 32)
+ *          function    - Callable instantiated for each key size
+ * Returns: The result of function
+ ********************************************************************/
+template <typename Function>
+decltype(auto) DispatchKeySize(size_t keySize, Function&& function)
+{
+    switch (keySize)
+    {
+        case 16:
+            return function(std::integral_constant<size_t, 16>{});
+        case 24:
+            return function(std::integral_constant<size_t, 24>{});
+        case 32:
+            return function(std::integral_constant<size_t, 32>{});
+        default:
+            throw std::invalid_argument("AES key size must be 16, 24 or 32 bytes.");
+    }
+}
 
-    /* Declare a vector to hold the original counter for the CTR Mode of Operation */
-    std::vector<uint8_t> counter;
+/********************************************************************
+ * Struct: BlockView / ConstBlockView
+ * Description:
+ *  Non-owning view over a run of consecutive 16-byte states stored
+ *  contiguously in memory. State i starts at data + i * BLOCK_SIZE.
+ *  length is the number of message bytes covered by the view, so
+ *  the last state may be a partial one
+ ********************************************************************/
+struct BlockView
+{
+    uint8_t* data;
+    size_t blocksNumber;
+    size_t length;
 
-    /* Take input string from the user */
-    std::cout << "Enter the Plain Text: ";
-    std::cin >> plainText;
+    uint8_t* Block(size_t index) const { return data + index * BLOCK_SIZE; }
+    BlockView Slice(size_t first, size_t count) const
+    {
+        return BlockView{Block(first), count, std::min<size_t>(count * BLOCK_SIZE, length - first * BLOCK_SIZE)};
+    }
+};
 
-    /* Initialize the counter for AES CTR Mode encryption */
-    CounterModeInitializer(counter);
+struct ConstBlockView
+{
+    const uint8_t* data;
+    size_t blocksNumber;
+    size_t length;
 
-    /* Transform the input */
-    TextPreprocessor(plainText, plainStates);
+    ConstBlockView(const uint8_t* viewData, size_t viewLength)
+        : data(viewData), blocksNumber((viewLength + BLOCK_SIZE - 1) / BLOCK_SIZE), length(viewLength) {}
+    ConstBlockView(const BlockView& view) : data(view.data), blocksNumber(view.blocksNumber), length(view.length) {}
 
-    /* Reserve memory for the Encrypted states */
-    encryptedStates.resize(plainStates.size());
-    for (int i = 0; i < plainStates.size(); ++i) 
+    const uint8_t* Block(size_t index) const { return data + index * BLOCK_SIZE; }
+    ConstBlockView Slice(size_t first, size_t count) const
     {
-        encryptedStates[i].resize(4);
-        for (int j = 0; j < 4; ++j) 
-        {
-            encryptedStates[i][j].resize(4);
-        }
+        return ConstBlockView(Block(first), std::min<size_t>(count * BLOCK_SIZE, length - first * BLOCK_SIZE));
     }
+};
+
+/********************************************************************
+ * Class: BlockBuffer
+ * Description:
+ *  Owning buffer holding a whole message as one cache-line aligned
+ *  contiguous allocation. The capacity is always rounded up to a
+ *  whole number of states and the bytes past the message length are
+ *  zeroed, but only Length() bytes belong to the message
+ ********************************************************************/
+class BlockBuffer
+{
+public:
+    BlockBuffer();
+    explicit BlockBuffer(size_t length);
+    ~BlockBuffer();
 
+    BlockBuffer(BlockBuffer&& other) noexcept;
+    BlockBuffer& operator=(BlockBuffer&& other) noexcept;
+    BlockBuffer(const BlockBuffer&) = delete;
+    BlockBuffer& operator=(const BlockBuffer&) = delete;
 
-    /* Initiate the Encryption Dispatcher */
-    EncryptionDispatcher(plainStates, counter, encryptedStates);
+    void Resize(size_t length);
+    uint8_t* Data() { return data; }
+    const uint8_t* Data() const { return data; }
+    size_t Length() const { return length; }
+    size_t BlocksNumber() const { return (length + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+    BlockView View() { return BlockView{data, BlocksNumber(), length}; }
+    ConstBlockView View() const { return ConstBlockView(data, length); }
 
-    /* Transform the Encrypted States from 3D into a 1D vector for printing */
-    TextPostprocessor(encryptedStates, cipherText);
+private:
+    void Release();
 
-    /* Print the ciphertext */
-    std::cout << "Cipher Text: " << cipherText << std::endl;
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+};
 
-    /* Clear the encrypted states vector for decryption */
-    encryptedStates.clear();
+/********************************************************************
+ * Class: AesKey
+ * Description:
+ *  AES key context. The key schedule is expanded once when the
+ *  object is constructed and then shared read-only by all the
+ *  workers. Both the encryption schedule and the decryption schedule
+ *  of the equivalent inverse cipher (FIPS-197 section 5.3.5) are kept
+ *  as 32-bit words and as 16-byte round keys in aligned storage.
+ *  The bitsliced backend additionally gets its encryption round keys
+ *  in bitsliced form. The key also records which backend implements
+ *  its rounds. The expansion itself is instantiated per key size
+ *  through DispatchKeySize
+ ********************************************************************/
+class AesKey
+{
+public:
+    AesKey(const uint8_t* key, size_t keySize, AesBackend backend = AesBackend::Automatic);
+    ~AesKey();
 
-    /* Preprocess the ciphertext */
-    TextPreprocessor(cipherText, encryptedStates);
+    AesBackend Backend() const { return backend; }
+    size_t KeySize() const { return keySize; }
+    int Rounds() const { return rounds; }
+    const uint32_t* EncryptionWords() const { return encryptionWords.data(); }
+    const uint32_t* DecryptionWords() const { return decryptionWords.data(); }
+    const uint8_t* EncryptionRoundKey(int round) const { return encryptionRoundKeys[round].data(); }
+    const uint8_t* DecryptionRoundKey(int round) const { return decryptionRoundKeys[round].data(); }
+    const uint64_t* BitslicedRoundKey(int round) const { return bitslicedRoundKeys[round].data(); }
 
-    /* Reserve memory for the decrypted states */
-    decryptedStates.resize(encryptedStates.size());
-    for (int i = 0; i < encryptedStates.size(); ++i) 
-    {
-        decryptedStates[i].resize(4);
-        for (int j = 0; j < 4; ++j) 
-        {
-            decryptedStates[i][j].resize(4);
-        }
-    }
+private:
+    template <size_t KeySize>
+    void Expand(const uint8_t* key);
 
-    /* Initiate the Encryption Dispatcher */
-    DecryptionDispatcher(encryptedStates, counter, decryptedStates);
+    AesBackend backend;
+    size_t keySize;
+    int rounds;
+    alignas(BUFFER_ALIGNMENT) RoundKeyWords encryptionWords;
+    alignas(BUFFER_ALIGNMENT) RoundKeyWords decryptionWords;
+    alignas(BUFFER_ALIGNMENT) RoundKeys encryptionRoundKeys;
+    alignas(BUFFER_ALIGNMENT) RoundKeys decryptionRoundKeys;
+    alignas(BUFFER_ALIGNMENT) BitslicedRoundKeys bitslicedRoundKeys;
+};
 
-    /* Transform the Encrypted States from 3D into a 1D vector for printing */
-    TextPostprocessor(decryptedStates, decryptedText);
+/********************************************************************
+ * Class: AesCtrStream
+ * Description:
+ *  Incremental AES-CTR context. Init binds it to an expanded key and
+ *  an initial counter block (nonce || counter), Update processes any
+ *  number of bytes and can be called repeatedly, and Final wipes the
+ *  context. The keystream bytes left over from a partial block are
+ *  carried to the next Update, so splitting a message into arbitrary
+ *  pieces gives the same output as processing it at once. Memory use
+ *  does not depend on the message size. Encryption and decryption
+ *  are the same operation. Seek moves to any byte offset of the
+ *  message in constant time, since the counter of every block is
+ *  derived arithmetically from the initial counter
+ ********************************************************************/
+class AesCtrStream
+{
+public:
+    AesCtrStream();
+    ~AesCtrStream();
 
-    /* Print the decryptedText */
-    std::cout << "Decypted Text: " << decryptedText << std::endl;
+    AesCtrStream(const AesCtrStream&) = delete;
+    AesCtrStream& operator=(const AesCtrStream&) = delete;
 
-    return 0;
-}
+    void Init(const AesKey& key, const CounterBlock& nonce);
+    void Seek(uint64_t offset);
+    void Update(const uint8_t* input, uint8_t* output, size_t length);
+    void Final();
+
+private:
+    const AesKey* key;
+    CounterBlock initialCounter;
+    CounterBlock counter;
+    alignas(BLOCK_SIZE) uint8_t keystream[BLOCK_SIZE];
+    size_t keystreamUsed;
+};
+
+/* Outcome of an asynchronous CTR job. Cancelled means at least one piece was skipped, so the output
+   is only partially processed and must not be used */
+enum class AesJobStatus
+{
+    Completed,
+    Cancelled
+};
 
 /********************************************************************
- ********************** Encryption Functions ************************
+ * Class: AesCtrAwaitable
+ * Description:
+ *  C++20 awaitable running a CTR job on the worker pool. co_await
+ *  suspends the coroutine without blocking its thread and yields the
+ *  AesJobStatus of the job. The coroutine is resumed on the worker
+ *  that finishes the job; synchronous dispatcher calls made from
+ *  there keep that worker processing ranges while they wait (see
+ *  WorkerPool::ParallelFor). The key and both views must stay valid
+ *  until it resumes
  ********************************************************************/
+class AesCtrAwaitable
+{
+public:
+    AesCtrAwaitable(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates,
+                    std::stop_token stopToken = {});
+
+    bool await_ready() const noexcept;
+    void await_suspend(std::coroutine_handle<> handle);
+    AesJobStatus await_resume() const noexcept;
+
+private:
+    const AesKey& key;
+    ConstBlockView states;
+    CounterBlock counter;
+    BlockView outputStates;
+    std::stop_token stopToken;
+    AesJobStatus status;
+};
+
 /********************************************************************
- * Function: AddRoundKey
+ * Struct: GhashKey
  * Description:
- *  This function performs AddRoundKey step in AES. It XORs the 
- *  state matrix with the round key
- * Inputs:  state       - Refernece to Input State Matrix (4x4)
- *          roundKey    - Round Key
- * Outputs: state       - Refernece to Output State Matrix (4x4)
- * Returns: void
+ *  Precomputed multiples of the GHASH subkey H = E(K, 0^128). The
+ *  Shoup backend keeps the products of H by every 4-bit value split
+ *  in 64-bit halves, so a multiplication by H is 32 table lookups.
+ *  The PCLMULQDQ backend keeps H^1..H^GHASH_AGGREGATION with the byte
+ *  order reversed, so that GHASH_AGGREGATION blocks are multiplied by
+ *  their powers of H and reduced once
  ********************************************************************/
-void AddRoundKey(uint8_t state[4][4], const std::vector<uint8_t>& roundKey) 
+struct GhashKey
 {
-    for (int row = 0; row < 4; ++row) {  // Iterate through each row of the state matrix
-        for (int col = 0; col < 4; ++col) {  // Iterate through each column of the state matrix
-            state[row][col] ^= roundKey[row * 4 + col]; // XOR the state byte with the corresponding round key byte
-        }
-    }
-}
+    GhashBackend backend;
+    uint64_t shoupHigh[16];
+    uint64_t shoupLow[16];
+    alignas(BLOCK_SIZE) uint8_t clmulPowers[GHASH_AGGREGATION][BLOCK_SIZE];
+};
+
+/********************************************************************
+ * Class: AesGcm
+ * Description:
+ *  AES-GCM authenticated encryption (NIST SP 800-38D) built on the
+ *  CTR engine. The data is processed in a single pass: every chunk
+ *  of KEYSTREAM_BLOCKS blocks is encrypted with the keystream and
+ *  hashed with GHASH while it is still in L1, instead of running a
+ *  CTR pass and a MAC pass over the whole message. The key is
+ *  referenced, not copied, so it must outlive the context.
+ *  Decrypt returns false and wipes the output when the tag does not
+ *  match
+ ********************************************************************/
+class AesGcm
+{
+public:
+    explicit AesGcm(const AesKey& key, GhashBackend backend = GhashBackend::Automatic);
+    ~AesGcm();
+
+    AesGcm(const AesGcm&) = delete;
+    AesGcm& operator=(const AesGcm&) = delete;
 
+    void Encrypt(const uint8_t* iv, size_t ivLength, const uint8_t* aad, size_t aadLength,
+                 const uint8_t* input, uint8_t* output, size_t length, uint8_t* tag) const;
+    bool Decrypt(const uint8_t* iv, size_t ivLength, const uint8_t* aad, size_t aadLength,
+                 const uint8_t* input, uint8_t* output, size_t length, const uint8_t* tag) const;
+
+private:
+    void Process(const uint8_t* iv, size_t ivLength, const uint8_t* aad, size_t aadLength,
+                 const uint8_t* input, uint8_t* output, size_t length, bool encrypt, uint8_t* tag) const;
+
+    const AesKey& key;
+    GhashKey ghashKey;
+};
+
+/* Placement of the threads of a worker pool:
+   None      - threads are left to the OS scheduler
+   Compact   - thread i is pinned to the i-th usable CPU
+   Numa      - threads are spread evenly over the NUMA nodes and pinned to CPUs of their node, each
+               node gets its own task queue so ranges can be routed to the node holding their pages
+   Automatic - Numa on a machine with several NUMA nodes, None otherwise */
+enum class WorkerPlacement
+{
+    Automatic,
+    None,
+    Compact,
+    Numa
+};
+
+/* Usable CPUs (within the affinity mask) of every NUMA node that has any, node by node */
+struct NumaTopology
+{
+    std::vector<std::vector<int>> nodeCpus;
+};
 
 /********************************************************************
- * Function: SubBytes
+ * Class: WorkerPool
  * Description:
- *  This function performs the SubBytes transformation step in AES.
- *  It substitutes each byte in the state matrix with a corresponding
- *  byte from the AES S-box.
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Outputs: state   - Refernece to Output State Matrix (4x4)
- * Returns: void
+ *  Long-lived pool of worker threads created once for the lifetime
+ *  of the program. Tasks submitted to the pool are queued and picked
+ *  up by the first idle worker, so the dispatchers never pay the cost
+ *  of creating and joining a thread per state.
+ *  With the Numa placement there is one queue per node and a task
+ *  submitted to a node only runs on that node's workers. Worker
+ *  slots are numbered node by node, and NodeOfRange maps range r of
+ *  n equal ranges to the node owning slot r * threads / n, so every
+ *  partition of a buffer into equal ranges sends each part to the
+ *  same node.
+ *  ParallelFor runs block ranges through a work-stealing scheduler:
+ *  every worker owns a deque of ranges, pops the newest one itself
+ *  and, once its deque is empty, steals the oldest range of another
+ *  worker (same node first). A worker running a large range splits
+ *  its upper half back onto its deque whenever some worker is idle,
+ *  so a huge message keeps every core busy even while other
+ *  messages arrive, and a small message queued behind it is picked
+ *  up first by the LIFO owner or stolen by an idle worker.
+ *  ParallelForAsync does the same without waiting: its completion
+ *  runs on the worker that finishes the last piece. A worker calling
+ *  ParallelFor (e.g. a coroutine resumed by a completion) keeps
+ *  running queued ranges until its job is done instead of blocking,
+ *  so such calls cannot starve the pool of its own threads
  ********************************************************************/
-void SubBytes(uint8_t state[4][4]) {
-    // The AES S-box (Substitution Box) is a predefined lookup table used in SubBytes.
-    // This is a standard, constant table defined by the AES specification.
-    // Declaring it as 'static const' helps optimization and avoids redundant copies.
-    const uint8_t sbox[16][16] = {
-        {0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76},
-        {0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0},
-        {0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15},
-        {0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75},
-        {0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84},
-        {0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf},
-        {0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8},
-        {0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2},
-        {0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73},
-        {0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb},
-        {0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79},
-        {0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08},
-        {0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a},
-        {0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e},
-        {0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf},
-        {0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16}
+class WorkerPool
+{
+public:
+    explicit WorkerPool(size_t threadsNumber, WorkerPlacement placement = WorkerPlacement::None,
+                        const NumaTopology* topology = nullptr);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void Submit(std::function<void()> task, size_t node = 0);
+    void ParallelFor(uint64_t count, uint64_t grain, const std::function<void(uint64_t, uint64_t)>& body);
+    void ParallelForAsync(uint64_t count, uint64_t grain, std::function<void(uint64_t, uint64_t)> body,
+                          std::function<void()> completion);
+    size_t ThreadsNumber() const;
+    size_t NodesNumber() const;
+    size_t NodeOfRange(size_t range, size_t rangesNumber) const;
+
+private:
+    /* One ParallelFor call: body runs on [first, last) pieces of at most grain items, then completion
+       runs once. The job is owned by the scheduler and deleted after its completion */
+    struct RangeJob
+    {
+        std::function<void(uint64_t, uint64_t)> body;
+        std::function<void()> completion;
+        uint64_t grain;
+        std::atomic<uint64_t> itemsLeft;
     };
 
-    // Iterate over each byte of the state matrix
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            // Get the current byte from the state matrix
-            uint8_t currentByte = state[row][col];
-            // Use the high nibble (upper 4 bits) as the row index for the S-box
-            uint8_t sboxRow = currentByte >> 4;
-            // Use the low nibble (lower 4 bits) as the column index for the S-box
-            uint8_t sboxCol = currentByte & 0x0f;
-            // Substitute the current byte with the value from the S-box
-            state[row][col] = sbox[sboxRow][sboxCol];
-        }
-    }
-}
+    /* Part [first, last) of a job waiting in a worker deque */
+    struct RangeTask
+    {
+        RangeJob* job;
+        uint64_t first;
+        uint64_t last;
+    };
+
+    /* Ranges owned by one worker, the owner works at the back and thieves at the front */
+    struct WorkerDeque
+    {
+        std::mutex rangesMutex;
+        std::deque<RangeTask> ranges;
+    };
+
+    void WorkerLoop(size_t slot, int cpu);
+    void PushRange(size_t slot, const RangeTask& range, bool notify);
+    bool PopRange(size_t slot, RangeTask& range);
+    bool StealRange(size_t slot, RangeTask& range);
+    void RunRange(size_t slot, RangeTask range);
 
+    std::vector<std::thread> workers;
+    std::vector<size_t> workerNodes;
+    std::vector<size_t> nodeFirstSlots;
+    std::vector<std::deque<std::function<void()>>> queues;
+    std::vector<WorkerDeque> deques;
+    std::atomic<size_t> queuedRanges;
+    std::atomic<size_t> idleWorkers;
+    std::mutex tasksMutex;
+    std::condition_variable workAvailable;
+    bool stopping;
 
+    /* Pool and slot of the calling thread when it is a worker, nullptr otherwise */
+    inline static thread_local WorkerPool* currentPool = nullptr;
+    inline static thread_local size_t currentSlot = 0;
+};
 
 /********************************************************************
- * Function: ShiftRows
+ * Class: BoundedQueue
  * Description:
- *  This function performs the ShiftRows transformation in AES. It
- *  cyclically shifts the bytes in each row of the state matrix.
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Outputs: state   - Refernece to Output State Matrix (4x4)
- * Returns: void
+ *  Fixed-capacity lock-free ring buffer between exactly one producer
+ *  thread and one consumer thread. Push blocks while the queue is
+ *  full and Pop blocks while it is empty, waiting on the atomic
+ *  indices themselves (C++20 atomic wait), which gives the pipeline
+ *  stages backpressure without a mutex
  ********************************************************************/
-void ShiftRows(uint8_t state[4][4])
+template <typename T, size_t Capacity>
+class BoundedQueue
 {
-    uint8_t rowTemp[4];
-    // Row 0: No Shift
+public:
+    BoundedQueue() : head(0), tail(0) {}
 
-    // Row 1: Shift left by 1
-    for (int col = 0; col < 4; col++) {
-        rowTemp[col] = state[1][(col + 1) % 4]; // Store the shifted byte in a temporary variable
-    }
-    for (int col = 0; col < 4; col++) {
-        state[1][col] = rowTemp[col];  // Copy the shifted bytes back to row 1
+    void Push(T item)
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        size_t currentHead = head.load(std::memory_order_acquire);
+        while (currentTail - currentHead == Capacity)
+        {
+            head.wait(currentHead, std::memory_order_acquire);
+            currentHead = head.load(std::memory_order_acquire);
+        }
+        slots[currentTail % Capacity] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        tail.notify_one();
     }
 
-    // Row 2: Shift left by 2
-    for (int col = 0; col < 4; col++) {
-        rowTemp[col] = state[2][(col + 2) % 4]; // Store the shifted byte in a temporary variable
-    }
-    for (int col = 0; col < 4; col++) {
-        state[2][col] = rowTemp[col];  // Copy the shifted bytes back to row 2
+    T Pop()
+    {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        size_t currentTail = tail.load(std::memory_order_acquire);
+        while (currentTail == currentHead)
+        {
+            tail.wait(currentTail, std::memory_order_acquire);
+            currentTail = tail.load(std::memory_order_acquire);
+        }
+        T item = slots[currentHead % Capacity];
+        head.store(currentHead + 1, std::memory_order_release);
+        head.notify_one();
+        return item;
     }
-    
-    // Row 3: Shift left by 3
-    for (int col = 0; col < 4; col++) {
-        rowTemp[col] = state[3][(col + 3) % 4]; // Store the shifted byte in a temporary variable
+
+private:
+    std::array<T, Capacity> slots;
+    alignas(BUFFER_ALIGNMENT) std::atomic<size_t> head;
+    alignas(BUFFER_ALIGNMENT) std::atomic<size_t> tail;
+};
+
+#if AES_IO_URING
+/********************************************************************
+ * Class: IoUring
+ * Description:
+ *  Minimal io_uring instance driven through the raw system calls.
+ *  It owns the submission and completion rings mapped from the
+ *  kernel; submission queue entries are filled with NextSqe and sent
+ *  in one batch by Submit, completions are reaped with PopCompletion
+ *  and Drain waits out the requests still in flight before the
+ *  buffers they use are released
+ ********************************************************************/
+class IoUring
+{
+public:
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool RegisterBuffers(const struct iovec* buffers, unsigned buffersNumber);
+    struct io_uring_sqe* NextSqe();
+    void Submit(unsigned waitCompletions);
+    bool PopCompletion(uint64_t& userData, int32_t& result);
+    void Drain(unsigned inFlight) noexcept;
+
+private:
+    int ringFile;
+    unsigned pendingSubmissions;
+    void* submissionRing;
+    size_t submissionRingSize;
+    void* completionRing;
+    size_t completionRingSize;
+    struct io_uring_sqe* submissionEntries;
+    size_t submissionEntriesSize;
+    unsigned* submissionHead;
+    unsigned* submissionTail;
+    unsigned* submissionMask;
+    unsigned* submissionArray;
+    unsigned submissionEntriesNumber;
+    unsigned* completionHead;
+    unsigned* completionTail;
+    unsigned* completionMask;
+    struct io_uring_cqe* completionEntries;
+};
+#endif
+
+#if AES_POSIX
+/********************************************************************
+ * Class: FileDescriptor
+ * Description:
+ *  Owner of an open file descriptor, closed when the object goes
+ *  away. Close closes it early and reports the result, for the
+ *  output file whose close may be the first to see a write error
+ ********************************************************************/
+class FileDescriptor
+{
+public:
+    explicit FileDescriptor(int file) : file(file) {}
+    ~FileDescriptor();
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int Get() const { return file; }
+    bool Close();
+
+private:
+    int file;
+};
+
+/********************************************************************
+ * Class: FileMapping
+ * Description:
+ *  Shared mapping of a window of a file, unmapped when the object
+ *  goes away. The constructor throws if the window cannot be mapped
+ ********************************************************************/
+class FileMapping
+{
+public:
+    FileMapping(int file, uint64_t offset, size_t length, int protection, const std::string& path);
+    ~FileMapping();
+
+    FileMapping(const FileMapping&) = delete;
+    FileMapping& operator=(const FileMapping&) = delete;
+
+    uint8_t* Data() const { return data; }
+
+private:
+    uint8_t* data;
+    size_t length;
+};
+#endif
+
+/* Buffer travelling through the streaming pipeline. A zero length marks the end of the stream */
+struct PipelineBuffer
+{
+    BlockBuffer data;
+    size_t length;
+};
+
+#if AES_INSTRUMENTATION
+/* Instrumented stages of the CTR path, in the order a message goes through them */
+enum class InstrumentedStage
+{
+    CounterInit,
+    TextPreprocess,
+    Dispatch,
+    Worker,
+    TextPostprocess,
+    Count
+};
+
+/* Instrumented waits: workers sleeping on an empty queue and dispatchers blocked on their ranges */
+enum class InstrumentedWait
+{
+    WorkerIdle,
+    DispatcherWait,
+    Count
+};
+
+/* Accumulated counters of one stage. Monotonic time in nanoseconds */
+struct StageCounters
+{
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> nanoseconds;
+    std::atomic<uint64_t> blocks;
+    std::atomic<uint64_t> bytes;
+};
+
+/********************************************************************
+ * Struct: InstrumentationCounters
+ * Description:
+ *  Process-wide instrumentation counters. Every counter is a relaxed
+ *  atomic updated once per stage call (once per range for the
+ *  workers, never per block), so the workers can update them
+ *  concurrently without a lock. Allocations are the message buffer
+ *  and output text allocations made by the engine itself
+ ********************************************************************/
+struct InstrumentationCounters
+{
+    StageCounters stages[static_cast<size_t>(InstrumentedStage::Count)];
+    std::atomic<uint64_t> waitNanoseconds[static_cast<size_t>(InstrumentedWait::Count)];
+    std::atomic<uint64_t> tasksSubmitted;
+    std::atomic<uint64_t> rangesStolen;
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> allocatedBytes;
+};
+
+/********************************************************************
+ * Class: InstrumentationTimer
+ * Description:
+ *  Scoped monotonic timer. It adds the time elapsed between its
+ *  construction and its destruction to a stage (counting one call)
+ *  or to a wait counter
+ ********************************************************************/
+class InstrumentationTimer
+{
+public:
+    explicit InstrumentationTimer(InstrumentedStage stage);
+    explicit InstrumentationTimer(InstrumentedWait wait);
+    ~InstrumentationTimer();
+
+    InstrumentationTimer(const InstrumentationTimer&) = delete;
+    InstrumentationTimer& operator=(const InstrumentationTimer&) = delete;
+
+private:
+    std::atomic<uint64_t>* target;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define AES_STAGE_TIMER(stage)                  InstrumentationTimer stageTimer(stage)
+#define AES_WAIT_TIMER(wait)                    InstrumentationTimer waitTimer(wait)
+#define AES_STAGE_COUNT(stage, blocks, bytes)   CountStage(stage, blocks, bytes)
+#define AES_COUNT_ALLOCATION(bytes)             CountAllocation(bytes)
+#define AES_COUNT_TASK()                        CountTask()
+#define AES_COUNT_STEAL()                       CountSteal()
+#else
+#define AES_STAGE_TIMER(stage)
+#define AES_WAIT_TIMER(wait)
+#define AES_STAGE_COUNT(stage, blocks, bytes)
+#define AES_COUNT_ALLOCATION(bytes)
+#define AES_COUNT_TASK()
+#define AES_COUNT_STEAL()
+#endif
+
+
+
+/********************************************************************
+ ************************* Prototypes *******************************
+ ********************************************************************/
+/* Encryption Functions */
+void AddRoundKey(uint8_t state[4][4], const uint8_t* roundKey);
+void SubBytes(uint8_t state[4][4]);
+void ShiftRows(uint8_t state[4][4]);
+
+uint32_t SubWord(uint32_t word);
+uint32_t RotWord(uint32_t word);
+template <size_t KeySize>
+KeySchedule<KeySize> KeyExpansion(const uint8_t* key);
+void PrintExpandedKey(const uint32_t* w, int size);
+
+
+/* Decryption functions (MixColumns and InvMixColumns come from GaloisField.h) */
+void InvSubBytes(uint8_t state[4][4]);
+void InvShiftRows(uint8_t state[4][4]);
+
+/* Block Cipher Functions */
+AesBackend SelectAesBackend(AesBackend requested);
+void AesEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+void AesDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+void AesEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+void AesDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+template <int Nr> AES_FLATTEN void ReferenceEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+template <int Nr> AES_FLATTEN void ReferenceDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+template <int Nr> AES_FLATTEN void TTableEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+template <int Nr> AES_FLATTEN void TTableDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+template <int Nr> void TTableEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+template <int Nr> void TTableDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+#if AES_X86
+template <size_t KeySize> AES_TARGET("aes,sse2") void AesNiKeyExpansion(const uint8_t* key, RoundKeys& encryptionRoundKeys, RoundKeys& decryptionRoundKeys);
+template <int Nr> AES_TARGET("aes,sse2") AES_FLATTEN void AesNiEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+template <int Nr> AES_TARGET("aes,sse2") AES_FLATTEN void AesNiDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output);
+template <int Nr> void AesNiEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+template <int Nr> void AesNiDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+#endif
+template <int Nr> void BitslicedKeySchedule(const RoundKeys& roundKeys, BitslicedRoundKeys& bitslicedRoundKeys);
+template <int Nr> void BitslicedEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+template <int Nr> void BitslicedDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+
+/* Prining Functions */
+void printState(uint8_t state[4][4]);
+
+/* Utility Functions */
+void IncrementCounter(CounterBlock& counter);
+uint32_t LoadWordBigEndian(const uint8_t* bytes);
+void StoreWordBigEndian(uint32_t word, uint8_t* bytes);
+const CpuFeatures& GetCpuFeatures();
+void CounterAdd(const CounterBlock& counter, uint64_t offset, CounterBlock& result);
+void TextPreprocessor(const std::string& strText, BlockBuffer& states, TextEncoding encoding);
+void TextPostprocessor(ConstBlockView states, std::string& strText, TextEncoding encoding);
+void XorBytes(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t length);
+#if AES_X86
+void XorBytesAvx2(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t length);
+#endif
+
+/* Worker Pool Functions */
+WorkerPool& GetWorkerPool();
+size_t DetectCpuCount();
+const NumaTopology& GetNumaTopology();
+std::vector<int> ParseCpuList(const std::string& strList);
+void PinCurrentThread(int cpu);
+void FirstTouchDispatcher(WorkerPool& pool, uint8_t* data, size_t length);
+
+/* Hex Codec Functions */
+void HexEncode(const uint8_t* input, size_t length, char* output);
+bool HexDecode(const char* input, size_t length, uint8_t* output);
+#if AES_X86
+void HexEncodeSsse3(const uint8_t* input, size_t length, char* output);
+void HexEncodeAvx2(const uint8_t* input, size_t length, char* output);
+bool HexDecodeSsse3(const char* input, size_t length, uint8_t* output);
+bool HexDecodeAvx2(const char* input, size_t length, uint8_t* output);
+#endif
+
+/* Counter Mode Functions */
+void CounterModeInitializer(CounterBlock& counter);
+void StatesDispatcher(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates);
+void StatesDispatcher(WorkerPool& pool, const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates);
+uint64_t DispatchGrainBlocks(const AesKey& key);
+void EncryptionDispatcher(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView encryptedStates);
+void DecryptionDispatcher(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView decryptedStates);
+void GenerateKeystream(const AesKey& key, CounterBlock& counter, uint8_t* keystream, size_t blocksNumber);
+void CounterModeWorker(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates);
+
+/* Counter Mode Stream Functions */
+void SecureZero(void* data, size_t length);
+void DecryptRange(const AesKey& key, const CounterBlock& nonce, uint64_t offset, const uint8_t* input, uint8_t* output, size_t length);
+
+/* Asynchronous Counter Mode Functions */
+void StatesDispatcherAsync(WorkerPool& pool, const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates,
+                           std::stop_token stopToken, std::function<void(AesJobStatus)> completion);
+std::future<AesJobStatus> EncryptionDispatcherAsync(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView encryptedStates,
+                                                    std::function<void(AesJobStatus)> completion = nullptr, std::stop_token stopToken = {});
+std::future<AesJobStatus> DecryptionDispatcherAsync(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView decryptedStates,
+                                                    std::function<void(AesJobStatus)> completion = nullptr, std::stop_token stopToken = {});
+
+/* GHASH Functions */
+GhashBackend SelectGhashBackend(GhashBackend requested);
+void GhashInit(const uint8_t* subkey, GhashBackend backend, GhashKey& ghashKey);
+void GhashUpdate(const GhashKey& ghashKey, uint8_t* state, const uint8_t* data, size_t length);
+void GhashShoupBlocks(const GhashKey& ghashKey, uint8_t* state, const uint8_t* data, size_t blocksNumber);
+#if AES_X86
+void GhashClmulInit(GhashKey& ghashKey, const uint8_t* subkey);
+void GhashClmulBlocks(const GhashKey& ghashKey, uint8_t* state, const uint8_t* data, size_t blocksNumber);
+#endif
+
+/* GCM Functions */
+void GcmGenerateKeystream(const AesKey& key, const uint8_t* preCounter, uint32_t counter, uint8_t* keystream, size_t blocksNumber);
+
+#if AES_INSTRUMENTATION
+/* Instrumentation Functions */
+void CountStage(InstrumentedStage stage, uint64_t blocks, uint64_t bytes);
+void CountAllocation(uint64_t bytes);
+void CountTask();
+void CountSteal();
+void DumpInstrumentation(std::ostream& output);
+void ResetInstrumentation();
+#endif
+
+/* File Mode Functions */
+void FileDispatcher(const AesKey& key, const CounterBlock& counter, const std::string& inputPath, const std::string& outputPath);
+void ParseCounter(const std::string& strCounter, CounterBlock& counter);
+
+#if AES_IO_URING
+/* io_uring Functions */
+bool IoUringFileDispatcher(const AesKey& key, const CounterBlock& counter, int inputFile, int outputFile, uint64_t fileSize);
+#endif
+
+/* Pipeline Functions */
+void PipelineDispatcher(const AesKey& key, const CounterBlock& counter, std::istream& input, std::ostream& output);
+void RunPipeline(std::istream& input, std::ostream& output, const std::function<void(uint8_t*, size_t)>& process);
+void PipelineFileDispatcher(const AesKey& key, const CounterBlock& counter, const std::string& inputPath, const std::string& outputPath);
+
+/********************************************************************
+ ************************* Main Function ****************************
+ ********************************************************************/
+int main(int argc, char* argv[]) 
+{
+    /* File mode: AES_CTR <input file> <output file> [counter as 32 hex digits], "-" is stdin/stdout */
+    if (argc >= 3)
+    {
+        AesKey fileKey(exampleKey, sizeof(exampleKey));
+        CounterBlock fileCounter;
+
+        /* Bad arguments and failed system calls are reported and turned into the exit status */
+        try
+        {
+            /* Encryption starts from a fresh counter, decryption reuses the one printed by the encryption */
+            if (argc >= 4)
+            {
+                ParseCounter(argv[3], fileCounter);
+            }
+            else
+            {
+                CounterModeInitializer(fileCounter);
+            }
+
+            FileDispatcher(fileKey, fileCounter, argv[1], argv[2]);
+        }
+        catch (const std::exception& error)
+        {
+            std::cerr << "AES_CTR: " << error.what() << std::endl;
+            return 1;
+        }
+
+        /* Keep stdout clean when it carries the output data */
+        char strCounter[2 * sizeof(fileCounter)];
+        HexEncode(fileCounter.data(), fileCounter.size(), strCounter);
+        std::ostream& report = (std::string(argv[2]) == "-") ? std::cerr : std::cout;
+        report << "Counter: " << std::string(strCounter, sizeof(strCounter)) << std::endl;
+        return 0;
+    }
+
+    /* Declare a string to hold the plaintext */
+    std::string plainText;
+
+    /* Declare a string to hold the plaintext */
+    std::string cipherText;
+
+    /* Declare a string to hold the plaintext */
+    std::string decryptedText;
+
+    /* Plain States */
+    BlockBuffer plainStates;
+
+    /* Encrypted States */
+    BlockBuffer encryptedStates;
+
+    /* Decrypted States */
+    BlockBuffer decryptedStates;
+
+    /* Declare the original counter block for the CTR Mode of Operation */
+    CounterBlock counter;
+
+    /* Take input line from the user */
+    std::cout << "Enter the Plain Text: ";
+    std::getline(std::cin, plainText);
+
+    /* Expand the key schedule once for all the states */
+    AesKey key(exampleKey, sizeof(exampleKey));
+
+    /* Initialize the counter for AES CTR Mode encryption */
+    CounterModeInitializer(counter);
+
+    /* Transform the input */
+    TextPreprocessor(plainText, plainStates, TextEncoding::Raw);
+
+    /* Reserve memory for the Encrypted states in a single allocation */
+    encryptedStates.Resize(plainStates.Length());
+
+    /* Initiate the Encryption Dispatcher */
+    EncryptionDispatcher(key, plainStates.View(), counter, encryptedStates.View());
+
+    /* Transform the Encrypted States into text for printing */
+    TextPostprocessor(encryptedStates.View(), cipherText, TextEncoding::Hex);
+
+    /* Print the ciphertext */
+    std::cout << "Cipher Text: " << cipherText << std::endl;
+
+    /* Preprocess the ciphertext back from its hex form */
+    TextPreprocessor(cipherText, encryptedStates, TextEncoding::Hex);
+
+    /* Reserve memory for the decrypted states in a single allocation */
+    decryptedStates.Resize(encryptedStates.Length());
+
+    /* Initiate the Encryption Dispatcher */
+    DecryptionDispatcher(key, encryptedStates.View(), counter, decryptedStates.View());
+
+    /* Transform the Decrypted States into text for printing */
+    TextPostprocessor(decryptedStates.View(), decryptedText, TextEncoding::Raw);
+
+    /* Print the decryptedText */
+    std::cout << "Decypted Text: " << decryptedText << std::endl;
+
+    /* Authenticated encryption of the same text with AES-GCM. GCM block j uses IV || (j + 2), which is
+       CTR block j + 2 when the IV is taken from the counter, so the IV must be drawn independently */
+    AesGcm gcm(key);
+    std::array<uint8_t, GCM_IV_SIZE> gcmIv;
+    std::random_device rd;
+    for (uint8_t& ivByte : gcmIv)
+    {
+        ivByte = static_cast<uint8_t>(rd());
+    }
+    std::vector<uint8_t> gcmText(plainText.size());
+    uint8_t tag[GCM_TAG_SIZE];
+    gcm.Encrypt(gcmIv.data(), gcmIv.size(), nullptr, 0,
+                reinterpret_cast<const uint8_t*>(plainText.data()), gcmText.data(), gcmText.size(), tag);
+
+    std::string strGcm(2 * gcmText.size(), '\0');
+    char strTag[2 * GCM_TAG_SIZE];
+    HexEncode(gcmText.data(), gcmText.size(), strGcm.data());
+    HexEncode(tag, sizeof(tag), strTag);
+    std::cout << "GCM Cipher Text: " << strGcm << std::endl;
+    std::cout << "GCM Tag: " << std::string(strTag, sizeof(strTag)) << std::endl;
+
+    /* Decryption authenticates the ciphertext before releasing it */
+    bool authentic = gcm.Decrypt(gcmIv.data(), gcmIv.size(), nullptr, 0, gcmText.data(), gcmText.data(), gcmText.size(), tag);
+    std::cout << "GCM Decrypted Text: " << (authentic ? std::string(gcmText.begin(), gcmText.end()) : "authentication failed") << std::endl;
+
+    return 0;
+}
+
+/********************************************************************
+ ********************** Encryption Functions ************************
+ ********************************************************************/
+/********************************************************************
+ * Function: AddRoundKey
+ * Description:
+ *  This function performs AddRoundKey step in AES. It XORs the 
+ *  state matrix with the round key. The round key holds its four
+ *  words one after the other, so column col of the state is XORed
+ *  with bytes 4*col..4*col+3 of the round key
+ * Inputs:  state       - Refernece to Input State Matrix (4x4)
+ *          roundKey    - Round Key (16 bytes)
+ * Outputs: state       - Refernece to Output State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+void AddRoundKey(uint8_t state[4][4], const uint8_t* roundKey) 
+{
+    for (int row = 0; row < 4; ++row) {  // Iterate through each row of the state matrix
+        for (int col = 0; col < 4; ++col) {  // Iterate through each column of the state matrix
+            state[row][col] ^= roundKey[col * 4 + row]; // XOR the state byte with the corresponding round key byte
+        }
+    }
+}
+
+
+/********************************************************************
+ * Function: SubBytes
+ * Description:
+ *  This function performs the SubBytes transformation step in AES.
+ *  It substitutes each byte in the state matrix with a corresponding
+ *  byte from the AES S-box.
+ * Inputs:  state   - Refernece to Input State Matrix (4x4)
+ * Outputs: state   - Refernece to Output State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+void SubBytes(uint8_t state[4][4]) {
+    // Iterate over each byte of the state matrix
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            // Substitute the current byte with the value from the global S-box
+            state[row][col] = sBox[state[row][col]];
+        }
+    }
+}
+
+/********************************************************************
+ * Function: ShiftRows
+ * Description:
+ *  This function performs the ShiftRows transformation in AES. It
+ *  cyclically shifts the bytes in each row of the state matrix.
+ * Inputs:  state   - Refernece to Input State Matrix (4x4)
+ * Outputs: state   - Refernece to Output State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+void ShiftRows(uint8_t state[4][4])
+{
+    uint8_t rowTemp[4];
+    // Row 0: No Shift
+
+    // Row 1: Shift left by 1
+    for (int col = 0; col < 4; col++) {
+        rowTemp[col] = state[1][(col + 1) % 4]; // Store the shifted byte in a temporary variable
+    }
+    for (int col = 0; col < 4; col++) {
+        state[1][col] = rowTemp[col];  // Copy the shifted bytes back to row 1
+    }
+
+    // Row 2: Shift left by 2
+    for (int col = 0; col < 4; col++) {
+        rowTemp[col] = state[2][(col + 2) % 4]; // Store the shifted byte in a temporary variable
+    }
+    for (int col = 0; col < 4; col++) {
+        state[2][col] = rowTemp[col];  // Copy the shifted bytes back to row 2
+    }
+    
+    // Row 3: Shift left by 3
+    for (int col = 0; col < 4; col++) {
+        rowTemp[col] = state[3][(col + 3) % 4]; // Store the shifted byte in a temporary variable
+    }
+    for (int col = 0; col < 4; col++) {
+        state[3][col] = rowTemp[col];  // Copy the shifted bytes back to row 3
+    }
+}
+/********************************************************************
+ ************************ Utility Functions *************************
+ ********************************************************************/
+/********************************************************************
+ * Function: printState
+ * Description:
+ *  Function to print the state (4x4) Matrix
+ * Inputs:  state   - Refernece to Input State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+void printState(const uint8_t state[4][4])
+{
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) {
+            std::cout << std::hex << static_cast<int>(state[row][col]) << " ";
+        }
+        std::cout << std::endl;
+    }
+}
+
+/********************************************************************
+ * Function: LoadWordBigEndian / StoreWordBigEndian
+ * Description:
+ *  Functions to move a 32-bit column word from/to 4 bytes of a
+ *  block, most significant byte first
+ ********************************************************************/
+uint32_t LoadWordBigEndian(const uint8_t* bytes)
+{
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+}
+
+void StoreWordBigEndian(uint32_t word, uint8_t* bytes)
+{
+    bytes[0] = static_cast<uint8_t>(word >> 24);
+    bytes[1] = static_cast<uint8_t>(word >> 16);
+    bytes[2] = static_cast<uint8_t>(word >> 8);
+    bytes[3] = static_cast<uint8_t>(word);
+}
+
+/********************************************************************
+ * Function: GetCpuFeatures
+ * Description:
+ *  Function to detect once, through CPUID, the instruction set
+ *  extensions used by the hardware backends. AVX2 is only reported
+ *  when the OS also saves the YMM registers (XGETBV). On non-x86
+ *  targets all the features are reported as missing
+ * Returns: Reference to the detected features
+ ********************************************************************/
+const CpuFeatures& GetCpuFeatures()
+{
+    static const CpuFeatures features = []()
+    {
+        CpuFeatures detected{};
+#if AES_X86
+        unsigned int registers[4] = {0, 0, 0, 0};
+        unsigned int extendedRegisters[4] = {0, 0, 0, 0};
+        uint64_t enabledStates = 0;
+#if defined(_MSC_VER)
+        int msvcRegisters[4];
+        __cpuid(msvcRegisters, 1);
+        for (int i = 0; i < 4; ++i)
+        {
+            registers[i] = static_cast<unsigned int>(msvcRegisters[i]);
+        }
+        __cpuidex(msvcRegisters, 7, 0);
+        for (int i = 0; i < 4; ++i)
+        {
+            extendedRegisters[i] = static_cast<unsigned int>(msvcRegisters[i]);
+        }
+        if ((registers[2] & (1U << 27)) != 0)
+        {
+            enabledStates = _xgetbv(0);
+        }
+#else
+        __get_cpuid(1, &registers[0], &registers[1], &registers[2], &registers[3]);
+        __get_cpuid_count(7, 0, &extendedRegisters[0], &extendedRegisters[1], &extendedRegisters[2], &extendedRegisters[3]);
+        if ((registers[2] & (1U << 27)) != 0)
+        {
+            unsigned int eax, edx;
+            __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            enabledStates = (static_cast<uint64_t>(edx) << 32) | eax;
+        }
+#endif
+        /* CPUID leaf 1: ECX bit 25 is AES-NI, ECX bit 9 is SSSE3, ECX bit 1 is PCLMULQDQ */
+        detected.aesNi = (registers[2] & (1U << 25)) != 0;
+        detected.ssse3 = (registers[2] & (1U << 9)) != 0;
+        detected.pclmul = (registers[2] & (1U << 1)) != 0;
+
+        /* CPUID leaf 7: EBX bit 5 is AVX2, usable only if the OS saves the XMM and YMM state (XCR0 bits 1 and 2) */
+        detected.avx2 = ((extendedRegisters[1] & (1U << 5)) != 0) && ((enabledStates & 0x6) == 0x6);
+#endif
+        return detected;
+    }();
+    return features;
+}
+
+/********************************************************************
+ * Function: IncrementCounter
+ * Description:
+ *  Function to increment the 16 byte counter considering the carry
+ *  propagation. The counter is stored most significant byte first
+ * Inputs:  counter   - Refernece to the counter array
+ * Outputs: counter   - The counter after being incremented
+ * Returns: void
+ ********************************************************************/
+void IncrementCounter(CounterBlock& counter) 
+{
+    for (size_t i = 16; i > 0; --i) { // Iterate from LSB to MSB
+        if (++counter[i - 1] != 0) {  // Increment the current byte
+            break;                     // If no overflow, we're done
+        }
+    } // If the loop completes, the counter wrapped around
+}
+
+/********************************************************************
+ * Function: CounterAdd
+ * Description:
+ *  Function to compute counter + offset as a 128-bit addition so
+ *  that the counter of any block can be derived directly from the
+ *  initial counter without incrementing through all the previous
+ *  blocks. The counter is stored most significant byte first and
+ *  wraps around modulo 2^128
+ * Inputs:  counter   - Initial counter block
+ *          offset    - Number of blocks to advance the counter by
+ * Outputs: result    - The counter after being advanced
+ * Returns: void
+ ********************************************************************/
+void CounterAdd(const CounterBlock& counter, uint64_t offset, CounterBlock& result)
+{
+    /* Split the counter into its two 64-bit halves */
+    uint64_t high = 0;
+    uint64_t low = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        high = (high << 8) | counter[i];
+        low  = (low << 8) | counter[i + 8];
+    }
+
+    /* Add the offset to the low half and propagate the carry into the high half */
+    uint64_t sum = low + offset;
+    if (sum < low)
+    {
+        high++;
+    }
+
+    /* Store the halves back most significant byte first */
+    for (int i = 7; i >= 0; --i)
+    {
+        result[i] = static_cast<uint8_t>(high);
+        result[i + 8] = static_cast<uint8_t>(sum);
+        high >>= 8;
+        sum >>= 8;
+    }
+}
+
+
+/********************************************************************
+ * Function: TextPreprocessor
+ * Description:
+ *  Function to transform text into states for AES manipulation for
+ *  either encryption or decryption. Raw text is copied as is, hex
+ *  text is decoded, into a single contiguous buffer. CTR mode needs
+ *  no padding, so the states keep the exact length of the data
+ * Inputs:  strText  - text as string either plaintext or ciphertext
+ *          encoding - Representation of strText
+ * Outputs: states   - Prepared states
+ * Returns: void
+ ********************************************************************/
+void TextPreprocessor(const std::string& strText, BlockBuffer& states, TextEncoding encoding) 
+{
+    AES_STAGE_TIMER(InstrumentedStage::TextPreprocess);
+
+    if (encoding == TextEncoding::Hex)
+    {
+        /* Every byte takes two hex digits */
+        if ((strText.size() % 2) != 0)
+        {
+            throw std::invalid_argument("Hex text must have an even number of digits.");
+        }
+        states.Resize(strText.size() / 2);
+        if (!HexDecode(strText.data(), strText.size(), states.Data()))
+        {
+            throw std::invalid_argument("Hex text contains a non-hex digit.");
+        }
+        AES_STAGE_COUNT(InstrumentedStage::TextPreprocess, states.BlocksNumber(), states.Length());
+        return;
+    }
+
+    /* Allocate all the states at once and copy the text into them */
+    states.Resize(strText.size());
+    if (!strText.empty())
+    {
+        std::memcpy(states.Data(), strText.data(), strText.size());
+    }
+    AES_STAGE_COUNT(InstrumentedStage::TextPreprocess, states.BlocksNumber(), states.Length());
+}
+
+/********************************************************************
+ * Function: TextPostprocessor
+ * Description:
+ *  Function to transform states into text to be printed, either as
+ *  raw characters or as lowercase hex digits
+ * Inputs:  states    - states
+ *          encoding  - Representation of strText
+ * Outputs: strText   - text to be printed
+ * Returns: void
+ ********************************************************************/
+void TextPostprocessor(ConstBlockView states, std::string& strText, TextEncoding encoding) 
+{
+    AES_STAGE_TIMER(InstrumentedStage::TextPostprocess);
+    AES_STAGE_COUNT(InstrumentedStage::TextPostprocess, states.blocksNumber, states.length);
+
+    /* Count the growth of the output text as an allocation */
+    size_t textLength = (encoding == TextEncoding::Hex) ? 2 * states.length : states.length;
+    if (textLength > strText.capacity())
+    {
+        AES_COUNT_ALLOCATION(textLength);
+    }
+
+    if (encoding == TextEncoding::Hex)
+    {
+        strText.resize(textLength);
+        HexEncode(states.data, states.length, strText.data());
+        return;
+    }
+
+    strText.assign(reinterpret_cast<const char*>(states.data), states.length);
+}
+
+/********************************************************************
+ * Function: XorBytes
+ * Description:
+ *  Function to XOR a keystream into a run of bytes of any length.
+ *  The bulk is processed with the widest SIMD XOR available (AVX2 or
+ *  SSE2 on x86, 64-bit words elsewhere) and the remaining bytes of a
+ *  partial final block one at a time. input and output may alias
+ * Inputs:  input       - Bytes to be XORed
+ *          keystream   - Keystream bytes (at least length bytes)
+ *          length      - Number of bytes
+ * Outputs: output      - input XOR keystream
+ * Returns: void
+ ********************************************************************/
+void XorBytes(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t length)
+{
+    size_t i = 0;
+
+#if AES_X86
+    if (GetCpuFeatures().avx2)
+    {
+        XorBytesAvx2(input, keystream, output, length);
+        return;
+    }
+
+    /* SSE2 is part of the x86-64 baseline */
+    for (; i + BLOCK_SIZE <= length; i += BLOCK_SIZE)
+    {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m128i stream = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keystream + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_xor_si128(data, stream));
+    }
+#else
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+    {
+        uint64_t data, stream;
+        std::memcpy(&data, input + i, sizeof(data));
+        std::memcpy(&stream, keystream + i, sizeof(stream));
+        data ^= stream;
+        std::memcpy(output + i, &data, sizeof(data));
+    }
+#endif
+
+    /* Partial final block */
+    for (; i < length; ++i)
+    {
+        output[i] = input[i] ^ keystream[i];
+    }
+}
+
+#if AES_X86
+/********************************************************************
+ * Function: XorBytesAvx2
+ * Description:
+ *  AVX2 version of XorBytes processing two blocks per instruction.
+ *  It is only called when CPUID reports AVX2 support
+ * Inputs:  input       - Bytes to be XORed
+ *          keystream   - Keystream bytes (at least length bytes)
+ *          length      - Number of bytes
+ * Outputs: output      - input XOR keystream
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("avx2")
+void XorBytesAvx2(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t length)
+{
+    size_t i = 0;
+    for (; i + 2 * BLOCK_SIZE <= length; i += 2 * BLOCK_SIZE)
+    {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        __m256i stream = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keystream + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_xor_si256(data, stream));
+    }
+    if (i + BLOCK_SIZE <= length)
+    {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m128i stream = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keystream + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_xor_si128(data, stream));
+        i += BLOCK_SIZE;
+    }
+
+    /* Partial final block */
+    for (; i < length; ++i)
+    {
+        output[i] = input[i] ^ keystream[i];
+    }
+}
+#endif
+
+/********************************************************************
+ ************************ Hex Codec Functions ***********************
+ ********************************************************************/
+/* Lowercase hex digits indexed by nibble */
+constexpr char hexDigits[17] = "0123456789abcdef";
+
+/* Nibble value of every character, 0xff for the characters that are not hex digits */
+constexpr std::array<uint8_t, 256> hexValues = []()
+{
+    std::array<uint8_t, 256> values{};
+    for (int c = 0; c < 256; ++c)
+    {
+        values[c] = ((c >= '0') && (c <= '9')) ? static_cast<uint8_t>(c - '0') :
+                    ((c >= 'a') && (c <= 'f')) ? static_cast<uint8_t>(c - 'a' + 10) :
+                    ((c >= 'A') && (c <= 'F')) ? static_cast<uint8_t>(c - 'A' + 10) : 0xff;
+    }
+    return values;
+}();
+
+/********************************************************************
+ * Function: HexEncode
+ * Description:
+ *  Function to encode bytes as lowercase hex digits into a buffer
+ *  provided by the caller. The bulk goes through the widest SIMD
+ *  path available (AVX2, then SSSE3) and the rest through a table
+ * Inputs:  input   - Bytes to be encoded
+ *          length  - Number of bytes
+ * Outputs: output  - Hex digits (2 * length characters, no terminator)
+ * Returns: void
+ ********************************************************************/
+void HexEncode(const uint8_t* input, size_t length, char* output)
+{
+    size_t i = 0;
+
+#if AES_X86
+    if (GetCpuFeatures().avx2)
+    {
+        i = length - (length % (2 * BLOCK_SIZE));
+        HexEncodeAvx2(input, i, output);
+    }
+    else if (GetCpuFeatures().ssse3)
+    {
+        i = length - (length % BLOCK_SIZE);
+        HexEncodeSsse3(input, i, output);
+    }
+#endif
+
+    for (; i < length; ++i)
+    {
+        output[2 * i]     = hexDigits[input[i] >> 4];
+        output[2 * i + 1] = hexDigits[input[i] & 0x0f];
+    }
+}
+
+/********************************************************************
+ * Function: HexDecode
+ * Description:
+ *  Function to decode hex digits (either case) into bytes in a
+ *  buffer provided by the caller. The bulk goes through the widest
+ *  SIMD path available (AVX2, then SSSE3) and the rest through a
+ *  table
+ * Inputs:  input   - Hex digits
+ *          length  - Number of hex digits (even)
+ * Outputs: output  - Decoded bytes (length / 2 bytes)
+ * Returns: false if input holds a character that is not a hex digit
+ ********************************************************************/
+bool HexDecode(const char* input, size_t length, uint8_t* output)
+{
+    size_t bytesNumber = length / 2;
+    size_t i = 0;
+
+#if AES_X86
+    if (GetCpuFeatures().avx2)
+    {
+        i = bytesNumber - (bytesNumber % (2 * BLOCK_SIZE));
+        if (!HexDecodeAvx2(input, 2 * i, output))
+        {
+            return false;
+        }
+    }
+    else if (GetCpuFeatures().ssse3)
+    {
+        i = bytesNumber - (bytesNumber % BLOCK_SIZE);
+        if (!HexDecodeSsse3(input, 2 * i, output))
+        {
+            return false;
+        }
+    }
+#endif
+
+    uint8_t invalid = 0;
+    for (; i < bytesNumber; ++i)
+    {
+        uint8_t high = hexValues[static_cast<uint8_t>(input[2 * i])];
+        uint8_t low = hexValues[static_cast<uint8_t>(input[2 * i + 1])];
+        invalid |= (high | low) & 0xf0;
+        output[i] = static_cast<uint8_t>((high << 4) | (low & 0x0f));
+    }
+    return invalid == 0;
+}
+
+#if AES_X86
+/********************************************************************
+ * Function: HexEncodeSsse3
+ * Description:
+ *  SSSE3 version of HexEncode for a multiple of 16 bytes. The two
+ *  nibbles of every byte are split into two vectors, mapped to their
+ *  digits with PSHUFB and interleaved back in order
+ * Inputs:  input   - Bytes to be encoded
+ *          length  - Number of bytes (multiple of 16)
+ * Outputs: output  - Hex digits
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("ssse3")
+void HexEncodeSsse3(const uint8_t* input, size_t length, char* output)
+{
+    const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hexDigits));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+
+    for (size_t i = 0; i < length; i += BLOCK_SIZE)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask));
+        __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibbleMask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i + BLOCK_SIZE), _mm_unpackhi_epi8(high, low));
+    }
+}
+
+/********************************************************************
+ * Function: HexEncodeAvx2
+ * Description:
+ *  AVX2 version of HexEncode for a multiple of 32 bytes. The input
+ *  quadwords are reordered first so that the in-lane interleave
+ *  leaves the digits in order
+ * Inputs:  input   - Bytes to be encoded
+ *          length  - Number of bytes (multiple of 32)
+ * Outputs: output  - Hex digits
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("avx2")
+void HexEncodeAvx2(const uint8_t* input, size_t length, char* output)
+{
+    const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hexDigits)));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+
+    for (size_t i = 0; i < length; i += 2 * BLOCK_SIZE)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        bytes = _mm256_permute4x64_epi64(bytes, 0xd8);
+        __m256i high = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask));
+        __m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(bytes, nibbleMask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + 2 * i), _mm256_unpacklo_epi8(high, low));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + 2 * i + 2 * BLOCK_SIZE), _mm256_unpackhi_epi8(high, low));
+    }
+}
+
+/********************************************************************
+ * Function: HexDecodeNibblesSsse3
+ * Description:
+ *  Helper of HexDecodeSsse3 converting 16 hex digits to their nibble
+ *  values. Digits and letters are recognised with signed range
+ *  compares, so any byte >= 0x80 is rejected as well
+ * Inputs:  characters  - 16 characters
+ * Outputs: valid       - All ones in the lanes holding a hex digit
+ * Returns: Nibble values
+ ********************************************************************/
+AES_TARGET("ssse3")
+static inline __m128i HexDecodeNibblesSsse3(__m128i characters, __m128i& valid)
+{
+    __m128i lowerCase = _mm_or_si128(characters, _mm_set1_epi8(0x20));
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(characters, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), characters));
+    __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lowerCase, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lowerCase));
+    valid = _mm_or_si128(isDigit, isLetter);
+    return _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(characters, _mm_set1_epi8('0'))),
+                        _mm_and_si128(isLetter, _mm_sub_epi8(lowerCase, _mm_set1_epi8('a' - 10))));
+}
+
+/********************************************************************
+ * Function: HexDecodeSsse3
+ * Description:
+ *  SSSE3 version of HexDecode for a multiple of 32 digits. PMADDUBSW
+ *  merges every pair of nibbles into high * 16 + low and PACKUSWB
+ *  narrows the pairs back to bytes
+ * Inputs:  input   - Hex digits
+ *          length  - Number of hex digits (multiple of 32)
+ * Outputs: output  - Decoded bytes
+ * Returns: false if input holds a character that is not a hex digit
+ ********************************************************************/
+AES_TARGET("ssse3")
+bool HexDecodeSsse3(const char* input, size_t length, uint8_t* output)
+{
+    const __m128i pairWeights = _mm_set1_epi16(0x0110);
+    __m128i allValid = _mm_set1_epi8(-1);
+
+    for (size_t i = 0; i < length; i += 2 * BLOCK_SIZE)
+    {
+        __m128i validFirst, validSecond;
+        __m128i first = HexDecodeNibblesSsse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)), validFirst);
+        __m128i second = HexDecodeNibblesSsse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i + BLOCK_SIZE)), validSecond);
+        allValid = _mm_and_si128(allValid, _mm_and_si128(validFirst, validSecond));
+
+        __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(first, pairWeights), _mm_maddubs_epi16(second, pairWeights));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i / 2), bytes);
+    }
+    return _mm_movemask_epi8(allValid) == 0xffff;
+}
+
+/********************************************************************
+ * Function: HexDecodeNibblesAvx2
+ * Description:
+ *  AVX2 version of HexDecodeNibblesSsse3 for 32 hex digits
+ * Inputs:  characters  - 32 characters
+ * Outputs: valid       - All ones in the lanes holding a hex digit
+ * Returns: Nibble values
+ ********************************************************************/
+AES_TARGET("avx2")
+static inline __m256i HexDecodeNibblesAvx2(__m256i characters, __m256i& valid)
+{
+    __m256i lowerCase = _mm256_or_si256(characters, _mm256_set1_epi8(0x20));
+    __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(characters, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), characters));
+    __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(lowerCase, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lowerCase));
+    valid = _mm256_or_si256(isDigit, isLetter);
+    return _mm256_or_si256(_mm256_and_si256(isDigit, _mm256_sub_epi8(characters, _mm256_set1_epi8('0'))),
+                           _mm256_and_si256(isLetter, _mm256_sub_epi8(lowerCase, _mm256_set1_epi8('a' - 10))));
+}
+
+/********************************************************************
+ * Function: HexDecodeAvx2
+ * Description:
+ *  AVX2 version of HexDecode for a multiple of 64 digits. PACKUSWB
+ *  works within each 128-bit lane, so the quadwords are put back in
+ *  order afterwards
+ * Inputs:  input   - Hex digits
+ *          length  - Number of hex digits (multiple of 64)
+ * Outputs: output  - Decoded bytes
+ * Returns: false if input holds a character that is not a hex digit
+ ********************************************************************/
+AES_TARGET("avx2")
+bool HexDecodeAvx2(const char* input, size_t length, uint8_t* output)
+{
+    const __m256i pairWeights = _mm256_set1_epi16(0x0110);
+    __m256i allValid = _mm256_set1_epi8(-1);
+
+    for (size_t i = 0; i < length; i += 4 * BLOCK_SIZE)
+    {
+        __m256i validFirst, validSecond;
+        __m256i first = HexDecodeNibblesAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i)), validFirst);
+        __m256i second = HexDecodeNibblesAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i + 2 * BLOCK_SIZE)), validSecond);
+        allValid = _mm256_and_si256(allValid, _mm256_and_si256(validFirst, validSecond));
+
+        __m256i bytes = _mm256_packus_epi16(_mm256_maddubs_epi16(first, pairWeights), _mm256_maddubs_epi16(second, pairWeights));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i / 2), _mm256_permute4x64_epi64(bytes, 0xd8));
+    }
+    return _mm256_movemask_epi8(allValid) == -1;
+}
+#endif
+
+/********************************************************************
+ ********************** Counter Mode Functions **********************
+ ********************************************************************/
+/********************************************************************
+ * Function: CounterModeInitializer
+ * Description:
+ *  Function to initialize a counter for the CTR mode of operation
+ *  for AES. It generates an 8-byte random nonce and concatenate it
+ *  to a zero-initialized counter (nonce || counter). The output
+ *  counter is then used for CTR Mode AES
+ * Inputs:  counter   - Place holder to hold the output counter
+ * Outputs: counter   - The initialized counter
+ * Returns: void
+ ********************************************************************/
+void CounterModeInitializer(CounterBlock& counter)
+{
+    AES_STAGE_TIMER(InstrumentedStage::CounterInit);
+
+    /* Obtain a random seed from the OS */
+    std::random_device rd;
+    std::mt19937_64 gen(rd());  
+    std::uniform_int_distribution<> distrib(0, 255);
+
+    for (int i = 0; i < 16; ++i) 
+    {
+        if(i < 8)
+        {
+            /* Store the random nonce in the first 8 bytes of the counter */
+            counter[i] = static_cast<uint8_t>(distrib(gen));
+        }
+        else
+        {
+            /* Set the remaining 8 bytes to 0 */
+            counter[i] = 0x00;
+        }
+    }
+}
+
+/********************************************************************
+ * Function: GenerateKeystream
+ * Description:
+ *  Function to generate the CTR keystream E_K(nonce || counter) of
+ *  consecutive blocks. The counter blocks are laid out first and
+ *  then encrypted in place as one run, so multi-block backends can
+ *  process several of them in parallel
+ * Inputs:  key             - Expanded key
+ *          counter         - Counter of the first keystream block
+ *          blocksNumber    - Number of keystream blocks
+ * Outputs: keystream       - Keystream blocks
+ *          counter         - Counter of the block following the last one
+ * Returns: void
+ ********************************************************************/
+void GenerateKeystream(const AesKey& key, CounterBlock& counter, uint8_t* keystream, size_t blocksNumber)
+{
+    for (size_t i = 0; i < blocksNumber; ++i)
+    {
+        std::memcpy(keystream + i * BLOCK_SIZE, counter.data(), BLOCK_SIZE);
+        IncrementCounter(counter);
+    }
+    AesEncryptBlocks(key, keystream, keystream, blocksNumber);
+}
+
+/********************************************************************
+ * Function: CounterModeWorker
+ * Description:
+ *  Function to perform AES in counter mode for a contiguous range of
+ *  states. The keystream is generated KEYSTREAM_BLOCKS at a time and
+ *  XORed into the states, the last state may be partial. Encryption
+ *  and decryption are the same operation in CTR mode
+ * Inputs:  key     - Expanded key
+ *          states  - States to be processed
+ *          counter - Counter of the first state of the range
+ * Outputs: outputStates   - states XOR keystream
+ * Returns: void
+ ********************************************************************/
+void CounterModeWorker(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates)
+{
+    AES_STAGE_TIMER(InstrumentedStage::Worker);
+    AES_STAGE_COUNT(InstrumentedStage::Worker, states.blocksNumber, states.length);
+
+    alignas(BUFFER_ALIGNMENT) uint8_t keystream[KEYSTREAM_BLOCKS * BLOCK_SIZE];
+    CounterBlock blockCounter = counter;
+
+    for (size_t offset = 0; offset < states.length; offset += sizeof(keystream))
+    {
+        size_t chunkLength = std::min<size_t>(sizeof(keystream), states.length - offset);
+        GenerateKeystream(key, blockCounter, keystream, (chunkLength + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        XorBytes(states.data + offset, keystream, outputStates.data + offset, chunkLength);
+    }
+}
+
+/********************************************************************
+ * Function: EncryptionDispatcher
+ * Description:
+ *  Function to perform AES 128 encryption in counter mode
+ *  for an input data. This function parallize the encryption
+ *  over multiple working encryption threads to speed up the
+ *  encryption process
+ * Inputs:  states   - States to be encrypted
+ *          counter - Counter to be used in encryption
+ * Outputs: encryptedStates   - Output states after encryption
+ * Returns: void
+ ********************************************************************/
+void EncryptionDispatcher(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView encryptedStates)
+{
+    /* Hand the states over to the worker pool in batches of keystream work */
+    StatesDispatcher(key, states, counter, encryptedStates);
+}
+
+/********************************************************************
+ * Function: DecryptionDispatcher
+ * Description:
+ *  Function to perform AES 128 decryption in counter mode
+ *  for an input data. This function parallize the decryption
+ *  over multiple working decryption threads to speed up the
+ *  decryption process. CTR decryption regenerates the same
+ *  keystream as encryption, so both share one code path
+ * Inputs:  states   - States to be decrypted
+ *          counter - Counter to be used in decryption
+ * Outputs: encryptedStates   - Output states after decryption
+ * Returns: void
+ ********************************************************************/
+void DecryptionDispatcher(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView decryptedStates)
+{
+    /* Hand the states over to the worker pool in batches of keystream work */
+    StatesDispatcher(key, states, counter, decryptedStates);
+}
+
+/********************************************************************
+ * Function: StatesDispatcher
+ * Description:
+ *  Common dispatching logic of the encryption and decryption
+ *  dispatchers. The states are handed to WorkerPool::ParallelFor,
+ *  which starts with one contiguous range per worker thread on the
+ *  NUMA node given by WorkerPool::NodeOfRange, then balances the
+ *  ranges by work stealing in pieces of the DispatchGrainBlocks
+ *  grain. An input too small for two grains is processed on the
+ *  calling thread. Every piece derives the counter of its first
+ *  state as counter + first using 128-bit addition, so no counter
+ *  is carried serially across the pieces. The function blocks until
+ *  all the states have been processed
+ * Inputs:  key     - Expanded key shared by all the workers
+ *          states  - States to be processed
+ *          counter - Counter of the first state
+ * Outputs: outputStates   - Output states after processing
+ * Returns: void
+ ********************************************************************/
+void StatesDispatcher(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates)
+{
+    /* Dispatch over the long-lived worker pool */
+    StatesDispatcher(GetWorkerPool(), key, states, counter, outputStates);
+}
+
+/********************************************************************
+ * Function: StatesDispatcher
+ * Description:
+ *  Same as above over an explicit worker pool, so the number of
+ *  threads can differ from the global pool (e.g. to benchmark the
+ *  scaling)
+ * Inputs:  pool    - Worker pool running the ranges
+ *          key     - Expanded key shared by all the workers
+ *          states  - States to be processed
+ *          counter - Counter of the first state
+ * Outputs: outputStates   - Output states after processing
+ * Returns: void
+ ********************************************************************/
+void StatesDispatcher(WorkerPool& pool, const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates)
+{
+    AES_STAGE_TIMER(InstrumentedStage::Dispatch);
+    AES_STAGE_COUNT(InstrumentedStage::Dispatch, states.blocksNumber, states.length);
+
+    /* Nothing to dispatch for an empty input */
+    uint64_t statesNumber = states.blocksNumber;
+    if (statesNumber == 0)
+    {
+        return;
+    }
+
+    /* Use one range per worker unless the input cannot give every range a full grain of work */
+    uint64_t grainBlocks = DispatchGrainBlocks(key);
+    uint64_t rangesNumber = std::min<uint64_t>(statesNumber / grainBlocks, pool.ThreadsNumber());
+    if (rangesNumber <= 1)
+    {
+        /* A single range would only add the handoff to a worker and back */
+        CounterModeWorker(key, states, counter, outputStates);
+        return;
+    }
+
+    /* Hand the states to the work-stealing scheduler, one grain of keystream work at a time */
+    pool.ParallelFor(statesNumber, grainBlocks, [&key, states, outputStates, &counter](uint64_t first, uint64_t last)
+    {
+        /* Derive the counter of the first state of the piece directly from the initial counter */
+        CounterBlock rangeCounter;
+        CounterAdd(counter, first, rangeCounter);
+
+        CounterModeWorker(key, states.Slice(first, last - first), rangeCounter, outputStates.Slice(first, last - first));
+    });
+}
+
+/********************************************************************
+ * Function: DispatchGrainBlocks
+ * Description:
+ *  Function to get the smallest range worth handing to a worker:
+ *  the number of states the key's backend processes on one core in
+ *  DISPATCH_GRAIN_NANOSECONDS, never below BLOCKS_PER_BATCH. The
+ *  per-core throughputs are rough figures measured with
+ *  Units/AES_CTR_Benchmark.cpp, only their order of magnitude
+ *  matters
+ * Inputs:  key     - Expanded key selecting the backend
+ * Returns: Minimum number of states per range
+ ********************************************************************/
+uint64_t DispatchGrainBlocks(const AesKey& key)
+{
+    /* Approximate single-core CTR throughput in bytes per microsecond */
+    uint64_t bytesPerMicrosecond;
+    switch (key.Backend())
+    {
+    case AesBackend::AesNi:
+        bytesPerMicrosecond = 1000;
+        break;
+    case AesBackend::TTable:
+        bytesPerMicrosecond = 200;
+        break;
+    case AesBackend::Bitsliced:
+        bytesPerMicrosecond = 80;
+        break;
+    default:
+        bytesPerMicrosecond = 25;
+        break;
+    }
+
+    uint64_t grainBlocks = DISPATCH_GRAIN_NANOSECONDS * bytesPerMicrosecond / 1000U / BLOCK_SIZE;
+    return std::max<uint64_t>(grainBlocks, BLOCKS_PER_BATCH);
+}
+
+/********************************************************************
+ ******************* Counter Mode Stream Functions ******************
+ ********************************************************************/
+/********************************************************************
+ * Function: AesCtrStream::AesCtrStream
+ * Description:
+ *  Constructor of the streaming context. The context is unusable
+ *  until Init is called
+ * Returns: void
+ ********************************************************************/
+AesCtrStream::AesCtrStream() : key(nullptr), initialCounter{}, counter{}, keystream{}, keystreamUsed(BLOCK_SIZE)
+{
+}
+
+/********************************************************************
+ * Function: AesCtrStream::~AesCtrStream
+ * Description:
+ *  Destructor of the streaming context. It wipes the context the
+ *  same way Final does
+ * Returns: void
+ ********************************************************************/
+AesCtrStream::~AesCtrStream()
+{
+    Final();
+}
+
+/********************************************************************
+ * Function: AesCtrStream::Init
+ * Description:
+ *  Function to start a new message. The key is referenced, not
+ *  copied, so it must outlive the stream
+ * Inputs:  key     - Expanded key
+ *          nonce   - Initial counter block (nonce || counter)
+ * Returns: void
+ ********************************************************************/
+void AesCtrStream::Init(const AesKey& key, const CounterBlock& nonce)
+{
+    this->key = &key;
+    initialCounter = nonce;
+    counter = nonce;
+
+    /* No keystream is buffered at the start of a message */
+    keystreamUsed = BLOCK_SIZE;
+}
+
+/********************************************************************
+ * Function: AesCtrStream::Seek
+ * Description:
+ *  Function to position the stream at a byte offset of the message,
+ *  so that the next Update processes the bytes starting there. The
+ *  counter of the block holding the offset is initial counter +
+ *  offset / 16, and when the offset falls inside that block its
+ *  keystream is generated with the first offset % 16 bytes consumed
+ * Inputs:  offset  - Byte offset from the start of the message
+ * Returns: void
+ ********************************************************************/
+void AesCtrStream::Seek(uint64_t offset)
+{
+    if (key == nullptr)
+    {
+        throw std::logic_error("AesCtrStream::Seek called before Init.");
+    }
+
+    /* Jump straight to the counter of the block holding the offset */
+    CounterAdd(initialCounter, offset / BLOCK_SIZE, counter);
+
+    /* Buffer the keystream of that block when the offset falls inside it */
+    keystreamUsed = BLOCK_SIZE;
+    size_t intraBlockOffset = static_cast<size_t>(offset % BLOCK_SIZE);
+    if (intraBlockOffset != 0)
+    {
+        GenerateKeystream(*key, counter, keystream, 1);
+        keystreamUsed = intraBlockOffset;
+    }
+}
+
+/********************************************************************
+ * Function: AesCtrStream::Update
+ * Description:
+ *  Function to encrypt or decrypt the next length bytes of the
+ *  message. It runs in three steps:
+ *      1. Consume the keystream left over by the previous call
+ *      2. Process the whole blocks directly, in parallel through the
+ *         worker pool when there are enough of them
+ *      3. Generate one more keystream block for a partial tail and
+ *         keep its unused bytes for the next call
+ *  input and output may be the same buffer
+ * Inputs:  input   - Bytes to be processed
+ *          length  - Number of bytes
+ * Outputs: output  - Processed bytes
+ * Returns: void
+ ********************************************************************/
+void AesCtrStream::Update(const uint8_t* input, uint8_t* output, size_t length)
+{
+    if (key == nullptr)
+    {
+        throw std::logic_error("AesCtrStream::Update called before Init.");
+    }
+
+    /* Consume the leftover keystream first */
+    size_t leftover = std::min<size_t>(BLOCK_SIZE - keystreamUsed, length);
+    XorBytes(input, keystream + keystreamUsed, output, leftover);
+    keystreamUsed += leftover;
+    input += leftover;
+    output += leftover;
+    length -= leftover;
+
+    /* Whole blocks need no buffering, so hand them to the bulk path */
+    size_t blocksNumber = length / BLOCK_SIZE;
+    if (blocksNumber != 0)
+    {
+        ConstBlockView states(input, blocksNumber * BLOCK_SIZE);
+        BlockView outputStates{output, blocksNumber, blocksNumber * BLOCK_SIZE};
+        StatesDispatcher(*key, states, counter, outputStates);
+        CounterAdd(counter, blocksNumber, counter);
+        input += blocksNumber * BLOCK_SIZE;
+        output += blocksNumber * BLOCK_SIZE;
+        length -= blocksNumber * BLOCK_SIZE;
+    }
+
+    /* Partial tail: generate one more keystream block and keep the rest of it */
+    if (length != 0)
+    {
+        GenerateKeystream(*key, counter, keystream, 1);
+        XorBytes(input, keystream, output, length);
+        keystreamUsed = length;
+    }
+}
+
+/********************************************************************
+ * Function: AesCtrStream::Final
+ * Description:
+ *  Function to finish the message. CTR mode has no pending output,
+ *  so it only wipes the buffered keystream and the counter and
+ *  detaches the key. Init must be called before the next message
+ * Returns: void
+ ********************************************************************/
+void AesCtrStream::Final()
+{
+    SecureZero(keystream, sizeof(keystream));
+    SecureZero(initialCounter.data(), initialCounter.size());
+    SecureZero(counter.data(), counter.size());
+    keystreamUsed = BLOCK_SIZE;
+    key = nullptr;
+}
+
+/********************************************************************
+ * Function: DecryptRange
+ * Description:
+ *  Function to decrypt only the bytes [offset, offset + length) of
+ *  a message encrypted in CTR mode, without touching the bytes
+ *  before them. The cost is proportional to length, not to offset
+ * Inputs:  key     - Expanded key
+ *          nonce   - Initial counter block of the message
+ *          offset  - Byte offset of the range in the message
+ *          input   - Ciphertext bytes of the range
+ *          length  - Number of bytes in the range
+ * Outputs: output  - Plaintext bytes of the range
+ * Returns: void
+ ********************************************************************/
+void DecryptRange(const AesKey& key, const CounterBlock& nonce, uint64_t offset, const uint8_t* input, uint8_t* output, size_t length)
+{
+    AesCtrStream stream;
+    stream.Init(key, nonce);
+    stream.Seek(offset);
+    stream.Update(input, output, length);
+    stream.Final();
+}
+
+/********************************************************************
+ * Function: SecureZero
+ * Description:
+ *  Function to wipe sensitive memory through a volatile pointer so
+ *  the compiler cannot drop the stores as dead
+ * Inputs:  data    - Memory to be wiped
+ *          length  - Number of bytes
+ * Returns: void
+ ********************************************************************/
+void SecureZero(void* data, size_t length)
+{
+    volatile uint8_t* bytes = static_cast<volatile uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i)
+    {
+        bytes[i] = 0;
+    }
+}
+
+/********************************************************************
+ **************** Asynchronous Counter Mode Functions ***************
+ ********************************************************************/
+/********************************************************************
+ * Function: StatesDispatcherAsync
+ * Description:
+ *  Non-blocking counterpart of StatesDispatcher. The states go
+ *  through WorkerPool::ParallelForAsync in pieces of the
+ *  DispatchGrainBlocks grain, even a small input, so the caller never
+ *  runs any of the work itself. Once stopToken is signalled the
+ *  pieces not started yet are skipped. completion receives the
+ *  status once all the pieces are done or skipped, on the worker
+ *  that finished the last one (on the caller for an empty input),
+ *  where an exception it throws is dropped. The counter is copied,
+ *  the key and both views must stay valid until completion
+ * Inputs:  pool        - Worker pool running the job
+ *          key         - Expanded key shared by all the workers
+ *          states      - States to be processed
+ *          counter     - Counter of the first state
+ *          stopToken   - Cancellation token
+ *          completion  - Function receiving the status of the job
+ * Outputs: outputStates   - Output states after processing
+ * Returns: void
+ ********************************************************************/
+void StatesDispatcherAsync(WorkerPool& pool, const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates,
+                           std::stop_token stopToken, std::function<void(AesJobStatus)> completion)
+{
+    /* Set by the first skipped piece */
+    auto skipped = std::make_shared<std::atomic<bool>>(false);
+
+    pool.ParallelForAsync(states.blocksNumber, DispatchGrainBlocks(key),
+        [&key, states, outputStates, counter, stopToken, skipped](uint64_t first, uint64_t last)
+        {
+            if (stopToken.stop_requested())
+            {
+                skipped->store(true, std::memory_order_relaxed);
+                return;
+            }
+
+            CounterBlock rangeCounter;
+            CounterAdd(counter, first, rangeCounter);
+            CounterModeWorker(key, states.Slice(first, last - first), rangeCounter, outputStates.Slice(first, last - first));
+        },
+        [skipped, completion = std::move(completion)]()
+        {
+            completion(skipped->load(std::memory_order_relaxed) ? AesJobStatus::Cancelled : AesJobStatus::Completed);
+        });
+}
+
+/********************************************************************
+ * Function: EncryptionDispatcherAsync
+ * Description:
+ *  Function to start AES encryption in counter mode on the worker
+ *  pool and return at once. The returned future becomes ready with
+ *  the status of the job, after the optional completion callback
+ *  has run (on a worker thread, see StatesDispatcherAsync). If the
+ *  callback throws, the future rethrows its exception
+ * Inputs:  key         - Expanded key
+ *          states      - States to be encrypted
+ *          counter     - Counter to be used in encryption
+ *          completion  - Optional callback receiving the status
+ *          stopToken   - Cancellation token
+ * Outputs: encryptedStates   - Output states after encryption
+ * Returns: Future of the status of the job
+ ********************************************************************/
+std::future<AesJobStatus> EncryptionDispatcherAsync(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView encryptedStates,
+                                                    std::function<void(AesJobStatus)> completion, std::stop_token stopToken)
+{
+    auto promise = std::make_shared<std::promise<AesJobStatus>>();
+    std::future<AesJobStatus> future = promise->get_future();
+
+    StatesDispatcherAsync(GetWorkerPool(), key, states, counter, encryptedStates, std::move(stopToken),
+        [promise, completion = std::move(completion)](AesJobStatus status)
+        {
+            /* An exception of the callback goes to the future instead of the worker thread */
+            try
+            {
+                if (completion)
+                {
+                    completion(status);
+                }
+            }
+            catch (...)
+            {
+                promise->set_exception(std::current_exception());
+                return;
+            }
+            promise->set_value(status);
+        });
+    return future;
+}
+
+/********************************************************************
+ * Function: DecryptionDispatcherAsync
+ * Description:
+ *  Function to start AES decryption in counter mode on the worker
+ *  pool and return at once. CTR decryption regenerates the same
+ *  keystream as encryption, so both share one code path
+ * Inputs:  key         - Expanded key
+ *          states      - States to be decrypted
+ *          counter     - Counter to be used in decryption
+ *          completion  - Optional callback receiving the status
+ *          stopToken   - Cancellation token
+ * Outputs: decryptedStates   - Output states after decryption
+ * Returns: Future of the status of the job
+ ********************************************************************/
+std::future<AesJobStatus> DecryptionDispatcherAsync(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView decryptedStates,
+                                                    std::function<void(AesJobStatus)> completion, std::stop_token stopToken)
+{
+    return EncryptionDispatcherAsync(key, states, counter, decryptedStates, std::move(completion), std::move(stopToken));
+}
+
+/********************************************************************
+ * Function: AesCtrAwaitable::AesCtrAwaitable
+ * Description:
+ *  Constructor of the awaitable, the job starts when it is awaited
+ * Inputs:  key         - Expanded key
+ *          states      - States to be processed
+ *          counter     - Counter of the first state
+ *          outputStates - Output states
+ *          stopToken   - Cancellation token
+ * Returns: void
+ ********************************************************************/
+AesCtrAwaitable::AesCtrAwaitable(const AesKey& key, ConstBlockView states, const CounterBlock& counter, BlockView outputStates,
+                                 std::stop_token stopToken)
+    : key(key), states(states), counter(counter), outputStates(outputStates), stopToken(std::move(stopToken)),
+      status(AesJobStatus::Completed)
+{
+}
+
+/* An empty job completes without suspending */
+bool AesCtrAwaitable::await_ready() const noexcept
+{
+    return states.blocksNumber == 0;
+}
+
+/* Function to start the job, the coroutine is resumed by the worker completing it */
+void AesCtrAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    StatesDispatcherAsync(GetWorkerPool(), key, states, counter, outputStates, stopToken,
+        [this, handle](AesJobStatus jobStatus)
+        {
+            status = jobStatus;
+            handle.resume();
+        });
+}
+
+/* Function to get the status of the awaited job */
+AesJobStatus AesCtrAwaitable::await_resume() const noexcept
+{
+    return status;
+}
+
+/********************************************************************
+ ************************** GHASH Functions *************************
+ ********************************************************************/
+/* Reduction of the 4 bits shifted out of the Shoup accumulator, as the top 16 bits of the high half */
+constexpr uint64_t ghashShoupReduction[16] =
+{
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/********************************************************************
+ * Function: SelectGhashBackend
+ * Description:
+ *  Function to resolve the GHASH backend. Automatic and Clmul select
+ *  PCLMULQDQ when the CPU supports it (it also needs SSSE3 for the
+ *  byte reversal) and fall back to the Shoup tables otherwise
+ * Inputs:  requested   - Requested backend
+ * Returns: The backend to be used
+ ********************************************************************/
+GhashBackend SelectGhashBackend(GhashBackend requested)
+{
+    if ((requested == GhashBackend::Automatic) || (requested == GhashBackend::Clmul))
+    {
+        const CpuFeatures& features = GetCpuFeatures();
+        return (features.pclmul && features.ssse3) ? GhashBackend::Clmul : GhashBackend::Shoup;
+    }
+    return requested;
+}
+
+/********************************************************************
+ * Function: GhashInit
+ * Description:
+ *  Function to precompute the multiples of the GHASH subkey H. The
+ *  Shoup table holds i * H for every 4-bit i in the bit-reflected
+ *  GCM field: H is at index 8 (the polynomial 1), the indices 4, 2
+ *  and 1 are H divided by x, x^2 and x^3, and the other entries are
+ *  XORs of those
+ * Inputs:  subkey  - GHASH subkey H (16 bytes)
+ *          backend - Requested backend
+ * Outputs: ghashKey    - Precomputed subkey
+ * Returns: void
+ ********************************************************************/
+void GhashInit(const uint8_t* subkey, GhashBackend backend, GhashKey& ghashKey)
+{
+    ghashKey.backend = SelectGhashBackend(backend);
+
+    uint64_t high = 0;
+    uint64_t low = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        high = (high << 8) | subkey[i];
+        low = (low << 8) | subkey[8 + i];
+    }
+
+    ghashKey.shoupHigh[0] = 0;
+    ghashKey.shoupLow[0] = 0;
+    ghashKey.shoupHigh[8] = high;
+    ghashKey.shoupLow[8] = low;
+
+    /* Dividing by x is a right shift in the reflected field, reduced by R = 11100001 || 0^120 */
+    for (int i = 4; i > 0; i >>= 1)
+    {
+        uint64_t reduction = (low & 1) * 0xe100000000000000ULL;
+        low = (high << 63) | (low >> 1);
+        high = (high >> 1) ^ reduction;
+        ghashKey.shoupHigh[i] = high;
+        ghashKey.shoupLow[i] = low;
+    }
+    for (int i = 2; i <= 8; i *= 2)
+    {
+        for (int j = 1; j < i; ++j)
+        {
+            ghashKey.shoupHigh[i + j] = ghashKey.shoupHigh[i] ^ ghashKey.shoupHigh[j];
+            ghashKey.shoupLow[i + j] = ghashKey.shoupLow[i] ^ ghashKey.shoupLow[j];
+        }
+    }
+
+    std::memset(ghashKey.clmulPowers, 0, sizeof(ghashKey.clmulPowers));
+#if AES_X86
+    if (ghashKey.backend == GhashBackend::Clmul)
+    {
+        GhashClmulInit(ghashKey, subkey);
+    }
+#endif
+}
+
+/********************************************************************
+ * Function: GhashUpdate
+ * Description:
+ *  Function to absorb length bytes into the GHASH state with the
+ *  backend selected by the key. A partial last block is padded with
+ *  zeros, as GCM pads the AAD and the ciphertext separately
+ * Inputs:  ghashKey    - Precomputed subkey
+ *          state       - GHASH state (16 bytes)
+ *          data        - Bytes to be hashed
+ *          length      - Number of bytes
+ * Outputs: state       - Updated GHASH state
+ * Returns: void
+ ********************************************************************/
+void GhashUpdate(const GhashKey& ghashKey, uint8_t* state, const uint8_t* data, size_t length)
+{
+    size_t blocksNumber = length / BLOCK_SIZE;
+    size_t tail = length % BLOCK_SIZE;
+    uint8_t lastBlock[BLOCK_SIZE] = {};
+    if (tail != 0)
+    {
+        std::memcpy(lastBlock, data + blocksNumber * BLOCK_SIZE, tail);
+    }
+
+#if AES_X86
+    if (ghashKey.backend == GhashBackend::Clmul)
+    {
+        GhashClmulBlocks(ghashKey, state, data, blocksNumber);
+        if (tail != 0)
+        {
+            GhashClmulBlocks(ghashKey, state, lastBlock, 1);
+        }
+        return;
+    }
+#endif
+    GhashShoupBlocks(ghashKey, state, data, blocksNumber);
+    if (tail != 0)
+    {
+        GhashShoupBlocks(ghashKey, state, lastBlock, 1);
+    }
+}
+
+/********************************************************************
+ * Function: GhashShoupBlocks
+ * Description:
+ *  Function to hash whole blocks with Shoup's 4-bit tables. For every
+ *  block the state becomes (state ^ block) * H, computed from the
+ *  last nibble to the first one: the accumulator is divided by x^4,
+ *  the 4 bits shifted out are reduced through ghashShoupReduction and
+ *  the product of the next nibble by H is added. Note that the
+ *  lookups are indexed by the data, so unlike PCLMULQDQ this backend
+ *  is not constant-time
+ * Inputs:  ghashKey        - Precomputed subkey
+ *          state           - GHASH state (16 bytes)
+ *          data            - Blocks to be hashed
+ *          blocksNumber    - Number of blocks
+ * Outputs: state           - Updated GHASH state
+ * Returns: void
+ ********************************************************************/
+void GhashShoupBlocks(const GhashKey& ghashKey, uint8_t* state, const uint8_t* data, size_t blocksNumber)
+{
+    const uint64_t* tableHigh = ghashKey.shoupHigh;
+    const uint64_t* tableLow = ghashKey.shoupLow;
+
+    for (size_t block = 0; block < blocksNumber; ++block)
+    {
+        uint8_t x[BLOCK_SIZE];
+        for (size_t i = 0; i < BLOCK_SIZE; ++i)
+        {
+            x[i] = state[i] ^ data[block * BLOCK_SIZE + i];
+        }
+
+        uint8_t nibble = x[15] & 0xf;
+        uint64_t high = tableHigh[nibble];
+        uint64_t low = tableLow[nibble];
+        for (int i = 15; i >= 0; --i)
+        {
+            uint8_t remainder;
+            if (i != 15)
+            {
+                nibble = x[i] & 0xf;
+                remainder = low & 0xf;
+                low = (high << 60) | (low >> 4);
+                high = (high >> 4) ^ (ghashShoupReduction[remainder] << 48) ^ tableHigh[nibble];
+                low ^= tableLow[nibble];
+            }
+            nibble = x[i] >> 4;
+            remainder = low & 0xf;
+            low = (high << 60) | (low >> 4);
+            high = (high >> 4) ^ (ghashShoupReduction[remainder] << 48) ^ tableHigh[nibble];
+            low ^= tableLow[nibble];
+        }
+
+        for (int i = 0; i < 8; ++i)
+        {
+            state[i] = static_cast<uint8_t>(high >> (56 - 8 * i));
+            state[8 + i] = static_cast<uint8_t>(low >> (56 - 8 * i));
+        }
+    }
+}
+
+#if AES_X86
+/********************************************************************
+ * Function: ClmulMultiply
+ * Description:
+ *  Carry-less multiplication of two byte-reversed field elements.
+ *  The 256-bit product is XORed into low/high without reduction, so
+ *  several products can share one ClmulReduce
+ * Inputs:  a, b        - Factors (byte-reversed)
+ *          low, high   - Accumulated product
+ * Outputs: low, high   - Accumulated product
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("pclmul,sse2")
+static inline void ClmulMultiply(__m128i a, __m128i b, __m128i& low, __m128i& high)
+{
+    __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+    low = _mm_xor_si128(low, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(middle, 8)));
+    high = _mm_xor_si128(high, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(middle, 8)));
+}
+
+/********************************************************************
+ * Function: ClmulReduce
+ * Description:
+ *  Reduction of a 256-bit carry-less product modulo the GCM
+ *  polynomial x^128 + x^7 + x^2 + x + 1. The product of two
+ *  bit-reflected operands is one bit short, so it is first shifted
+ *  left by one, then the low half is folded into the high half with
+ *  shifts by 1, 2 and 7 (Intel's carry-less multiplication guide)
+ * Inputs:  low, high   - Product
+ * Returns: The reduced field element (byte-reversed)
+ ********************************************************************/
+AES_TARGET("pclmul,sse2")
+static inline __m128i ClmulReduce(__m128i low, __m128i high)
+{
+    /* Shift the 256-bit product left by one bit */
+    __m128i lowCarry = _mm_srli_epi32(low, 31);
+    __m128i highCarry = _mm_srli_epi32(high, 31);
+    low = _mm_slli_epi32(low, 1);
+    high = _mm_slli_epi32(high, 1);
+    high = _mm_or_si128(high, _mm_srli_si128(lowCarry, 12));
+    high = _mm_or_si128(high, _mm_slli_si128(highCarry, 4));
+    low = _mm_or_si128(low, _mm_slli_si128(lowCarry, 4));
+
+    /* First phase of the reduction */
+    __m128i fold = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+    __m128i foldCarry = _mm_srli_si128(fold, 4);
+    low = _mm_xor_si128(low, _mm_slli_si128(fold, 12));
+
+    /* Second phase of the reduction */
+    __m128i result = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+    result = _mm_xor_si128(_mm_xor_si128(result, foldCarry), low);
+    return _mm_xor_si128(high, result);
+}
+
+/********************************************************************
+ * Function: GhashClmulInit
+ * Description:
+ *  Function to precompute the powers H^1..H^GHASH_AGGREGATION for the
+ *  PCLMULQDQ backend, stored byte-reversed
+ * Inputs:  subkey      - GHASH subkey H (16 bytes)
+ * Outputs: ghashKey    - Precomputed powers of H
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("pclmul,ssse3,sse2")
+void GhashClmulInit(GhashKey& ghashKey, const uint8_t* subkey)
+{
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i h = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(subkey)), reverse);
+    __m128i power = h;
+
+    for (size_t i = 0; i < GHASH_AGGREGATION; ++i)
+    {
+        _mm_store_si128(reinterpret_cast<__m128i*>(ghashKey.clmulPowers[i]), power);
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        ClmulMultiply(power, h, low, high);
+        power = ClmulReduce(low, high);
+    }
+}
+
+/********************************************************************
+ * Function: GhashClmulBlocks
+ * Description:
+ *  Function to hash whole blocks with PCLMULQDQ using aggregated
+ *  reduction. Groups of GHASH_AGGREGATION blocks X1..Xn are folded
+ *  as (state ^ X1) * H^n ^ X2 * H^(n-1) ^ ... ^ Xn * H, which only
+ *  needs independent multiplications and a single reduction per
+ *  group. The remaining blocks are hashed one at a time
+ * Inputs:  ghashKey        - Precomputed subkey
+ *          state           - GHASH state (16 bytes)
+ *          data            - Blocks to be hashed
+ *          blocksNumber    - Number of blocks
+ * Outputs: state           - Updated GHASH state
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("pclmul,ssse3,sse2")
+void GhashClmulBlocks(const GhashKey& ghashKey, uint8_t* state, const uint8_t* data, size_t blocksNumber)
+{
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i powers[GHASH_AGGREGATION];
+    for (size_t i = 0; i < GHASH_AGGREGATION; ++i)
+    {
+        powers[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(ghashKey.clmulPowers[i]));
+    }
+    __m128i hash = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), reverse);
+
+    size_t block = 0;
+    for (; block + GHASH_AGGREGATION <= blocksNumber; block += GHASH_AGGREGATION)
+    {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        for (size_t i = 0; i < GHASH_AGGREGATION; ++i)
+        {
+            __m128i x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (block + i) * BLOCK_SIZE)), reverse);
+            if (i == 0)
+            {
+                x = _mm_xor_si128(x, hash);
+            }
+            ClmulMultiply(x, powers[GHASH_AGGREGATION - 1 - i], low, high);
+        }
+        hash = ClmulReduce(low, high);
+    }
+    for (; block < blocksNumber; ++block)
+    {
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + block * BLOCK_SIZE)), reverse);
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+        ClmulMultiply(_mm_xor_si128(x, hash), powers[0], low, high);
+        hash = ClmulReduce(low, high);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi8(hash, reverse));
+}
+#endif
+
+/********************************************************************
+ *************************** GCM Functions **************************
+ ********************************************************************/
+/********************************************************************
+ * Function: AesGcm::AesGcm
+ * Description:
+ *  Constructor of the GCM context. It derives the GHASH subkey
+ *  H = E(K, 0^128) and precomputes its multiples
+ * Inputs:  key     - Expanded key
+ *          backend - Requested GHASH backend
+ * Returns: void
+ ********************************************************************/
+AesGcm::AesGcm(const AesKey& key, GhashBackend backend) : key(key), ghashKey{}
+{
+    alignas(BLOCK_SIZE) uint8_t subkey[BLOCK_SIZE] = {};
+    AesEncryptBlock(key, subkey, subkey);
+    GhashInit(subkey, backend, ghashKey);
+    SecureZero(subkey, sizeof(subkey));
+}
+
+/********************************************************************
+ * Function: AesGcm::~AesGcm
+ * Description:
+ *  Destructor of the GCM context. It wipes the multiples of H
+ * Returns: void
+ ********************************************************************/
+AesGcm::~AesGcm()
+{
+    SecureZero(&ghashKey, sizeof(ghashKey));
+}
+
+/********************************************************************
+ * Function: AesGcm::Encrypt
+ * Description:
+ *  Function to encrypt and authenticate a message. input and output
+ *  may be the same buffer. An IV must never be reused with the same
+ *  key
+ * Inputs:  iv          - Initialization vector (GCM_IV_SIZE bytes recommended)
+ *          ivLength    - Length of the IV in bytes
+ *          aad         - Additional authenticated data (may be null when empty)
+ *          aadLength   - Length of the AAD in bytes
+ *          input       - Plaintext
+ *          length      - Length of the plaintext in bytes
+ * Outputs: output      - Ciphertext (length bytes)
+ *          tag         - Authentication tag (GCM_TAG_SIZE bytes)
+ * Returns: void
+ ********************************************************************/
+void AesGcm::Encrypt(const uint8_t* iv, size_t ivLength, const uint8_t* aad, size_t aadLength,
+                     const uint8_t* input, uint8_t* output, size_t length, uint8_t* tag) const
+{
+    Process(iv, ivLength, aad, aadLength, input, output, length, true, tag);
+}
+
+/********************************************************************
+ * Function: AesGcm::Decrypt
+ * Description:
+ *  Function to decrypt and verify a message. The tag is compared in
+ *  constant time. On a mismatch the output is wiped, so unverified
+ *  plaintext is never released. input and output may be the same
+ *  buffer
+ * Inputs:  iv          - Initialization vector used by the encryption
+ *          ivLength    - Length of the IV in bytes
+ *          aad         - Additional authenticated data (may be null when empty)
+ *          aadLength   - Length of the AAD in bytes
+ *          input       - Ciphertext
+ *          length      - Length of the ciphertext in bytes
+ *          tag         - Authentication tag (GCM_TAG_SIZE bytes)
+ * Outputs: output      - Plaintext (length bytes)
+ * Returns: true if the tag is valid, false otherwise
+ ********************************************************************/
+bool AesGcm::Decrypt(const uint8_t* iv, size_t ivLength, const uint8_t* aad, size_t aadLength,
+                     const uint8_t* input, uint8_t* output, size_t length, const uint8_t* tag) const
+{
+    uint8_t expectedTag[GCM_TAG_SIZE];
+    Process(iv, ivLength, aad, aadLength, input, output, length, false, expectedTag);
+
+    uint8_t difference = 0;
+    for (size_t i = 0; i < GCM_TAG_SIZE; ++i)
+    {
+        difference |= expectedTag[i] ^ tag[i];
+    }
+    SecureZero(expectedTag, sizeof(expectedTag));
+
+    if (difference != 0)
+    {
+        SecureZero(output, length);
+        return false;
+    }
+    return true;
+}
+
+/********************************************************************
+ * Function: AesGcm::Process
+ * Description:
+ *  Single pass shared by Encrypt and Decrypt:
+ *      1. Derive the pre-counter block J0 from the IV
+ *      2. Hash the AAD
+ *      3. For every chunk of KEYSTREAM_BLOCKS blocks, generate the
+ *         keystream from inc32(J0) onwards, XOR it into the data and
+ *         hash the ciphertext chunk (before the XOR when decrypting,
+ *         after it when encrypting) while it is still in cache
+ *      4. Hash the bit lengths of the AAD and the ciphertext and
+ *         encrypt the hash with J0 to get the tag
+ * Inputs:  iv, ivLength    - Initialization vector
+ *          aad, aadLength  - Additional authenticated data
+ *          input, length   - Input data
+ *          encrypt         - true to encrypt, false to decrypt
+ * Outputs: output          - Output data
+ *          tag             - Computed tag (GCM_TAG_SIZE bytes)
+ * Returns: void
+ ********************************************************************/
+void AesGcm::Process(const uint8_t* iv, size_t ivLength, const uint8_t* aad, size_t aadLength,
+                     const uint8_t* input, uint8_t* output, size_t length, bool encrypt, uint8_t* tag) const
+{
+    /* SP 800-38D limits the plaintext to 2^39 - 256 bits */
+    if (ivLength == 0)
+    {
+        throw std::invalid_argument("AES-GCM IV must not be empty.");
+    }
+    if (static_cast<uint64_t>(length) > ((1ULL << 36) - 32))
+    {
+        throw std::invalid_argument("AES-GCM message is too long.");
+    }
+
+    /* J0 is IV || 0^31 || 1 for a 96-bit IV, GHASH(IV || padding || [len(IV)]64) otherwise */
+    alignas(BLOCK_SIZE) uint8_t preCounter[BLOCK_SIZE] = {};
+    uint8_t lengthBlock[BLOCK_SIZE] = {};
+    if (ivLength == GCM_IV_SIZE)
+    {
+        std::memcpy(preCounter, iv, GCM_IV_SIZE);
+        preCounter[15] = 1;
+    }
+    else
+    {
+        GhashUpdate(ghashKey, preCounter, iv, ivLength);
+        uint64_t ivBits = static_cast<uint64_t>(ivLength) * 8;
+        for (int i = 0; i < 8; ++i)
+        {
+            lengthBlock[8 + i] = static_cast<uint8_t>(ivBits >> (56 - 8 * i));
+        }
+        GhashUpdate(ghashKey, preCounter, lengthBlock, BLOCK_SIZE);
+    }
+
+    /* Hash the AAD, padded on its own */
+    uint8_t hash[BLOCK_SIZE] = {};
+    if (aadLength != 0)
+    {
+        GhashUpdate(ghashKey, hash, aad, aadLength);
+    }
+
+    /* Encrypt and hash chunk by chunk so the data is touched once */
+    alignas(BUFFER_ALIGNMENT) uint8_t keystream[KEYSTREAM_BLOCKS * BLOCK_SIZE];
+    uint32_t counter = LoadWordBigEndian(preCounter + 12) + 1;
+    for (size_t offset = 0; offset < length; offset += sizeof(keystream))
+    {
+        size_t chunkLength = std::min<size_t>(sizeof(keystream), length - offset);
+        size_t chunkBlocks = (chunkLength + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+        GcmGenerateKeystream(key, preCounter, counter, keystream, chunkBlocks);
+        counter += static_cast<uint32_t>(chunkBlocks);
+
+        if (!encrypt)
+        {
+            GhashUpdate(ghashKey, hash, input + offset, chunkLength);
+        }
+        XorBytes(input + offset, keystream, output + offset, chunkLength);
+        if (encrypt)
+        {
+            GhashUpdate(ghashKey, hash, output + offset, chunkLength);
+        }
+    }
+    SecureZero(keystream, sizeof(keystream));
+
+    /* Close the hash with [len(A)]64 || [len(C)]64 */
+    uint64_t aadBits = static_cast<uint64_t>(aadLength) * 8;
+    uint64_t textBits = static_cast<uint64_t>(length) * 8;
+    for (int i = 0; i < 8; ++i)
+    {
+        lengthBlock[i] = static_cast<uint8_t>(aadBits >> (56 - 8 * i));
+        lengthBlock[8 + i] = static_cast<uint8_t>(textBits >> (56 - 8 * i));
+    }
+    GhashUpdate(ghashKey, hash, lengthBlock, BLOCK_SIZE);
+
+    /* The tag is the hash encrypted with J0 */
+    AesEncryptBlock(key, preCounter, preCounter);
+    XorBytes(hash, preCounter, tag, GCM_TAG_SIZE);
+}
+
+/********************************************************************
+ * Function: GcmGenerateKeystream
+ * Description:
+ *  Function to generate consecutive GCM keystream blocks. GCM only
+ *  increments the last 32 bits of the counter block (inc32), which
+ *  wrap around without carrying into the IV part, so the counter
+ *  blocks are laid out here rather than with IncrementCounter. They
+ *  are then encrypted in one multi-block call
+ * Inputs:  key             - Expanded key
+ *          preCounter      - Pre-counter block J0 (its first 12 bytes are kept)
+ *          counter         - 32-bit counter of the first block
+ *          blocksNumber    - Number of blocks
+ * Outputs: keystream       - Keystream blocks
+ * Returns: void
+ ********************************************************************/
+void GcmGenerateKeystream(const AesKey& key, const uint8_t* preCounter, uint32_t counter, uint8_t* keystream, size_t blocksNumber)
+{
+    for (size_t i = 0; i < blocksNumber; ++i)
+    {
+        std::memcpy(keystream + i * BLOCK_SIZE, preCounter, BLOCK_SIZE - 4);
+        StoreWordBigEndian(counter + static_cast<uint32_t>(i), keystream + i * BLOCK_SIZE + BLOCK_SIZE - 4);
+    }
+    AesEncryptBlocks(key, keystream, keystream, blocksNumber);
+}
+
+/********************************************************************
+ ************************* File Mode Functions **********************
+ ********************************************************************/
+#if AES_POSIX
+/********************************************************************
+ * Function: ThrowSystemError
+ * Description:
+ *  Function to report a failed system call together with errno
+ * Inputs:  what    - Description of the failed operation
+ * Returns: Does not return
+ ********************************************************************/
+[[noreturn]] static void ThrowSystemError(const std::string& what)
+{
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/* Destructor of the file descriptor owner, closing it unless Close already did */
+FileDescriptor::~FileDescriptor()
+{
+    if (file >= 0)
+    {
+        close(file);
+    }
+}
+
+/********************************************************************
+ * Function: FileDescriptor::Close
+ * Description:
+ *  Function to close the file descriptor now instead of on
+ *  destruction
+ * Returns: false if close failed (e.g. delayed write error)
+ ********************************************************************/
+bool FileDescriptor::Close()
+{
+    int result = close(file);
+    file = -1;
+    return result == 0;
+}
+
+/********************************************************************
+ * Function: FileMapping::FileMapping
+ * Description:
+ *  Constructor of the file window mapping
+ * Inputs:  file        - File descriptor
+ *          offset      - Offset of the window (page aligned)
+ *          length      - Length of the window in bytes
+ *          protection  - PROT_READ, optionally with PROT_WRITE
+ *          path        - Path of the file, for the error message
+ * Returns: void
+ ********************************************************************/
+FileMapping::FileMapping(int file, uint64_t offset, size_t length, int protection, const std::string& path) : data(nullptr), length(length)
+{
+    void* mapping = mmap(nullptr, length, protection, MAP_SHARED, file, static_cast<off_t>(offset));
+    if (mapping == MAP_FAILED)
+    {
+        ThrowSystemError("Cannot map " + path);
+    }
+    data = static_cast<uint8_t*>(mapping);
+}
+
+/* Destructor of the file window mapping */
+FileMapping::~FileMapping()
+{
+    munmap(data, length);
+}
+#endif
+
+/********************************************************************
+ * Function: FileDispatcher
+ * Description:
+ *  Function to encrypt or decrypt a whole file in counter mode into
+ *  another file. The input and the output are memory-mapped, so the
+ *  data goes from the page cache through the keystream XOR straight
+ *  back to the page cache with no user-space copies. The files are
+ *  processed in windows of FILE_WINDOW_SIZE bytes so that files far
+ *  larger than RAM (or the address space) can be handled; each window
+ *  is split into counter-aligned ranges across the worker pool by
+ *  StatesDispatcher, starting at counter + window offset / 16.
+ *  Pipes, sockets and stdin/stdout ("-") cannot be mapped, so they
+ *  (and every file on targets without POSIX mmap) go through the
+ *  streaming pipeline instead. When built with AES_IO_URING, regular
+ *  files go through io_uring if the kernel allows it. The output
+ *  blocks are reserved before mapping so a full disk is reported as
+ *  an error, and an output naming the input file itself is processed
+ *  in place
+ * Inputs:  key         - Expanded key
+ *          counter     - Initial counter block
+ *          inputPath   - File to be processed
+ *          outputPath  - File receiving the result (created or resized)
+ * Returns: void
+ ********************************************************************/
+void FileDispatcher(const AesKey& key, const CounterBlock& counter, const std::string& inputPath, const std::string& outputPath)
+{
+#if AES_POSIX
+    if ((inputPath == "-") || (outputPath == "-"))
+    {
+        PipelineFileDispatcher(key, counter, inputPath, outputPath);
+        return;
+    }
+
+    FileDescriptor inputFile(open(inputPath.c_str(), O_RDONLY));
+    if (inputFile.Get() < 0)
+    {
+        ThrowSystemError("Cannot open " + inputPath);
+    }
+
+    struct stat inputStat;
+    if (fstat(inputFile.Get(), &inputStat) != 0)
+    {
+        ThrowSystemError("Cannot stat " + inputPath);
+    }
+
+    /* Only regular files can be mapped */
+    if (!S_ISREG(inputStat.st_mode))
+    {
+        inputFile.Close();
+        PipelineFileDispatcher(key, counter, inputPath, outputPath);
+        return;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(inputStat.st_size);
+
+    /* The output is not truncated on open, it may be the input itself under another path */
+    FileDescriptor outputFile(open(outputPath.c_str(), O_RDWR | O_CREAT, 0644));
+    if (outputFile.Get() < 0)
+    {
+        ThrowSystemError("Cannot open " + outputPath);
+    }
+
+    struct stat outputStat;
+    if (fstat(outputFile.Get(), &outputStat) != 0)
+    {
+        ThrowSystemError("Cannot stat " + outputPath);
+    }
+
+    /* The same file on both sides is processed in place through its writable mapping only */
+    bool inPlace = (inputStat.st_dev == outputStat.st_dev) && (inputStat.st_ino == outputStat.st_ino);
+
+    /* The output mapping needs the output file to have its final size up front */
+    if (!inPlace && (ftruncate(outputFile.Get(), static_cast<off_t>(fileSize)) != 0))
+    {
+        ThrowSystemError("Cannot resize " + outputPath);
+    }
+
+    /* Reserve the blocks now, a write fault on a full disk through the mapping would raise SIGBUS */
+    if (fileSize != 0)
+    {
+        int allocationError = posix_fallocate(outputFile.Get(), 0, static_cast<off_t>(fileSize));
+        if (allocationError != 0)
+        {
+            errno = allocationError;
+            ThrowSystemError("Cannot allocate " + outputPath);
+        }
+    }
+
+#if AES_IO_URING
+    bool processed = IoUringFileDispatcher(key, counter, inputFile.Get(), outputFile.Get(), fileSize);
+#else
+    bool processed = false;
+#endif
+
+    for (uint64_t windowOffset = 0; !processed && (windowOffset < fileSize); windowOffset += FILE_WINDOW_SIZE)
+    {
+        size_t windowLength = static_cast<size_t>(std::min<uint64_t>(FILE_WINDOW_SIZE, fileSize - windowOffset));
+
+        FileMapping outputWindow(outputFile.Get(), windowOffset, windowLength, PROT_READ | PROT_WRITE, outputPath);
+        std::optional<FileMapping> inputWindow;
+        if (!inPlace)
+        {
+            inputWindow.emplace(inputFile.Get(), windowOffset, windowLength, PROT_READ, inputPath);
+        }
+        uint8_t* input = inPlace ? outputWindow.Data() : inputWindow->Data();
+        uint8_t* output = outputWindow.Data();
+
+        /* Each worker walks its range front to back, let the kernel read ahead accordingly */
+        madvise(input, windowLength, MADV_SEQUENTIAL);
+        madvise(input, windowLength, MADV_WILLNEED);
+        madvise(output, windowLength, MADV_SEQUENTIAL);
+
+        /* Every window starts on a block boundary, so its counter is derived directly */
+        CounterBlock windowCounter;
+        CounterAdd(counter, windowOffset / BLOCK_SIZE, windowCounter);
+
+        ConstBlockView states(input, windowLength);
+        BlockView outputStates{output, states.blocksNumber, windowLength};
+        StatesDispatcher(key, states, windowCounter, outputStates);
+    }
+
+    if (!outputFile.Close())
+    {
+        ThrowSystemError("Cannot write " + outputPath);
+    }
+#else
+    PipelineFileDispatcher(key, counter, inputPath, outputPath);
+#endif
+}
+
+/********************************************************************
+ * Function: ParseCounter
+ * Description:
+ *  Function to parse a counter block given as 32 hex digits
+ * Inputs:  strCounter  - Counter as text
+ * Outputs: counter     - Parsed counter block
+ * Returns: void
+ ********************************************************************/
+void ParseCounter(const std::string& strCounter, CounterBlock& counter)
+{
+    if ((strCounter.size() != 2 * counter.size()) || !HexDecode(strCounter.data(), strCounter.size(), counter.data()))
+    {
+        throw std::invalid_argument("Counter must be 32 hex digits.");
+    }
+}
+
+#if AES_IO_URING
+/********************************************************************
+ ************************** io_uring Functions **********************
+ ********************************************************************/
+/********************************************************************
+ * Function: IoUring::IoUring
+ * Description:
+ *  Constructor of the io_uring instance. It creates the ring with
+ *  io_uring_setup and maps the submission ring, the completion ring
+ *  and the submission queue entries into the process
+ * Inputs:  entries - Number of submission queue entries
+ * Returns: void
+ ********************************************************************/
+IoUring::IoUring(unsigned entries) : ringFile(-1), pendingSubmissions(0), submissionRing(MAP_FAILED), submissionRingSize(0),
+                                     completionRing(MAP_FAILED), completionRingSize(0), submissionEntries(nullptr), submissionEntriesSize(0)
+{
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    ringFile = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ringFile < 0)
+    {
+        ThrowSystemError("Cannot create io_uring");
+    }
+
+    submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    submissionEntriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Recent kernels map both rings with a single mapping */
+    bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMapping)
+    {
+        submissionRingSize = std::max(submissionRingSize, completionRingSize);
+        completionRingSize = submissionRingSize;
+    }
+
+    submissionRing = mmap(nullptr, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFile, IORING_OFF_SQ_RING);
+    if (submissionRing == MAP_FAILED)
+    {
+        close(ringFile);
+        ThrowSystemError("Cannot map the io_uring submission ring");
+    }
+    completionRing = singleMapping ? submissionRing :
+                     mmap(nullptr, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFile, IORING_OFF_CQ_RING);
+    void* entriesMapping = (completionRing == MAP_FAILED) ? MAP_FAILED :
+                           mmap(nullptr, submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFile, IORING_OFF_SQES);
+    if (entriesMapping == MAP_FAILED)
+    {
+        int mappingError = errno;
+        if ((completionRing != MAP_FAILED) && !singleMapping)
+        {
+            munmap(completionRing, completionRingSize);
+        }
+        munmap(submissionRing, submissionRingSize);
+        close(ringFile);
+        errno = mappingError;
+        ThrowSystemError("Cannot map the io_uring rings");
+    }
+    submissionEntries = static_cast<struct io_uring_sqe*>(entriesMapping);
+
+    uint8_t* submissionBase = static_cast<uint8_t*>(submissionRing);
+    submissionHead = reinterpret_cast<unsigned*>(submissionBase + params.sq_off.head);
+    submissionTail = reinterpret_cast<unsigned*>(submissionBase + params.sq_off.tail);
+    submissionMask = reinterpret_cast<unsigned*>(submissionBase + params.sq_off.ring_mask);
+    submissionArray = reinterpret_cast<unsigned*>(submissionBase + params.sq_off.array);
+    submissionEntriesNumber = params.sq_entries;
+
+    uint8_t* completionBase = static_cast<uint8_t*>(completionRing);
+    completionHead = reinterpret_cast<unsigned*>(completionBase + params.cq_off.head);
+    completionTail = reinterpret_cast<unsigned*>(completionBase + params.cq_off.tail);
+    completionMask = reinterpret_cast<unsigned*>(completionBase + params.cq_off.ring_mask);
+    completionEntries = reinterpret_cast<struct io_uring_cqe*>(completionBase + params.cq_off.cqes);
+}
+
+/********************************************************************
+ * Function: IoUring::~IoUring
+ * Description:
+ *  Destructor of the io_uring instance. It unmaps the rings and
+ *  closes the ring file descriptor
+ * Returns: void
+ ********************************************************************/
+IoUring::~IoUring()
+{
+    munmap(submissionEntries, submissionEntriesSize);
+    if (completionRing != submissionRing)
+    {
+        munmap(completionRing, completionRingSize);
+    }
+    munmap(submissionRing, submissionRingSize);
+    close(ringFile);
+}
+
+/********************************************************************
+ * Function: IoUring::RegisterBuffers
+ * Description:
+ *  Function to register fixed buffers with the ring, so the kernel
+ *  pins and maps them once instead of on every read and write
+ * Inputs:  buffers         - Buffers to be registered
+ *          buffersNumber   - Number of buffers
+ * Returns: true if the buffers were registered
+ ********************************************************************/
+bool IoUring::RegisterBuffers(const struct iovec* buffers, unsigned buffersNumber)
+{
+    return syscall(__NR_io_uring_register, ringFile, IORING_REGISTER_BUFFERS, buffers, buffersNumber) == 0;
+}
+
+/********************************************************************
+ * Function: IoUring::NextSqe
+ * Description:
+ *  Function to get the next free submission queue entry, cleared.
+ *  The entry is handed to the kernel by the next Submit
+ * Returns: Submission queue entry to be filled
+ ********************************************************************/
+struct io_uring_sqe* IoUring::NextSqe()
+{
+    unsigned tail = *submissionTail;
+    unsigned head = std::atomic_ref<unsigned>(*submissionHead).load(std::memory_order_acquire);
+    if (tail - head == submissionEntriesNumber)
+    {
+        throw std::runtime_error("io_uring submission queue is full.");
+    }
+
+    unsigned index = tail & *submissionMask;
+    struct io_uring_sqe* sqe = &submissionEntries[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    submissionArray[index] = index;
+    std::atomic_ref<unsigned>(*submissionTail).store(tail + 1, std::memory_order_release);
+    pendingSubmissions++;
+    return sqe;
+}
+
+/********************************************************************
+ * Function: IoUring::Submit
+ * Description:
+ *  Function to submit all the pending entries in one system call and
+ *  optionally wait for completions
+ * Inputs:  waitCompletions - Number of completions to wait for
+ * Returns: void
+ ********************************************************************/
+void IoUring::Submit(unsigned waitCompletions)
+{
+    while ((pendingSubmissions != 0) || (waitCompletions != 0))
+    {
+        long submitted = syscall(__NR_io_uring_enter, ringFile, pendingSubmissions, waitCompletions,
+                                 (waitCompletions != 0) ? IORING_ENTER_GETEVENTS : 0U, nullptr, 0);
+        if (submitted < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ThrowSystemError("Cannot submit to io_uring");
+        }
+        pendingSubmissions -= static_cast<unsigned>(submitted);
+        waitCompletions = 0;
+    }
+}
+
+/********************************************************************
+ * Function: IoUring::PopCompletion
+ * Description:
+ *  Function to reap one completion queue entry if there is any
+ * Outputs: userData    - User data of the completed request
+ *          result      - Result of the request (bytes or -errno)
+ * Returns: true if a completion was reaped
+ ********************************************************************/
+bool IoUring::PopCompletion(uint64_t& userData, int32_t& result)
+{
+    unsigned head = *completionHead;
+    unsigned tail = std::atomic_ref<unsigned>(*completionTail).load(std::memory_order_acquire);
+    if (head == tail)
+    {
+        return false;
+    }
+
+    const struct io_uring_cqe& cqe = completionEntries[head & *completionMask];
+    userData = cqe.user_data;
+    result = cqe.res;
+    std::atomic_ref<unsigned>(*completionHead).store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/********************************************************************
+ * Function: IoUring::Drain
+ * Description:
+ *  Function to wait for every request the kernel has been handed,
+ *  discarding their completions, so the buffers they read into or
+ *  write from can be freed. Entries queued by NextSqe but never
+ *  submitted are not waited for, the kernel has not seen them
+ * Inputs:  inFlight    - Requests queued and not completed yet
+ * Returns: void
+ ********************************************************************/
+void IoUring::Drain(unsigned inFlight) noexcept
+{
+    unsigned outstanding = inFlight - std::min(inFlight, pendingSubmissions);
+    while (outstanding != 0)
+    {
+        uint64_t userData;
+        int32_t result;
+        while ((outstanding != 0) && PopCompletion(userData, result))
+        {
+            outstanding--;
+        }
+        if ((outstanding != 0) &&
+            (syscall(__NR_io_uring_enter, ringFile, 0U, 1U, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) && (errno != EINTR))
+        {
+            /* Waiting is impossible, nothing better is left than giving the requests up */
+            break;
+        }
+    }
+}
+
+/********************************************************************
+ * Function: IoUringFileDispatcher
+ * Description:
+ *  Function to encrypt or decrypt a regular file in counter mode
+ *  with io_uring. IO_URING_DEPTH registered buffers cycle through
+ *  read -> keystream -> write:
+ *      1. Reads are issued for all the buffers up front, so several
+ *         reads are in flight ahead of the encryption
+ *      2. Each read that completes is processed in place by
+ *         StatesDispatcher as soon as it arrives, in any order, with
+ *         the counter derived from its file offset, and its write is
+ *         queued
+ *      3. A completed write frees its buffer for the next read
+ *  Newly queued requests are sent in one batch per io_uring_enter.
+ *  Short transfers are resubmitted for the remaining bytes. On an
+ *  error, including an exception of the submission or of the
+ *  dispatch, all the requests in flight are drained before throwing
+ * Inputs:  key         - Expanded key
+ *          counter     - Initial counter block
+ *          inputFile   - Input file descriptor
+ *          outputFile  - Output file descriptor (already sized)
+ *          fileSize    - Size of the input file in bytes
+ * Returns: false if io_uring is not available, true once processed
+ ********************************************************************/
+bool IoUringFileDispatcher(const AesKey& key, const CounterBlock& counter, int inputFile, int outputFile, uint64_t fileSize)
+{
+    struct IoUringSlot
+    {
+        BlockBuffer data;
+        uint64_t offset;
+        size_t length;
+        size_t done;
+        bool writing;
+    };
+
+    /* Declared before the ring, so an unwinding exception tears the ring down before it frees the buffers */
+    std::array<IoUringSlot, IO_URING_DEPTH> slots;
+    std::array<struct iovec, IO_URING_DEPTH> buffers;
+
+    /* Old kernels and sandboxes may not provide io_uring, let the caller fall back */
+    std::unique_ptr<IoUring> ring;
+    try
+    {
+        ring = std::make_unique<IoUring>(IO_URING_DEPTH);
+    }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < IO_URING_DEPTH; ++i)
+    {
+        slots[i].data.Resize(PIPELINE_BUFFER_SIZE);
+        buffers[i].iov_base = slots[i].data.Data();
+        buffers[i].iov_len = PIPELINE_BUFFER_SIZE;
+    }
+
+    /* Registered buffers are an optimization only, plain reads and writes work without them */
+    bool fixedBuffers = ring->RegisterBuffers(buffers.data(), IO_URING_DEPTH);
+
+    uint64_t nextOffset = 0;
+    unsigned inFlight = 0;
+    int firstError = 0;
+
+    /* Queue the transfer of the bytes of a slot not moved yet */
+    auto queueTransfer = [&](size_t index)
+    {
+        IoUringSlot& slot = slots[index];
+        struct io_uring_sqe* sqe = ring->NextSqe();
+        if (fixedBuffers)
+        {
+            sqe->opcode = slot.writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->buf_index = static_cast<uint16_t>(index);
+        }
+        else
+        {
+            sqe->opcode = slot.writing ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        sqe->fd = slot.writing ? outputFile : inputFile;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.data.Data() + slot.done);
+        sqe->len = static_cast<uint32_t>(slot.length - slot.done);
+        sqe->off = slot.offset + slot.done;
+        sqe->user_data = index;
+        inFlight++;
+    };
+
+    /* Start reading the next chunk of the file into a slot */
+    auto queueRead = [&](size_t index)
+    {
+        IoUringSlot& slot = slots[index];
+        slot.offset = nextOffset;
+        slot.length = static_cast<size_t>(std::min<uint64_t>(PIPELINE_BUFFER_SIZE, fileSize - nextOffset));
+        slot.done = 0;
+        slot.writing = false;
+        nextOffset += slot.length;
+        queueTransfer(index);
+    };
+
+    try
+    {
+        for (size_t i = 0; (i < IO_URING_DEPTH) && (nextOffset < fileSize); ++i)
+        {
+            queueRead(i);
+        }
+
+        while (inFlight != 0)
+        {
+            /* Send everything queued so far and wait for at least one completion */
+            ring->Submit(1);
+
+            uint64_t userData;
+            int32_t result;
+            while (ring->PopCompletion(userData, result))
+            {
+                inFlight--;
+                size_t index = static_cast<size_t>(userData);
+                IoUringSlot& slot = slots[index];
+
+                if ((result == -EINTR) || (result == -EAGAIN))
+                {
+                    result = 0;
+                }
+                else if ((result < 0) || ((result == 0) && !slot.writing))
+                {
+                    /* A read returning nothing means the file shrank under us */
+                    firstError = (firstError != 0) ? firstError : ((result < 0) ? -result : EIO);
+                }
+                if (firstError != 0)
+                {
+                    continue;
+                }
+
+                /* Resubmit the rest of a short transfer */
+                slot.done += static_cast<size_t>(result);
+                if (slot.done < slot.length)
+                {
+                    queueTransfer(index);
+                    continue;
+                }
+
+                if (!slot.writing)
+                {
+                    /* Keep the reads queued so far moving while the workers process this chunk */
+                    ring->Submit(0);
+
+                    CounterBlock slotCounter;
+                    CounterAdd(counter, slot.offset / BLOCK_SIZE, slotCounter);
+                    ConstBlockView states(slot.data.Data(), slot.length);
+                    BlockView outputStates{slot.data.Data(), states.blocksNumber, slot.length};
+                    StatesDispatcher(key, states, slotCounter, outputStates);
+
+                    slot.writing = true;
+                    slot.done = 0;
+                    queueTransfer(index);
+                }
+                else if (nextOffset < fileSize)
+                {
+                    queueRead(index);
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        /* A failed submission or dispatch leaves requests in flight on the buffers, wait for them first */
+        ring->Drain(inFlight);
+        throw;
+    }
+
+    if (firstError != 0)
+    {
+        errno = firstError;
+        ThrowSystemError("io_uring file transfer failed");
+    }
+    return true;
+}
+#endif
+
+/********************************************************************
+ ************************** Pipeline Functions **********************
+ ********************************************************************/
+/********************************************************************
+ * Function: PipelineDispatcher
+ * Description:
+ *  Function to encrypt or decrypt a stream that cannot be mapped
+ *  (pipe, socket, terminal). RunPipeline overlaps the reads and the
+ *  writes with stage 2, which applies the keystream to every filled
+ *  buffer through AesCtrStream, spreading large buffers over the
+ *  worker pool. The counter carries over from buffer to buffer
+ * Inputs:  key     - Expanded key
+ *          counter - Initial counter block
+ *          input   - Stream to be processed
+ * Outputs: output  - Stream receiving the result
+ * Returns: void
+ ********************************************************************/
+void PipelineDispatcher(const AesKey& key, const CounterBlock& counter, std::istream& input, std::ostream& output)
+{
+    AesCtrStream stream;
+    stream.Init(key, counter);
+    RunPipeline(input, output, [&stream](uint8_t* data, size_t length)
+    {
+        stream.Update(data, data, length);
+    });
+    stream.Final();
+}
+
+/********************************************************************
+ * Function: RunPipeline
+ * Description:
+ *  Function to stream the input to the output through three
+ *  pipelined stages:
+ *      1. A reader thread fills free buffers from the input
+ *      2. The calling thread runs process on every filled buffer
+ *      3. A writer thread writes the buffers out and recycles them
+ *  The stages hand PIPELINE_DEPTH buffers of PIPELINE_BUFFER_SIZE
+ *  bytes around through bounded single-producer single-consumer
+ *  queues, so reading, processing and writing overlap, a slow stage
+ *  holds the others back, and memory stays bounded whatever the
+ *  stream length. Every queue keeps a single producer: the reader
+ *  fills filledBuffers, the calling thread processedBuffers and the
+ *  writer freeBuffers. If process throws, the calling thread pushes
+ *  an end marker to the writer, the writer forwards it to the
+ *  reader, both threads are joined and the exception is rethrown
+ * Inputs:  input   - Stream to be processed
+ *          process - Transformation applied in place to each buffer
+ * Outputs: output  - Stream receiving the result
+ * Returns: void
+ ********************************************************************/
+void RunPipeline(std::istream& input, std::ostream& output, const std::function<void(uint8_t*, size_t)>& process)
+{
+    std::array<PipelineBuffer, PIPELINE_DEPTH> buffers;
+    /* One slot more than the buffers so the shutdown end marker always fits without blocking */
+    BoundedQueue<PipelineBuffer*, PIPELINE_DEPTH + 1> freeBuffers;
+    BoundedQueue<PipelineBuffer*, PIPELINE_DEPTH> filledBuffers;
+    BoundedQueue<PipelineBuffer*, PIPELINE_DEPTH + 1> processedBuffers;
+    std::atomic<bool> readFailed(false);
+    std::atomic<bool> writeFailed(false);
+    std::atomic<bool> aborted(false);
+    PipelineBuffer endMarker;
+    endMarker.length = 0;
+
+    /* All the memory of the pipeline is allocated up front */
+    for (PipelineBuffer& buffer : buffers)
+    {
+        buffer.data.Resize(PIPELINE_BUFFER_SIZE);
+        buffer.length = 0;
+        freeBuffers.Push(&buffer);
+    }
+
+    /* Stage 1: read until the end of the input, then pass an empty buffer down as the end marker */
+    std::jthread reader([&input, &freeBuffers, &filledBuffers, &readFailed, &aborted]()
+    {
+        for (;;)
+        {
+            PipelineBuffer* buffer = freeBuffers.Pop();
+            if (aborted)
+            {
+                break;
+            }
+            input.read(reinterpret_cast<char*>(buffer->data.Data()), static_cast<std::streamsize>(PIPELINE_BUFFER_SIZE));
+            buffer->length = static_cast<size_t>(input.gcount());
+            if (input.bad())
+            {
+                readFailed = true;
+                buffer->length = 0;
+            }
+            filledBuffers.Push(buffer);
+            if (buffer->length == 0)
+            {
+                break;
+            }
+        }
+    });
+
+    /* Stage 3: write the processed buffers in order and hand them back to the reader */
+    auto writerLoop = [&output, &freeBuffers, &processedBuffers, &writeFailed, &aborted, &endMarker]()
+    {
+        for (;;)
+        {
+            PipelineBuffer* buffer = processedBuffers.Pop();
+            if (buffer == &endMarker)
+            {
+                /* Shutdown: pass the marker on to the reader, which may be waiting for a free buffer */
+                freeBuffers.Push(&endMarker);
+                break;
+            }
+            if (buffer->length == 0)
+            {
+                break;
+            }
+            if (!writeFailed && !aborted)
+            {
+                output.write(reinterpret_cast<const char*>(buffer->data.Data()), static_cast<std::streamsize>(buffer->length));
+                writeFailed = !output;
+            }
+            freeBuffers.Push(buffer);
+        }
+        output.flush();
+        writeFailed = writeFailed || !output;
+    };
+    std::jthread writer;
+    try
+    {
+        writer = std::jthread(writerLoop);
+    }
+    catch (...)
+    {
+        /* Without a writer the calling thread is the only producer of freeBuffers, so it stops the reader itself */
+        aborted = true;
+        freeBuffers.Push(&endMarker);
+        throw;
+    }
+
+    /* Stage 2: process the buffers in place */
+    try
+    {
+        for (;;)
+        {
+            PipelineBuffer* buffer = filledBuffers.Pop();
+            /* The buffer belongs to the writer once pushed, so its length is read before */
+            size_t length = buffer->length;
+            process(buffer->data.Data(), length);
+            processedBuffers.Push(buffer);
+            if (length == 0)
+            {
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        /* Stop the writer, which stops the reader in turn; the jthreads join them while the exception unwinds */
+        aborted = true;
+        processedBuffers.Push(&endMarker);
+        throw;
+    }
+
+    reader.join();
+    writer.join();
+
+    if (readFailed)
+    {
+        throw std::runtime_error("Cannot read the input stream.");
+    }
+    if (writeFailed)
+    {
+        throw std::runtime_error("Cannot write the output stream.");
+    }
+}
+
+/********************************************************************
+ * Function: PipelineFileDispatcher
+ * Description:
+ *  Function to run the streaming pipeline between two paths, where
+ *  "-" stands for stdin or stdout
+ * Inputs:  key         - Expanded key
+ *          counter     - Initial counter block
+ *          inputPath   - Input path or "-"
+ *          outputPath  - Output path or "-"
+ * Returns: void
+ ********************************************************************/
+void PipelineFileDispatcher(const AesKey& key, const CounterBlock& counter, const std::string& inputPath, const std::string& outputPath)
+{
+    std::ifstream inputFile;
+    std::ofstream outputFile;
+
+    if (inputPath != "-")
+    {
+        inputFile.open(inputPath, std::ios::binary);
+        if (!inputFile)
+        {
+            throw std::runtime_error("Cannot open " + inputPath);
+        }
+    }
+    if (outputPath != "-")
+    {
+        outputFile.open(outputPath, std::ios::binary | std::ios::trunc);
+        if (!outputFile)
+        {
+            throw std::runtime_error("Cannot open " + outputPath);
+        }
+    }
+
+    PipelineDispatcher(key, counter,
+                       (inputPath == "-") ? static_cast<std::istream&>(std::cin) : static_cast<std::istream&>(inputFile),
+                       (outputPath == "-") ? static_cast<std::ostream&>(std::cout) : static_cast<std::ostream&>(outputFile));
+}
+
+/********************************************************************
+ ************************ AES Key Functions *************************
+ ********************************************************************/
+/********************************************************************
+ * Function: AesKey::AesKey
+ * Description:
+ *  Constructor of the AES key context. The runtime key size is
+ *  dispatched once to the key expansion instantiated for it
+ * Inputs:  key     - Cipher key
+ *          keySize - Size of the cipher key in bytes (16, 24 or 32)
+ *          backend - Backend implementing the rounds
+ * Returns: void
+ ********************************************************************/
+AesKey::AesKey(const uint8_t* key, size_t keySize, AesBackend backend) : backend(SelectAesBackend(backend)), keySize(keySize), rounds(0)
+{
+    /* Only the three key sizes defined by AES are accepted, anything else throws */
+    DispatchKeySize(keySize, [&](auto size) { Expand<decltype(size)::value>(key); });
+}
+
+/********************************************************************
+ * Function: AesKey::~AesKey
+ * Description:
+ *  Destructor of the AES key context. It wipes every form of both
+ *  key schedules, any of which gives the cipher key back
+ * Returns: void
+ ********************************************************************/
+AesKey::~AesKey()
+{
+    SecureZero(encryptionWords.data(), sizeof(encryptionWords));
+    SecureZero(decryptionWords.data(), sizeof(decryptionWords));
+    SecureZero(encryptionRoundKeys.data(), sizeof(encryptionRoundKeys));
+    SecureZero(decryptionRoundKeys.data(), sizeof(decryptionRoundKeys));
+    SecureZero(bitslicedRoundKeys.data(), sizeof(bitslicedRoundKeys));
+}
+
+/********************************************************************
+ * Function: AesKey::Expand
+ * Description:
+ *  Key expansion for a fixed key size. It runs the key expansion
+ *  once and derives from it:
+ *      1. The encryption round keys as words and as bytes
+ *      2. The decryption round keys of the equivalent inverse cipher,
+ *         which are the encryption round keys in reverse order with
+ *         InvMixColumns applied to all but the first and last ones
+ * Inputs:  key     - Cipher key (KeySize bytes)
+ * Returns: void
+ ********************************************************************/
+template <size_t KeySize>
+void AesKey::Expand(const uint8_t* key)
+{
+    constexpr int Nr = AesParameters<KeySize>::Nr;
+    rounds = Nr;
+
+#if AES_X86
+    /* The AES-NI backend expands both schedules with AESKEYGENASSIST and AESIMC */
+    if (backend == AesBackend::AesNi)
+    {
+        AesNiKeyExpansion<KeySize>(key, encryptionRoundKeys, decryptionRoundKeys);
+
+        /* Keep the word form of both schedules in sync with the round keys */
+        for (int i = 0; i < NUM_COLUMN * (Nr + 1); ++i)
+        {
+            encryptionWords[i] = LoadWordBigEndian(&encryptionRoundKeys[i / NUM_COLUMN][4 * (i % NUM_COLUMN)]);
+            decryptionWords[i] = LoadWordBigEndian(&decryptionRoundKeys[i / NUM_COLUMN][4 * (i % NUM_COLUMN)]);
+        }
+        return;
+    }
+#endif
+
+    /* Expand the key schedule (NUM_COLUMN * (Nr + 1) words) */
+    const KeySchedule<KeySize> schedule = KeyExpansion<KeySize>(key);
+    std::copy(schedule.begin(), schedule.end(), encryptionWords.begin());
+
+    /* Store the encryption round keys as bytes, each word most significant byte first */
+    for (int i = 0; i < NUM_COLUMN * (Nr + 1); ++i)
+    {
+        StoreWordBigEndian(encryptionWords[i], &encryptionRoundKeys[i / NUM_COLUMN][4 * (i % NUM_COLUMN)]);
+    }
+
+    /* Build the decryption round keys of the equivalent inverse cipher */
+    for (int round = 0; round <= Nr; ++round)
+    {
+        /* Load the round key in reverse order as a state matrix */
+        uint8_t roundKeyState[4][4];
+        for (int col = 0; col < 4; ++col)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                roundKeyState[row][col] = encryptionRoundKeys[Nr - round][4 * col + row];
+            }
+        }
+
+        /* The inner rounds apply InvMixColumns before AddRoundKey, so fold it into their keys */
+        if ((round != 0) && (round != Nr))
+        {
+            InvMixColumns(roundKeyState);
+        }
+
+        /* Store the round key as bytes and as words */
+        for (int col = 0; col < 4; ++col)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                decryptionRoundKeys[round][4 * col + row] = roundKeyState[row][col];
+            }
+            decryptionWords[round * NUM_COLUMN + col] = LoadWordBigEndian(&decryptionRoundKeys[round][4 * col]);
+        }
+    }
+
+    /* The bitsliced backend works on its own representation of the round keys */
+    if (backend == AesBackend::Bitsliced)
+    {
+        BitslicedKeySchedule<Nr>(encryptionRoundKeys, bitslicedRoundKeys);
+    }
+}
+
+/********************************************************************
+ * Function: SelectAesBackend
+ * Description:
+ *  Function to resolve the backend to be used by a key. Automatic
+ *  selects AES-NI when the CPU supports it and falls back to the
+ *  T-table software backend otherwise (or to the constant-time
+ *  bitsliced backend when AES_CONSTANT_TIME_FALLBACK is set). An
+ *  explicit request for AES-NI on a CPU without it falls back the
+ *  same way, any other explicit request is honoured as is
+ * Inputs:  requested   - Requested backend
+ * Returns: The backend to be used
+ ********************************************************************/
+AesBackend SelectAesBackend(AesBackend requested)
+{
+    if ((requested == AesBackend::Automatic) || (requested == AesBackend::AesNi))
+    {
+        if (GetCpuFeatures().aesNi)
+        {
+            return AesBackend::AesNi;
+        }
+        return (AES_CONSTANT_TIME_FALLBACK != 0U) ? AesBackend::Bitsliced : AesBackend::TTable;
+    }
+    return requested;
+}
+
+/********************************************************************
+ * Function: AesEncryptBlock
+ * Description:
+ *  Function to encrypt a single 16-byte block with the backend
+ *  selected by the key
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be encrypted (16 bytes)
+ * Outputs: output  - Encrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+void AesEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    AesEncryptBlocks(key, input, output, 1);
+}
+
+/********************************************************************
+ * Function: AesDecryptBlock
+ * Description:
+ *  Function to decrypt a single 16-byte block with the backend
+ *  selected by the key
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be decrypted (16 bytes)
+ * Outputs: output  - Decrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+void AesDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    AesDecryptBlocks(key, input, output, 1);
+}
+
+/********************************************************************
+ * Function: AesEncryptBlocks
+ * Description:
+ *  Function to encrypt consecutive 16-byte blocks with the backend
+ *  selected by the key. The key size and the backend are resolved
+ *  once for the whole run of blocks, which the T-table and AES-NI
+ *  backends then process several blocks at a time
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be encrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Encrypted blocks
+ * Returns: void
+ ********************************************************************/
+void AesEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    DispatchKeySize(key.KeySize(), [&](auto size)
+    {
+        constexpr int Nr = AesParameters<decltype(size)::value>::Nr;
+        switch (key.Backend())
+        {
+            case AesBackend::Reference:
+                for (size_t i = 0; i < blocksNumber; ++i)
+                {
+                    ReferenceEncryptBlock<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+                }
+                break;
+#if AES_X86
+            case AesBackend::AesNi:
+                AesNiEncryptBlocks<Nr>(key, input, output, blocksNumber);
+                break;
+#endif
+            case AesBackend::Bitsliced:
+                BitslicedEncryptBlocks<Nr>(key, input, output, blocksNumber);
+                break;
+            default:
+                TTableEncryptBlocks<Nr>(key, input, output, blocksNumber);
+                break;
+        }
+    });
+}
+
+/********************************************************************
+ * Function: AesDecryptBlocks
+ * Description:
+ *  Function to decrypt consecutive 16-byte blocks with the backend
+ *  selected by the key. The key size and the backend are resolved
+ *  once for the whole run of blocks, which the T-table and AES-NI
+ *  backends then process several blocks at a time
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be decrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Decrypted blocks
+ * Returns: void
+ ********************************************************************/
+void AesDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    DispatchKeySize(key.KeySize(), [&](auto size)
+    {
+        constexpr int Nr = AesParameters<decltype(size)::value>::Nr;
+        switch (key.Backend())
+        {
+            case AesBackend::Reference:
+                for (size_t i = 0; i < blocksNumber; ++i)
+                {
+                    ReferenceDecryptBlock<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+                }
+                break;
+#if AES_X86
+            case AesBackend::AesNi:
+                AesNiDecryptBlocks<Nr>(key, input, output, blocksNumber);
+                break;
+#endif
+            case AesBackend::Bitsliced:
+                BitslicedDecryptBlocks<Nr>(key, input, output, blocksNumber);
+                break;
+            default:
+                TTableDecryptBlocks<Nr>(key, input, output, blocksNumber);
+                break;
+        }
+    });
+}
+
+/********************************************************************
+ * Function: ReferenceEncryptBlock
+ * Description:
+ *  Function to encrypt a single 16-byte block with AES using the
+ *  precomputed encryption key schedule and the byte-wise round
+ *  functions. The block is loaded into the state column by column
+ *  as defined by FIPS-197
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be encrypted (16 bytes)
+ * Outputs: output  - Encrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_FLATTEN void ReferenceEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    uint8_t stateArray[4][4];
+
+    /* Load the input block into the state */
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            stateArray[row][col] = input[4 * col + row];
+        }
+    }
+
+    /* Initial round key addition */
+    AddRoundKey(stateArray, key.EncryptionRoundKey(0));
+
+    /* Main rounds */
+    Unroll<1, Nr>([&](auto round)
+    {
+        SubBytes(stateArray);
+        ShiftRows(stateArray);
+        MixColumns(stateArray);
+        AddRoundKey(stateArray, key.EncryptionRoundKey(round));
+    });
+
+    /* Final round (no MixColumns) */
+    SubBytes(stateArray);
+    ShiftRows(stateArray);
+    AddRoundKey(stateArray, key.EncryptionRoundKey(Nr));
+
+    /* Store the state into the output block */
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            output[4 * col + row] = stateArray[row][col];
+        }
+    }
+}
+
+/********************************************************************
+ * Function: ReferenceDecryptBlock
+ * Description:
+ *  Function to decrypt a single 16-byte block with AES using the
+ *  precomputed decryption key schedule of the equivalent inverse
+ *  cipher, which has the same round structure as the encryption,
+ *  and the byte-wise round functions
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be decrypted (16 bytes)
+ * Outputs: output  - Decrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_FLATTEN void ReferenceDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    uint8_t stateArray[4][4];
+
+    /* Load the input block into the state */
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            stateArray[row][col] = input[4 * col + row];
+        }
+    }
+
+    /* Initial round key addition */
+    AddRoundKey(stateArray, key.DecryptionRoundKey(0));
+
+    /* Main rounds */
+    Unroll<1, Nr>([&](auto round)
+    {
+        InvSubBytes(stateArray);
+        InvShiftRows(stateArray);
+        InvMixColumns(stateArray);
+        AddRoundKey(stateArray, key.DecryptionRoundKey(round));
+    });
+
+    /* Final round (no InvMixColumns) */
+    InvSubBytes(stateArray);
+    InvShiftRows(stateArray);
+    AddRoundKey(stateArray, key.DecryptionRoundKey(Nr));
+
+    /* Store the state into the output block */
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            output[4 * col + row] = stateArray[row][col];
+        }
+    }
+}
+
+/********************************************************************
+ * Function: TTableEncryptBlock
+ * Description:
+ *  Function to encrypt a single 16-byte block with the T-table
+ *  backend. The state is held as four 32-bit columns and each inner
+ *  round computes every output column with four table lookups, which
+ *  perform SubBytes, ShiftRows and MixColumns at once, followed by
+ *  the XOR with the round key word. The final round has no
+ *  MixColumns so it uses the S-box directly
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be encrypted (16 bytes)
+ * Outputs: output  - Encrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_FLATTEN void TTableEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    const uint32_t* roundKey = key.EncryptionWords();
+
+    /* Load the columns and add the initial round key */
+    uint32_t s0 = LoadWordBigEndian(input) ^ roundKey[0];
+    uint32_t s1 = LoadWordBigEndian(input + 4) ^ roundKey[1];
+    uint32_t s2 = LoadWordBigEndian(input + 8) ^ roundKey[2];
+    uint32_t s3 = LoadWordBigEndian(input + 12) ^ roundKey[3];
+    uint32_t t0, t1, t2, t3;
+
+    /* Main rounds, the round key words are addressed with constant offsets */
+    Unroll<1, Nr>([&](auto round)
+    {
+        const uint32_t* innerKey = roundKey + round * NUM_COLUMN;
+        t0 = Te0[s0 >> 24] ^ Te1[(s1 >> 16) & 0xff] ^ Te2[(s2 >> 8) & 0xff] ^ Te3[s3 & 0xff] ^ innerKey[0];
+        t1 = Te0[s1 >> 24] ^ Te1[(s2 >> 16) & 0xff] ^ Te2[(s3 >> 8) & 0xff] ^ Te3[s0 & 0xff] ^ innerKey[1];
+        t2 = Te0[s2 >> 24] ^ Te1[(s3 >> 16) & 0xff] ^ Te2[(s0 >> 8) & 0xff] ^ Te3[s1 & 0xff] ^ innerKey[2];
+        t3 = Te0[s3 >> 24] ^ Te1[(s0 >> 16) & 0xff] ^ Te2[(s1 >> 8) & 0xff] ^ Te3[s2 & 0xff] ^ innerKey[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    });
+
+    /* Final round (no MixColumns) */
+    roundKey += Nr * NUM_COLUMN;
+    t0 = ((static_cast<uint32_t>(sBox[s0 >> 24]) << 24) | (static_cast<uint32_t>(sBox[(s1 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(sBox[(s2 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(sBox[s3 & 0xff])) ^ roundKey[0];
+    t1 = ((static_cast<uint32_t>(sBox[s1 >> 24]) << 24) | (static_cast<uint32_t>(sBox[(s2 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(sBox[(s3 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(sBox[s0 & 0xff])) ^ roundKey[1];
+    t2 = ((static_cast<uint32_t>(sBox[s2 >> 24]) << 24) | (static_cast<uint32_t>(sBox[(s3 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(sBox[(s0 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(sBox[s1 & 0xff])) ^ roundKey[2];
+    t3 = ((static_cast<uint32_t>(sBox[s3 >> 24]) << 24) | (static_cast<uint32_t>(sBox[(s0 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(sBox[(s1 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(sBox[s2 & 0xff])) ^ roundKey[3];
+
+    /* Store the columns into the output block */
+    StoreWordBigEndian(t0, output);
+    StoreWordBigEndian(t1, output + 4);
+    StoreWordBigEndian(t2, output + 8);
+    StoreWordBigEndian(t3, output + 12);
+}
+
+/********************************************************************
+ * Function: TTableDecryptBlock
+ * Description:
+ *  Function to decrypt a single 16-byte block with the T-table
+ *  backend using the equivalent inverse cipher. Each inner round
+ *  computes every output column with four Td lookups, which perform
+ *  InvSubBytes, InvShiftRows and InvMixColumns at once, followed by
+ *  the XOR with the decryption round key word. The final round uses
+ *  the inverse S-box directly
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be decrypted (16 bytes)
+ * Outputs: output  - Decrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_FLATTEN void TTableDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    const uint32_t* roundKey = key.DecryptionWords();
+
+    /* Load the columns and add the initial round key */
+    uint32_t s0 = LoadWordBigEndian(input) ^ roundKey[0];
+    uint32_t s1 = LoadWordBigEndian(input + 4) ^ roundKey[1];
+    uint32_t s2 = LoadWordBigEndian(input + 8) ^ roundKey[2];
+    uint32_t s3 = LoadWordBigEndian(input + 12) ^ roundKey[3];
+    uint32_t t0, t1, t2, t3;
+
+    /* Main rounds, the round key words are addressed with constant offsets */
+    Unroll<1, Nr>([&](auto round)
+    {
+        const uint32_t* innerKey = roundKey + round * NUM_COLUMN;
+        t0 = Td0[s0 >> 24] ^ Td1[(s3 >> 16) & 0xff] ^ Td2[(s2 >> 8) & 0xff] ^ Td3[s1 & 0xff] ^ innerKey[0];
+        t1 = Td0[s1 >> 24] ^ Td1[(s0 >> 16) & 0xff] ^ Td2[(s3 >> 8) & 0xff] ^ Td3[s2 & 0xff] ^ innerKey[1];
+        t2 = Td0[s2 >> 24] ^ Td1[(s1 >> 16) & 0xff] ^ Td2[(s0 >> 8) & 0xff] ^ Td3[s3 & 0xff] ^ innerKey[2];
+        t3 = Td0[s3 >> 24] ^ Td1[(s2 >> 16) & 0xff] ^ Td2[(s1 >> 8) & 0xff] ^ Td3[s0 & 0xff] ^ innerKey[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    });
+
+    /* Final round (no InvMixColumns) */
+    roundKey += Nr * NUM_COLUMN;
+    t0 = ((static_cast<uint32_t>(inv_sbox[s0 >> 24]) << 24) | (static_cast<uint32_t>(inv_sbox[(s3 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(inv_sbox[(s2 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(inv_sbox[s1 & 0xff])) ^ roundKey[0];
+    t1 = ((static_cast<uint32_t>(inv_sbox[s1 >> 24]) << 24) | (static_cast<uint32_t>(inv_sbox[(s0 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(inv_sbox[(s3 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(inv_sbox[s2 & 0xff])) ^ roundKey[1];
+    t2 = ((static_cast<uint32_t>(inv_sbox[s2 >> 24]) << 24) | (static_cast<uint32_t>(inv_sbox[(s1 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(inv_sbox[(s0 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(inv_sbox[s3 & 0xff])) ^ roundKey[2];
+    t3 = ((static_cast<uint32_t>(inv_sbox[s3 >> 24]) << 24) | (static_cast<uint32_t>(inv_sbox[(s2 >> 16) & 0xff]) << 16) |
+          (static_cast<uint32_t>(inv_sbox[(s1 >> 8) & 0xff]) << 8) | static_cast<uint32_t>(inv_sbox[s0 & 0xff])) ^ roundKey[3];
+
+    /* Store the columns into the output block */
+    StoreWordBigEndian(t0, output);
+    StoreWordBigEndian(t1, output + 4);
+    StoreWordBigEndian(t2, output + 8);
+    StoreWordBigEndian(t3, output + 12);
+}
+
+/********************************************************************
+ * Function: TTableEncryptInterleaved
+ * Description:
+ *  Function to encrypt TTABLE_INTERLEAVE independent blocks in
+ *  lock-step with the T-table backend. Every round is applied to all
+ *  the blocks before moving to the next one, so the table lookups of
+ *  different blocks do not depend on each other and the CPU overlaps
+ *  their load latency instead of waiting on one block at a time
+ * Inputs:  key     - Expanded key
+ *          input   - Blocks to be encrypted (TTABLE_INTERLEAVE * 16 bytes)
+ * Outputs: output  - Encrypted blocks (TTABLE_INTERLEAVE * 16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_FLATTEN static void TTableEncryptInterleaved(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    const uint32_t* roundKey = key.EncryptionWords();
+    uint32_t s[TTABLE_INTERLEAVE][NUM_COLUMN];
+
+    /* Load the columns of every block and add the initial round key */
+    Unroll<0, TTABLE_INTERLEAVE>([&](auto lane)
+    {
+        for (int col = 0; col < NUM_COLUMN; ++col)
+        {
+            s[lane][col] = LoadWordBigEndian(input + lane * BLOCK_SIZE + 4 * col) ^ roundKey[col];
+        }
+    });
+
+    /* Main rounds, each one applied to all the blocks */
+    Unroll<1, Nr>([&](auto round)
+    {
+        const uint32_t* innerKey = roundKey + round * NUM_COLUMN;
+        Unroll<0, TTABLE_INTERLEAVE>([&](auto lane)
+        {
+            uint32_t t0 = Te0[s[lane][0] >> 24] ^ Te1[(s[lane][1] >> 16) & 0xff] ^ Te2[(s[lane][2] >> 8) & 0xff] ^ Te3[s[lane][3] & 0xff] ^ innerKey[0];
+            uint32_t t1 = Te0[s[lane][1] >> 24] ^ Te1[(s[lane][2] >> 16) & 0xff] ^ Te2[(s[lane][3] >> 8) & 0xff] ^ Te3[s[lane][0] & 0xff] ^ innerKey[1];
+            uint32_t t2 = Te0[s[lane][2] >> 24] ^ Te1[(s[lane][3] >> 16) & 0xff] ^ Te2[(s[lane][0] >> 8) & 0xff] ^ Te3[s[lane][1] & 0xff] ^ innerKey[2];
+            uint32_t t3 = Te0[s[lane][3] >> 24] ^ Te1[(s[lane][0] >> 16) & 0xff] ^ Te2[(s[lane][1] >> 8) & 0xff] ^ Te3[s[lane][2] & 0xff] ^ innerKey[3];
+            s[lane][0] = t0;
+            s[lane][1] = t1;
+            s[lane][2] = t2;
+            s[lane][3] = t3;
+        });
+    });
+
+    /* Final round (no MixColumns) */
+    roundKey += Nr * NUM_COLUMN;
+    Unroll<0, TTABLE_INTERLEAVE>([&](auto lane)
+    {
+        for (int col = 0; col < NUM_COLUMN; ++col)
+        {
+            uint32_t word = (static_cast<uint32_t>(sBox[s[lane][col] >> 24]) << 24) |
+                            (static_cast<uint32_t>(sBox[(s[lane][(col + 1) % NUM_COLUMN] >> 16) & 0xff]) << 16) |
+                            (static_cast<uint32_t>(sBox[(s[lane][(col + 2) % NUM_COLUMN] >> 8) & 0xff]) << 8) |
+                            static_cast<uint32_t>(sBox[s[lane][(col + 3) % NUM_COLUMN] & 0xff]);
+            StoreWordBigEndian(word ^ roundKey[col], output + lane * BLOCK_SIZE + 4 * col);
+        }
+    });
+}
+
+/********************************************************************
+ * Function: TTableDecryptInterleaved
+ * Description:
+ *  Function to decrypt TTABLE_INTERLEAVE independent blocks in
+ *  lock-step with the T-table backend and the equivalent inverse
+ *  cipher, round by round like TTableEncryptInterleaved
+ * Inputs:  key     - Expanded key
+ *          input   - Blocks to be decrypted (TTABLE_INTERLEAVE * 16 bytes)
+ * Outputs: output  - Decrypted blocks (TTABLE_INTERLEAVE * 16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_FLATTEN static void TTableDecryptInterleaved(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    const uint32_t* roundKey = key.DecryptionWords();
+    uint32_t s[TTABLE_INTERLEAVE][NUM_COLUMN];
+
+    /* Load the columns of every block and add the initial round key */
+    Unroll<0, TTABLE_INTERLEAVE>([&](auto lane)
+    {
+        for (int col = 0; col < NUM_COLUMN; ++col)
+        {
+            s[lane][col] = LoadWordBigEndian(input + lane * BLOCK_SIZE + 4 * col) ^ roundKey[col];
+        }
+    });
+
+    /* Main rounds, each one applied to all the blocks */
+    Unroll<1, Nr>([&](auto round)
+    {
+        const uint32_t* innerKey = roundKey + round * NUM_COLUMN;
+        Unroll<0, TTABLE_INTERLEAVE>([&](auto lane)
+        {
+            uint32_t t0 = Td0[s[lane][0] >> 24] ^ Td1[(s[lane][3] >> 16) & 0xff] ^ Td2[(s[lane][2] >> 8) & 0xff] ^ Td3[s[lane][1] & 0xff] ^ innerKey[0];
+            uint32_t t1 = Td0[s[lane][1] >> 24] ^ Td1[(s[lane][0] >> 16) & 0xff] ^ Td2[(s[lane][3] >> 8) & 0xff] ^ Td3[s[lane][2] & 0xff] ^ innerKey[1];
+            uint32_t t2 = Td0[s[lane][2] >> 24] ^ Td1[(s[lane][1] >> 16) & 0xff] ^ Td2[(s[lane][0] >> 8) & 0xff] ^ Td3[s[lane][3] & 0xff] ^ innerKey[2];
+            uint32_t t3 = Td0[s[lane][3] >> 24] ^ Td1[(s[lane][2] >> 16) & 0xff] ^ Td2[(s[lane][1] >> 8) & 0xff] ^ Td3[s[lane][0] & 0xff] ^ innerKey[3];
+            s[lane][0] = t0;
+            s[lane][1] = t1;
+            s[lane][2] = t2;
+            s[lane][3] = t3;
+        });
+    });
+
+    /* Final round (no InvMixColumns) */
+    roundKey += Nr * NUM_COLUMN;
+    Unroll<0, TTABLE_INTERLEAVE>([&](auto lane)
+    {
+        for (int col = 0; col < NUM_COLUMN; ++col)
+        {
+            uint32_t word = (static_cast<uint32_t>(inv_sbox[s[lane][col] >> 24]) << 24) |
+                            (static_cast<uint32_t>(inv_sbox[(s[lane][(col + 3) % NUM_COLUMN] >> 16) & 0xff]) << 16) |
+                            (static_cast<uint32_t>(inv_sbox[(s[lane][(col + 2) % NUM_COLUMN] >> 8) & 0xff]) << 8) |
+                            static_cast<uint32_t>(inv_sbox[s[lane][(col + 1) % NUM_COLUMN] & 0xff]);
+            StoreWordBigEndian(word ^ roundKey[col], output + lane * BLOCK_SIZE + 4 * col);
+        }
+    });
+}
+
+/********************************************************************
+ * Function: TTableEncryptBlocks
+ * Description:
+ *  Function to encrypt consecutive blocks with the T-table backend.
+ *  Full groups of TTABLE_INTERLEAVE blocks are interleaved, the
+ *  remaining blocks are encrypted one at a time
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be encrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Encrypted blocks
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void TTableEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    size_t fullBlocks = blocksNumber - (blocksNumber % TTABLE_INTERLEAVE);
+    for (size_t i = 0; i < fullBlocks; i += TTABLE_INTERLEAVE)
+    {
+        TTableEncryptInterleaved<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+    for (size_t i = fullBlocks; i < blocksNumber; ++i)
+    {
+        TTableEncryptBlock<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+}
+
+/********************************************************************
+ * Function: TTableDecryptBlocks
+ * Description:
+ *  Function to decrypt consecutive blocks with the T-table backend.
+ *  Full groups of TTABLE_INTERLEAVE blocks are interleaved, the
+ *  remaining blocks are decrypted one at a time
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be decrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Decrypted blocks
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void TTableDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    size_t fullBlocks = blocksNumber - (blocksNumber % TTABLE_INTERLEAVE);
+    for (size_t i = 0; i < fullBlocks; i += TTABLE_INTERLEAVE)
+    {
+        TTableDecryptInterleaved<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+    for (size_t i = fullBlocks; i < blocksNumber; ++i)
+    {
+        TTableDecryptBlock<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+}
+
+#if AES_X86
+/********************************************************************
+ *************************** AES-NI Functions ***********************
+ ********************************************************************/
+/********************************************************************
+ * Function: AesNiAssist128
+ * Description:
+ *  Helper of the AES-128 (and AES-256) key expansion. It computes
+ *  the next four key words from the previous four words and the
+ *  output of AESKEYGENASSIST, whose word selected by the caller holds
+ *  SubWord(RotWord(w)) ^ Rcon (or SubWord(w) for AES-256)
+ * Inputs:  previousKey - Previous four words of the key schedule
+ *          assist      - AESKEYGENASSIST result broadcast to all words
+ * Returns: The next four words of the key schedule
+ ********************************************************************/
+AES_TARGET("aes,sse2")
+static inline __m128i AesNiAssist128(__m128i previousKey, __m128i assist)
+{
+    previousKey = _mm_xor_si128(previousKey, _mm_slli_si128(previousKey, 4));
+    previousKey = _mm_xor_si128(previousKey, _mm_slli_si128(previousKey, 4));
+    previousKey = _mm_xor_si128(previousKey, _mm_slli_si128(previousKey, 4));
+    return _mm_xor_si128(previousKey, assist);
+}
+
+/********************************************************************
+ * Function: AesNiAssist192
+ * Description:
+ *  Helper of the AES-192 key expansion. It computes the next six
+ *  key words held in low (4 words) and high (2 words) from the
+ *  AESKEYGENASSIST output of the previous high words
+ * Inputs:  low     - Words 0..3 of the previous six words
+ *          high    - Words 4..5 of the previous six words
+ *          assist  - AESKEYGENASSIST result of high
+ * Outputs: low, high   - The next six words of the key schedule
+ * Returns: void
+ ********************************************************************/
+AES_TARGET("aes,sse2")
+static inline void AesNiAssist192(__m128i& low, __m128i& high, __m128i assist)
+{
+    low = AesNiAssist128(low, _mm_shuffle_epi32(assist, 0x55));
+    __m128i lastWord = _mm_shuffle_epi32(low, 0xff);
+    high = _mm_xor_si128(high, _mm_slli_si128(high, 4));
+    high = _mm_xor_si128(high, lastWord);
+}
+
+/********************************************************************
+ * Function: AesNiKeyExpansion
+ * Description:
+ *  Function to expand a 128, 192 or 256-bit key with the AES-NI
+ *  AESKEYGENASSIST instruction. The decryption round keys of the
+ *  equivalent inverse cipher are derived from the encryption round
+ *  keys with AESIMC (InvMixColumns) in reverse order
+ * Inputs:  key     - Cipher key (KeySize bytes)
+ * Outputs: encryptionRoundKeys - Encryption round keys
+ *          decryptionRoundKeys - Decryption round keys
+ * Returns: void
+ ********************************************************************/
+template <size_t KeySize>
+AES_TARGET("aes,sse2")
+void AesNiKeyExpansion(const uint8_t* key, RoundKeys& encryptionRoundKeys, RoundKeys& decryptionRoundKeys)
+{
+    constexpr int Nr = AesParameters<KeySize>::Nr;
+    __m128i roundKeys[Nr + 1];
+
+    if constexpr (KeySize == 16)
+    {
+        /* Each round key follows from the previous one and RotWord/SubWord of its last word */
+        roundKeys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+        roundKeys[1] = AesNiAssist128(roundKeys[0], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[0], 0x01), 0xff));
+        roundKeys[2] = AesNiAssist128(roundKeys[1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[1], 0x02), 0xff));
+        roundKeys[3] = AesNiAssist128(roundKeys[2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[2], 0x04), 0xff));
+        roundKeys[4] = AesNiAssist128(roundKeys[3], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[3], 0x08), 0xff));
+        roundKeys[5] = AesNiAssist128(roundKeys[4], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[4], 0x10), 0xff));
+        roundKeys[6] = AesNiAssist128(roundKeys[5], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[5], 0x20), 0xff));
+        roundKeys[7] = AesNiAssist128(roundKeys[6], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[6], 0x40), 0xff));
+        roundKeys[8] = AesNiAssist128(roundKeys[7], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[7], 0x80), 0xff));
+        roundKeys[9] = AesNiAssist128(roundKeys[8], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[8], 0x1b), 0xff));
+        roundKeys[10] = AesNiAssist128(roundKeys[9], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[9], 0x36), 0xff));
+    }
+    else if constexpr (KeySize == 24)
+    {
+        /* The schedule advances six words at a time, so round keys straddle two expansion steps */
+        alignas(16) uint8_t tail[16] = {0};
+        std::memcpy(tail, key + 16, 8);
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+        __m128i high = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+        roundKeys[0] = low;
+        roundKeys[1] = high;
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x01));
+        roundKeys[1] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(roundKeys[1]), _mm_castsi128_pd(low), 0));
+        roundKeys[2] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(low), _mm_castsi128_pd(high), 1));
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x02));
+        roundKeys[3] = low;
+        roundKeys[4] = high;
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x04));
+        roundKeys[4] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(roundKeys[4]), _mm_castsi128_pd(low), 0));
+        roundKeys[5] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(low), _mm_castsi128_pd(high), 1));
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x08));
+        roundKeys[6] = low;
+        roundKeys[7] = high;
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x10));
+        roundKeys[7] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(roundKeys[7]), _mm_castsi128_pd(low), 0));
+        roundKeys[8] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(low), _mm_castsi128_pd(high), 1));
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x20));
+        roundKeys[9] = low;
+        roundKeys[10] = high;
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x40));
+        roundKeys[10] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(roundKeys[10]), _mm_castsi128_pd(low), 0));
+        roundKeys[11] = _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(low), _mm_castsi128_pd(high), 1));
+        AesNiAssist192(low, high, _mm_aeskeygenassist_si128(high, 0x80));
+        roundKeys[12] = low;
+    }
+    else
+    {
+        /* Even round keys use RotWord/SubWord with Rcon, odd ones use SubWord only */
+        roundKeys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+        roundKeys[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+        roundKeys[2] = AesNiAssist128(roundKeys[0], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[1], 0x01), 0xff));
+        roundKeys[3] = AesNiAssist128(roundKeys[1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[2], 0x00), 0xaa));
+        roundKeys[4] = AesNiAssist128(roundKeys[2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[3], 0x02), 0xff));
+        roundKeys[5] = AesNiAssist128(roundKeys[3], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[4], 0x00), 0xaa));
+        roundKeys[6] = AesNiAssist128(roundKeys[4], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[5], 0x04), 0xff));
+        roundKeys[7] = AesNiAssist128(roundKeys[5], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[6], 0x00), 0xaa));
+        roundKeys[8] = AesNiAssist128(roundKeys[6], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[7], 0x08), 0xff));
+        roundKeys[9] = AesNiAssist128(roundKeys[7], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[8], 0x00), 0xaa));
+        roundKeys[10] = AesNiAssist128(roundKeys[8], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[9], 0x10), 0xff));
+        roundKeys[11] = AesNiAssist128(roundKeys[9], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[10], 0x00), 0xaa));
+        roundKeys[12] = AesNiAssist128(roundKeys[10], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[11], 0x20), 0xff));
+        roundKeys[13] = AesNiAssist128(roundKeys[11], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[12], 0x00), 0xaa));
+        roundKeys[14] = AesNiAssist128(roundKeys[12], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(roundKeys[13], 0x40), 0xff));
+    }
+
+    /* Store the encryption schedule and derive the decryption schedule of the equivalent inverse cipher */
+    for (int round = 0; round <= Nr; ++round)
+    {
+        _mm_store_si128(reinterpret_cast<__m128i*>(encryptionRoundKeys[round].data()), roundKeys[round]);
+
+        __m128i decryptionRoundKey = roundKeys[Nr - round];
+        if ((round != 0) && (round != Nr))
+        {
+            decryptionRoundKey = _mm_aesimc_si128(decryptionRoundKey);
+        }
+        _mm_store_si128(reinterpret_cast<__m128i*>(decryptionRoundKeys[round].data()), decryptionRoundKey);
+    }
+}
+
+/********************************************************************
+ * Function: AesNiEncryptBlock
+ * Description:
+ *  Function to encrypt a single 16-byte block with the AES-NI
+ *  instructions. AESENC performs a whole inner round and
+ *  AESENCLAST the final round without MixColumns
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be encrypted (16 bytes)
+ * Outputs: output  - Encrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_TARGET("aes,sse2") AES_FLATTEN
+void AesNiEncryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+
+    state = _mm_xor_si128(state, _mm_load_si128(reinterpret_cast<const __m128i*>(key.EncryptionRoundKey(0))));
+    Unroll<1, Nr>([&](auto round) AES_TARGET("aes,sse2")
+    {
+        state = _mm_aesenc_si128(state, _mm_load_si128(reinterpret_cast<const __m128i*>(key.EncryptionRoundKey(round))));
+    });
+    state = _mm_aesenclast_si128(state, _mm_load_si128(reinterpret_cast<const __m128i*>(key.EncryptionRoundKey(Nr))));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output), state);
+}
+
+/********************************************************************
+ * Function: AesNiDecryptBlock
+ * Description:
+ *  Function to decrypt a single 16-byte block with the AES-NI
+ *  instructions using the equivalent inverse cipher schedule.
+ *  AESDEC performs a whole inner round and AESDECLAST the final
+ *  round without InvMixColumns
+ * Inputs:  key     - Expanded key
+ *          input   - Block to be decrypted (16 bytes)
+ * Outputs: output  - Decrypted block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_TARGET("aes,sse2") AES_FLATTEN
+void AesNiDecryptBlock(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+
+    state = _mm_xor_si128(state, _mm_load_si128(reinterpret_cast<const __m128i*>(key.DecryptionRoundKey(0))));
+    Unroll<1, Nr>([&](auto round) AES_TARGET("aes,sse2")
+    {
+        state = _mm_aesdec_si128(state, _mm_load_si128(reinterpret_cast<const __m128i*>(key.DecryptionRoundKey(round))));
+    });
+    state = _mm_aesdeclast_si128(state, _mm_load_si128(reinterpret_cast<const __m128i*>(key.DecryptionRoundKey(Nr))));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output), state);
+}
+/********************************************************************
+ * Function: AesNiEncryptInterleaved
+ * Description:
+ *  Function to encrypt AESNI_INTERLEAVE independent blocks with the
+ *  AES-NI instructions. Each round key is loaded once and applied to
+ *  all the blocks, so consecutive AESENC instructions never depend
+ *  on each other and the AES unit pipeline stays full
+ * Inputs:  key     - Expanded key
+ *          input   - Blocks to be encrypted (AESNI_INTERLEAVE * 16 bytes)
+ * Outputs: output  - Encrypted blocks (AESNI_INTERLEAVE * 16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_TARGET("aes,sse2") AES_FLATTEN
+static void AesNiEncryptInterleaved(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    __m128i state[AESNI_INTERLEAVE];
+
+    __m128i roundKey = _mm_load_si128(reinterpret_cast<const __m128i*>(key.EncryptionRoundKey(0)));
+    for (size_t lane = 0; lane < AESNI_INTERLEAVE; ++lane)
+    {
+        state[lane] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + lane * BLOCK_SIZE)), roundKey);
+    }
+    Unroll<1, Nr>([&](auto round) AES_TARGET("aes,sse2")
+    {
+        __m128i innerKey = _mm_load_si128(reinterpret_cast<const __m128i*>(key.EncryptionRoundKey(round)));
+        for (size_t lane = 0; lane < AESNI_INTERLEAVE; ++lane)
+        {
+            state[lane] = _mm_aesenc_si128(state[lane], innerKey);
+        }
+    });
+    roundKey = _mm_load_si128(reinterpret_cast<const __m128i*>(key.EncryptionRoundKey(Nr)));
+    for (size_t lane = 0; lane < AESNI_INTERLEAVE; ++lane)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + lane * BLOCK_SIZE), _mm_aesenclast_si128(state[lane], roundKey));
+    }
+}
+
+/********************************************************************
+ * Function: AesNiDecryptInterleaved
+ * Description:
+ *  Function to decrypt AESNI_INTERLEAVE independent blocks with the
+ *  AES-NI instructions and the equivalent inverse cipher schedule,
+ *  round by round like AesNiEncryptInterleaved
+ * Inputs:  key     - Expanded key
+ *          input   - Blocks to be decrypted (AESNI_INTERLEAVE * 16 bytes)
+ * Outputs: output  - Decrypted blocks (AESNI_INTERLEAVE * 16 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+AES_TARGET("aes,sse2") AES_FLATTEN
+static void AesNiDecryptInterleaved(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    __m128i state[AESNI_INTERLEAVE];
+
+    __m128i roundKey = _mm_load_si128(reinterpret_cast<const __m128i*>(key.DecryptionRoundKey(0)));
+    for (size_t lane = 0; lane < AESNI_INTERLEAVE; ++lane)
+    {
+        state[lane] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + lane * BLOCK_SIZE)), roundKey);
+    }
+    Unroll<1, Nr>([&](auto round) AES_TARGET("aes,sse2")
+    {
+        __m128i innerKey = _mm_load_si128(reinterpret_cast<const __m128i*>(key.DecryptionRoundKey(round)));
+        for (size_t lane = 0; lane < AESNI_INTERLEAVE; ++lane)
+        {
+            state[lane] = _mm_aesdec_si128(state[lane], innerKey);
+        }
+    });
+    roundKey = _mm_load_si128(reinterpret_cast<const __m128i*>(key.DecryptionRoundKey(Nr)));
+    for (size_t lane = 0; lane < AESNI_INTERLEAVE; ++lane)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + lane * BLOCK_SIZE), _mm_aesdeclast_si128(state[lane], roundKey));
+    }
+}
+
+/********************************************************************
+ * Function: AesNiEncryptBlocks
+ * Description:
+ *  Function to encrypt consecutive blocks with the AES-NI backend.
+ *  Full groups of AESNI_INTERLEAVE blocks are interleaved, the
+ *  remaining blocks are encrypted one at a time
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be encrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Encrypted blocks
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void AesNiEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    size_t fullBlocks = blocksNumber - (blocksNumber % AESNI_INTERLEAVE);
+    for (size_t i = 0; i < fullBlocks; i += AESNI_INTERLEAVE)
+    {
+        AesNiEncryptInterleaved<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+    for (size_t i = fullBlocks; i < blocksNumber; ++i)
+    {
+        AesNiEncryptBlock<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+}
+
+/********************************************************************
+ * Function: AesNiDecryptBlocks
+ * Description:
+ *  Function to decrypt consecutive blocks with the AES-NI backend.
+ *  Full groups of AESNI_INTERLEAVE blocks are interleaved, the
+ *  remaining blocks are decrypted one at a time
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be decrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Decrypted blocks
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void AesNiDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    size_t fullBlocks = blocksNumber - (blocksNumber % AESNI_INTERLEAVE);
+    for (size_t i = 0; i < fullBlocks; i += AESNI_INTERLEAVE)
+    {
+        AesNiDecryptInterleaved<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+    for (size_t i = fullBlocks; i < blocksNumber; ++i)
+    {
+        AesNiDecryptBlock<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+}
+#endif
+
+/********************************************************************
+ ************************ Bitsliced Functions ***********************
+ ********************************************************************/
+/********************************************************************
+ * Function: BitslicedSbox
+ * Description:
+ *  Function to apply the S-box to 32 bytes in bitsliced form, where
+ *  q[b] holds bit b of every byte. The S-box is computed with the
+ *  Boyar-Peralta circuit (GF(2^4) tower field inversion) so it only
+ *  uses AND, XOR and NOT and never indexes memory with secret data
+ * Inputs:  q   - Bitsliced bytes
+ * Outputs: q   - Substituted bitsliced bytes
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedSbox(uint64_t q[8])
+{
+    uint64_t x0, x1, x2, x3, x4, x5, x6, x7;
+    uint64_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    uint64_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    uint64_t y20, y21;
+    uint64_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    uint64_t z10, z11, z12, z13, z14, z15, z16, z17;
+    uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    uint64_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    uint64_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    uint64_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    uint64_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    uint64_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    uint64_t t60, t61, t62, t63, t64, t65, t66, t67;
+    uint64_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    /* The circuit numbers the bits from the most significant one */
+    x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+    x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+    /* Top linear transformation */
+    y14 = x3 ^ x5; y13 = x0 ^ x6; y9 = x0 ^ x3; y8 = x0 ^ x5;
+    t0 = x1 ^ x2; y1 = t0 ^ x7; y4 = y1 ^ x3; y12 = y13 ^ y14;
+    y2 = y1 ^ x0; y5 = y1 ^ x6; y3 = y5 ^ y8; t1 = x4 ^ y12;
+    y15 = t1 ^ x5; y20 = t1 ^ x1; y6 = y15 ^ x7; y10 = y15 ^ t0;
+    y11 = y20 ^ y9; y7 = x7 ^ y11; y17 = y10 ^ y11; y19 = y10 ^ y8;
+    y16 = t0 ^ y11; y21 = y13 ^ y16; y18 = x0 ^ y16;
+
+    /* Non-linear section (shared inversion in GF(2^4)) */
+    t2 = y12 & y15; t3 = y3 & y6; t4 = t3 ^ t2; t5 = y4 & x7;
+    t6 = t5 ^ t2; t7 = y13 & y16; t8 = y5 & y1; t9 = t8 ^ t7;
+    t10 = y2 & y7; t11 = t10 ^ t7; t12 = y9 & y11; t13 = y14 & y17;
+    t14 = t13 ^ t12; t15 = y8 & y10; t16 = t15 ^ t12; t17 = t4 ^ t14;
+    t18 = t6 ^ t16; t19 = t9 ^ t14; t20 = t11 ^ t16; t21 = t17 ^ y20;
+    t22 = t18 ^ y19; t23 = t19 ^ y21; t24 = t20 ^ y18;
+    t25 = t21 ^ t22; t26 = t21 & t23; t27 = t24 ^ t26; t28 = t25 & t27;
+    t29 = t28 ^ t22; t30 = t23 ^ t24; t31 = t22 ^ t26; t32 = t31 & t30;
+    t33 = t32 ^ t24; t34 = t23 ^ t33; t35 = t27 ^ t33; t36 = t24 & t35;
+    t37 = t36 ^ t34; t38 = t27 ^ t36; t39 = t29 & t38; t40 = t25 ^ t39;
+    t41 = t40 ^ t37; t42 = t29 ^ t33; t43 = t29 ^ t40; t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15; z1 = t37 & y6; z2 = t33 & x7; z3 = t43 & y16;
+    z4 = t40 & y1; z5 = t29 & y7; z6 = t42 & y11; z7 = t45 & y17;
+    z8 = t41 & y10; z9 = t44 & y12; z10 = t37 & y3; z11 = t33 & y4;
+    z12 = t43 & y13; z13 = t40 & y5; z14 = t29 & y2; z15 = t42 & y9;
+    z16 = t45 & y14; z17 = t41 & y8;
+
+    /* Bottom linear transformation (including the affine constant) */
+    t46 = z15 ^ z16; t47 = z10 ^ z11; t48 = z5 ^ z13; t49 = z9 ^ z10;
+    t50 = z2 ^ z12; t51 = z2 ^ z5; t52 = z7 ^ z8; t53 = z0 ^ z3;
+    t54 = z6 ^ z7; t55 = z16 ^ z17; t56 = z12 ^ t48; t57 = t50 ^ t53;
+    t58 = z4 ^ t46; t59 = z3 ^ t54; t60 = t46 ^ t57; t61 = z14 ^ t57;
+    t62 = t52 ^ t58; t63 = t49 ^ t58; t64 = z4 ^ t59; t65 = t61 ^ t62;
+    t66 = z1 ^ t63; s0 = t59 ^ t63; s6 = t56 ^ ~t62; s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65; s3 = t53 ^ t66; s4 = t51 ^ t66; s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3; s2 = t55 ^ ~t67;
+
+    q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+    q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+/********************************************************************
+ * Function: BitslicedInvAffine
+ * Description:
+ *  Function to apply the inverse of the S-box affine transformation
+ *  to 32 bytes in bitsliced form. It is its own building block for
+ *  the inverse S-box: InvSbox(x) = A^-1(Sbox(A^-1(x)))
+ * Inputs:  q   - Bitsliced bytes
+ * Outputs: q   - Transformed bitsliced bytes
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedInvAffine(uint64_t q[8])
+{
+    uint64_t q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+/********************************************************************
+ * Function: BitslicedInvSbox
+ * Description:
+ *  Function to apply the inverse S-box to 32 bytes in bitsliced
+ *  form. The forward circuit computes A(x^-1), so undoing the affine
+ *  transformation before and after it yields (A^-1(x))^-1
+ * Inputs:  q   - Bitsliced bytes
+ * Outputs: q   - Substituted bitsliced bytes
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedInvSbox(uint64_t q[8])
+{
+    BitslicedInvAffine(q);
+    BitslicedSbox(q);
+    BitslicedInvAffine(q);
+}
+
+/********************************************************************
+ * Function: BitslicedOrtho
+ * Description:
+ *  Function to convert 8 words between the interleaved byte layout
+ *  and the bitsliced layout. The transformation is an involution,
+ *  so the same function is used in both directions
+ * Inputs:  q   - Words to be transposed
+ * Outputs: q   - Transposed words
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedOrtho(uint64_t q[8])
+{
+    auto swap = [](uint64_t& x, uint64_t& y, uint64_t lowMask, uint64_t highMask, int shift)
+    {
+        uint64_t a = x;
+        uint64_t b = y;
+        x = (a & lowMask) | ((b & lowMask) << shift);
+        y = ((a & highMask) >> shift) | (b & highMask);
+    };
+
+    swap(q[0], q[1], 0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1);
+    swap(q[2], q[3], 0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1);
+    swap(q[4], q[5], 0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1);
+    swap(q[6], q[7], 0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1);
+
+    swap(q[0], q[2], 0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2);
+    swap(q[1], q[3], 0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2);
+    swap(q[4], q[6], 0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2);
+    swap(q[5], q[7], 0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2);
+
+    swap(q[0], q[4], 0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4);
+    swap(q[1], q[5], 0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4);
+    swap(q[2], q[6], 0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4);
+    swap(q[3], q[7], 0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4);
+}
+
+/********************************************************************
+ * Function: BitslicedInterleaveIn
+ * Description:
+ *  Function to spread one 16-byte block, given as four little-endian
+ *  32-bit words, over two 64-bit words so that the even and the odd
+ *  columns end up interleaved byte by byte
+ * Inputs:  block   - Block to be interleaved (16 bytes)
+ * Outputs: q0, q1  - Interleaved words
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedInterleaveIn(const uint8_t* block, uint64_t& q0, uint64_t& q1)
+{
+    uint64_t x[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        x[i] = static_cast<uint64_t>(block[4 * i]) |
+               (static_cast<uint64_t>(block[4 * i + 1]) << 8) |
+               (static_cast<uint64_t>(block[4 * i + 2]) << 16) |
+               (static_cast<uint64_t>(block[4 * i + 3]) << 24);
+        x[i] |= (x[i] << 16);
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        x[i] |= (x[i] << 8);
+        x[i] &= 0x00FF00FF00FF00FFULL;
+    }
+    q0 = x[0] | (x[2] << 8);
+    q1 = x[1] | (x[3] << 8);
+}
+
+/********************************************************************
+ * Function: BitslicedInterleaveOut
+ * Description:
+ *  Function to gather one 16-byte block back from two interleaved
+ *  64-bit words. It is the inverse of BitslicedInterleaveIn
+ * Inputs:  q0, q1  - Interleaved words
+ * Outputs: block   - Block (16 bytes)
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedInterleaveOut(uint64_t q0, uint64_t q1, uint8_t* block)
+{
+    uint64_t x[4];
+    x[0] = q0 & 0x00FF00FF00FF00FFULL;
+    x[1] = q1 & 0x00FF00FF00FF00FFULL;
+    x[2] = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    x[3] = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    for (int i = 0; i < 4; ++i)
+    {
+        x[i] |= (x[i] >> 8);
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        uint32_t word = static_cast<uint32_t>(x[i]) | static_cast<uint32_t>(x[i] >> 16);
+        block[4 * i]     = word & 0xff;
+        block[4 * i + 1] = (word >> 8) & 0xff;
+        block[4 * i + 2] = (word >> 16) & 0xff;
+        block[4 * i + 3] = (word >> 24) & 0xff;
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedLoad
+ * Description:
+ *  Function to load four 16-byte blocks into bitsliced form
+ * Inputs:  blocks  - Blocks to be loaded (64 bytes)
+ * Outputs: q       - Bitsliced state of the four blocks
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedLoad(const uint8_t* blocks, uint64_t q[8])
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        BitslicedInterleaveIn(blocks + i * BLOCK_SIZE, q[i], q[i + 4]);
+    }
+    BitslicedOrtho(q);
+}
+
+/********************************************************************
+ * Function: BitslicedStore
+ * Description:
+ *  Function to store a bitsliced state back as four 16-byte blocks
+ * Inputs:  q       - Bitsliced state of the four blocks
+ * Outputs: blocks  - Stored blocks (64 bytes)
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedStore(uint64_t q[8], uint8_t* blocks)
+{
+    BitslicedOrtho(q);
+    for (int i = 0; i < 4; ++i)
+    {
+        BitslicedInterleaveOut(q[i], q[i + 4], blocks + i * BLOCK_SIZE);
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedAddRoundKey
+ * Description:
+ *  Function to XOR a bitsliced round key into a bitsliced state
+ * Inputs:  q           - Bitsliced state
+ *          roundKey    - Bitsliced round key (8 words)
+ * Outputs: q           - Updated state
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedAddRoundKey(uint64_t q[8], const uint64_t* roundKey)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        q[i] ^= roundKey[i];
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedShiftRows
+ * Description:
+ *  Function to perform ShiftRows on a bitsliced state. Each 16-bit
+ *  lane of a word holds one row of the four blocks, so the rotation
+ *  of a row is a fixed permutation of its 4-bit columns
+ * Inputs:  q   - Bitsliced state
+ * Outputs: q   - Updated state
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedShiftRows(uint64_t q[8])
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        uint64_t x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+             | ((x & 0x00000000FFF00000ULL) >> 4)
+             | ((x & 0x00000000000F0000ULL) << 12)
+             | ((x & 0x0000FF0000000000ULL) >> 8)
+             | ((x & 0x000000FF00000000ULL) << 8)
+             | ((x & 0xF000000000000000ULL) >> 12)
+             | ((x & 0x0FFF000000000000ULL) << 4);
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedInvShiftRows
+ * Description:
+ *  Function to perform InvShiftRows on a bitsliced state
+ * Inputs:  q   - Bitsliced state
+ * Outputs: q   - Updated state
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedInvShiftRows(uint64_t q[8])
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        uint64_t x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+             | ((x & 0x000000000FFF0000ULL) << 4)
+             | ((x & 0x00000000F0000000ULL) >> 12)
+             | ((x & 0x000000FF00000000ULL) << 8)
+             | ((x & 0x0000FF0000000000ULL) >> 8)
+             | ((x & 0x000F000000000000ULL) << 12)
+             | ((x & 0xFFF0000000000000ULL) >> 4);
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedRotate32
+ * Description:
+ *  Function to rotate a word by 32 bits, i.e. by two rows
+ * Inputs:  x   - Word to be rotated
+ * Returns: The rotated word
+ ********************************************************************/
+static inline uint64_t BitslicedRotate32(uint64_t x)
+{
+    return (x << 32) | (x >> 32);
+}
+
+/********************************************************************
+ * Function: BitslicedMixColumns
+ * Description:
+ *  Function to perform MixColumns on a bitsliced state. Rotating a
+ *  word by 16 bits moves every byte to the next row of its column,
+ *  and the multiplication by 2 is a shift of the bit planes with the
+ *  reduction polynomial folded in through q[7]
+ * Inputs:  q   - Bitsliced state
+ * Outputs: q   - Updated state
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedMixColumns(uint64_t q[8])
+{
+    uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    uint64_t r0 = (q0 >> 16) | (q0 << 48);
+    uint64_t r1 = (q1 >> 16) | (q1 << 48);
+    uint64_t r2 = (q2 >> 16) | (q2 << 48);
+    uint64_t r3 = (q3 >> 16) | (q3 << 48);
+    uint64_t r4 = (q4 >> 16) | (q4 << 48);
+    uint64_t r5 = (q5 >> 16) | (q5 << 48);
+    uint64_t r6 = (q6 >> 16) | (q6 << 48);
+    uint64_t r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q7 ^ r7 ^ r0 ^ BitslicedRotate32(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ BitslicedRotate32(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ BitslicedRotate32(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ BitslicedRotate32(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ BitslicedRotate32(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ BitslicedRotate32(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ BitslicedRotate32(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ BitslicedRotate32(q7 ^ r7);
+}
+
+/********************************************************************
+ * Function: BitslicedInvMixColumns
+ * Description:
+ *  Function to perform InvMixColumns on a bitsliced state, expanding
+ *  the multiplications by 9, 11, 13 and 14 into bit plane XORs
+ * Inputs:  q   - Bitsliced state
+ * Outputs: q   - Updated state
+ * Returns: void
+ ********************************************************************/
+static inline void BitslicedInvMixColumns(uint64_t q[8])
+{
+    uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    uint64_t r0 = (q0 >> 16) | (q0 << 48);
+    uint64_t r1 = (q1 >> 16) | (q1 << 48);
+    uint64_t r2 = (q2 >> 16) | (q2 << 48);
+    uint64_t r3 = (q3 >> 16) | (q3 << 48);
+    uint64_t r4 = (q4 >> 16) | (q4 << 48);
+    uint64_t r5 = (q5 >> 16) | (q5 << 48);
+    uint64_t r6 = (q6 >> 16) | (q6 << 48);
+    uint64_t r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^ BitslicedRotate32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+    q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^ BitslicedRotate32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+    q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^ BitslicedRotate32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+    q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^ BitslicedRotate32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+    q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^ BitslicedRotate32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+    q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^ BitslicedRotate32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+    q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^ BitslicedRotate32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+    q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^ BitslicedRotate32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+/********************************************************************
+ * Function: BitslicedKeySchedule
+ * Description:
+ *  Function to convert the encryption round keys to bitsliced form.
+ *  Every round key is replicated into the four block positions of a
+ *  bitsliced state so that AddRoundKey is a plain XOR of 8 words.
+ *  Decryption walks the same round keys in reverse order
+ * Inputs:  roundKeys   - Encryption round keys (16 bytes each)
+ * Outputs: bitslicedRoundKeys  - Bitsliced round keys (8 words each)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void BitslicedKeySchedule(const RoundKeys& roundKeys, BitslicedRoundKeys& bitslicedRoundKeys)
+{
+    for (int round = 0; round <= Nr; ++round)
+    {
+        uint64_t q[8];
+        BitslicedInterleaveIn(roundKeys[round].data(), q[0], q[4]);
+        q[1] = q[0]; q[2] = q[0]; q[3] = q[0];
+        q[5] = q[4]; q[6] = q[4]; q[7] = q[4];
+        BitslicedOrtho(q);
+        for (int i = 0; i < 8; ++i)
+        {
+            bitslicedRoundKeys[round][i] = q[i];
+        }
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedEncrypt8
+ * Description:
+ *  Function to encrypt BITSLICED_BLOCKS (8) blocks at once. The
+ *  blocks are held in two bitsliced states of four blocks that go
+ *  through every round step in lock-step, which gives the CPU two
+ *  independent dependency chains to overlap. The round loop keeps a
+ *  constant trip count but is not unrolled, since a bitsliced round
+ *  is already several hundred instructions long
+ * Inputs:  key     - Expanded key (bitsliced backend)
+ *          input   - Blocks to be encrypted (128 bytes)
+ * Outputs: output  - Encrypted blocks (128 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+static void BitslicedEncrypt8(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    uint64_t q[2][8];
+
+    BitslicedLoad(input, q[0]);
+    BitslicedLoad(input + 4 * BLOCK_SIZE, q[1]);
+
+    BitslicedAddRoundKey(q[0], key.BitslicedRoundKey(0));
+    BitslicedAddRoundKey(q[1], key.BitslicedRoundKey(0));
+    for (int round = 1; round < Nr; ++round)
+    {
+        BitslicedSbox(q[0]);
+        BitslicedSbox(q[1]);
+        BitslicedShiftRows(q[0]);
+        BitslicedShiftRows(q[1]);
+        BitslicedMixColumns(q[0]);
+        BitslicedMixColumns(q[1]);
+        BitslicedAddRoundKey(q[0], key.BitslicedRoundKey(round));
+        BitslicedAddRoundKey(q[1], key.BitslicedRoundKey(round));
+    }
+    BitslicedSbox(q[0]);
+    BitslicedSbox(q[1]);
+    BitslicedShiftRows(q[0]);
+    BitslicedShiftRows(q[1]);
+    BitslicedAddRoundKey(q[0], key.BitslicedRoundKey(Nr));
+    BitslicedAddRoundKey(q[1], key.BitslicedRoundKey(Nr));
+
+    BitslicedStore(q[0], output);
+    BitslicedStore(q[1], output + 4 * BLOCK_SIZE);
+}
+
+/********************************************************************
+ * Function: BitslicedDecrypt8
+ * Description:
+ *  Function to decrypt BITSLICED_BLOCKS (8) blocks at once with the
+ *  straightforward inverse cipher (FIPS-197 section 5.3)
+ * Inputs:  key     - Expanded key (bitsliced backend)
+ *          input   - Blocks to be decrypted (128 bytes)
+ * Outputs: output  - Decrypted blocks (128 bytes)
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+static void BitslicedDecrypt8(const AesKey& key, const uint8_t* input, uint8_t* output)
+{
+    uint64_t q[2][8];
+
+    BitslicedLoad(input, q[0]);
+    BitslicedLoad(input + 4 * BLOCK_SIZE, q[1]);
+
+    BitslicedAddRoundKey(q[0], key.BitslicedRoundKey(Nr));
+    BitslicedAddRoundKey(q[1], key.BitslicedRoundKey(Nr));
+    for (int round = Nr - 1; round > 0; --round)
+    {
+        BitslicedInvShiftRows(q[0]);
+        BitslicedInvShiftRows(q[1]);
+        BitslicedInvSbox(q[0]);
+        BitslicedInvSbox(q[1]);
+        BitslicedAddRoundKey(q[0], key.BitslicedRoundKey(round));
+        BitslicedAddRoundKey(q[1], key.BitslicedRoundKey(round));
+        BitslicedInvMixColumns(q[0]);
+        BitslicedInvMixColumns(q[1]);
+    }
+    BitslicedInvShiftRows(q[0]);
+    BitslicedInvShiftRows(q[1]);
+    BitslicedInvSbox(q[0]);
+    BitslicedInvSbox(q[1]);
+    BitslicedAddRoundKey(q[0], key.BitslicedRoundKey(0));
+    BitslicedAddRoundKey(q[1], key.BitslicedRoundKey(0));
+
+    BitslicedStore(q[0], output);
+    BitslicedStore(q[1], output + 4 * BLOCK_SIZE);
+}
+
+/********************************************************************
+ * Function: BitslicedEncryptBlocks
+ * Description:
+ *  Function to encrypt consecutive blocks with the constant-time
+ *  bitsliced kernel. Full groups of BITSLICED_BLOCKS are processed
+ *  in place, a partial tail group goes through a scratch buffer
+ * Inputs:  key             - Expanded key (bitsliced backend)
+ *          input           - Blocks to be encrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Encrypted blocks
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void BitslicedEncryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    size_t fullBlocks = blocksNumber - (blocksNumber % BITSLICED_BLOCKS);
+    for (size_t i = 0; i < fullBlocks; i += BITSLICED_BLOCKS)
+    {
+        BitslicedEncrypt8<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+
+    if (fullBlocks < blocksNumber)
+    {
+        uint8_t scratch[BITSLICED_BLOCKS * BLOCK_SIZE] = {};
+        std::copy(input + fullBlocks * BLOCK_SIZE, input + blocksNumber * BLOCK_SIZE, scratch);
+        BitslicedEncrypt8<Nr>(key, scratch, scratch);
+        std::copy(scratch, scratch + (blocksNumber - fullBlocks) * BLOCK_SIZE, output + fullBlocks * BLOCK_SIZE);
+    }
+}
+
+/********************************************************************
+ * Function: BitslicedDecryptBlocks
+ * Description:
+ *  Function to decrypt consecutive blocks with the constant-time
+ *  bitsliced kernel. Full groups of BITSLICED_BLOCKS are processed
+ *  in place, a partial tail group goes through a scratch buffer
+ * Inputs:  key             - Expanded key (bitsliced backend)
+ *          input           - Blocks to be decrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Decrypted blocks
+ * Returns: void
+ ********************************************************************/
+template <int Nr>
+void BitslicedDecryptBlocks(const AesKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    size_t fullBlocks = blocksNumber - (blocksNumber % BITSLICED_BLOCKS);
+    for (size_t i = 0; i < fullBlocks; i += BITSLICED_BLOCKS)
+    {
+        BitslicedDecrypt8<Nr>(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+    }
+
+    if (fullBlocks < blocksNumber)
+    {
+        uint8_t scratch[BITSLICED_BLOCKS * BLOCK_SIZE] = {};
+        std::copy(input + fullBlocks * BLOCK_SIZE, input + blocksNumber * BLOCK_SIZE, scratch);
+        BitslicedDecrypt8<Nr>(key, scratch, scratch);
+        std::copy(scratch, scratch + (blocksNumber - fullBlocks) * BLOCK_SIZE, output + fullBlocks * BLOCK_SIZE);
+    }
+}
+
+/********************************************************************
+ ********************** Block Buffer Functions **********************
+ ********************************************************************/
+/********************************************************************
+ * Function: BlockBuffer::BlockBuffer
+ * Description:
+ *  Constructors of the block buffer. The default constructor creates
+ *  an empty buffer without allocating, the second one allocates room
+ *  for a message of the given length
+ * Inputs:  length  - Length of the message in bytes
+ * Returns: void
+ ********************************************************************/
+BlockBuffer::BlockBuffer() : data(nullptr), length(0), capacity(0)
+{
+}
+
+BlockBuffer::BlockBuffer(size_t length) : BlockBuffer()
+{
+    Resize(length);
+}
+
+/********************************************************************
+ * Function: BlockBuffer::~BlockBuffer
+ * Description:
+ *  Destructor of the block buffer. It frees the aligned allocation
+ * Returns: void
+ ********************************************************************/
+BlockBuffer::~BlockBuffer()
+{
+    Release();
+}
+
+/********************************************************************
+ * Function: BlockBuffer move operations
+ * Description:
+ *  Transfer the ownership of the allocation from another buffer
+ *  leaving the other buffer empty
+ * Inputs:  other   - Buffer to take the allocation from
+ * Returns: void / Reference to this buffer
+ ********************************************************************/
+BlockBuffer::BlockBuffer(BlockBuffer&& other) noexcept : data(other.data), length(other.length), capacity(other.capacity)
+{
+    other.data = nullptr;
+    other.length = 0;
+    other.capacity = 0;
+}
+
+BlockBuffer& BlockBuffer::operator=(BlockBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        data = other.data;
+        length = other.length;
+        capacity = other.capacity;
+        other.data = nullptr;
+        other.length = 0;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+/********************************************************************
+ * Function: BlockBuffer::Resize
+ * Description:
+ *  Set the message length of the buffer. The buffer only reallocates
+ *  when the current capacity is too small, and the contents are not
+ *  preserved across a reallocation. Any bytes between the length and
+ *  the end of the last state are zeroed
+ * Inputs:  newLength   - New length of the message in bytes
+ * Returns: void
+ ********************************************************************/
+void BlockBuffer::Resize(size_t newLength)
+{
+    /* The capacity always covers whole states */
+    size_t requiredCapacity = ((newLength + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+
+    if (requiredCapacity > capacity)
+    {
+        Release();
+        data = static_cast<uint8_t*>(::operator new(requiredCapacity, std::align_val_t(BUFFER_ALIGNMENT)));
+        AES_COUNT_ALLOCATION(requiredCapacity);
+        capacity = requiredCapacity;
+
+        /* Fault the pages of a large buffer in from the NUMA nodes that will process them */
+        if ((requiredCapacity >= FIRST_TOUCH_MIN_SIZE) && (GetNumaTopology().nodeCpus.size() > 1) &&
+            (GetWorkerPool().NodesNumber() > 1))
+        {
+            FirstTouchDispatcher(GetWorkerPool(), data, requiredCapacity);
+        }
+    }
+    length = newLength;
+
+    /* Zero the tail of the last state */
+    if (requiredCapacity > newLength)
+    {
+        std::memset(data + newLength, 0, requiredCapacity - newLength);
+    }
+}
+
+/********************************************************************
+ * Function: BlockBuffer::Release
+ * Description:
+ *  Free the aligned allocation of the buffer if any
+ * Returns: void
+ ********************************************************************/
+void BlockBuffer::Release()
+{
+    if (data != nullptr)
+    {
+        ::operator delete(data, std::align_val_t(BUFFER_ALIGNMENT));
+    }
+    data = nullptr;
+    length = 0;
+    capacity = 0;
+}
+
+/********************************************************************
+ ********************** Worker Pool Functions ***********************
+ ********************************************************************/
+/********************************************************************
+ * Function: WorkerPool::WorkerPool
+ * Description:
+ *  Constructor of the worker pool. It starts the requested number of
+ *  worker threads which stay alive waiting for tasks, placed and
+ *  pinned according to the placement. With the Numa placement the
+ *  threads are dealt round-robin over the nodes (only the first
+ *  threadsNumber nodes when there are fewer threads than nodes) and
+ *  over the CPUs of each node
+ * Inputs:  threadsNumber   - Number of worker threads to start
+ *          placement       - Placement of the threads
+ *          topology        - NUMA topology, nullptr for the machine's
+ * Returns: void
+ ********************************************************************/
+WorkerPool::WorkerPool(size_t threadsNumber, WorkerPlacement placement, const NumaTopology* topology)
+    : queuedRanges(0), idleWorkers(0), stopping(false)
+{
+    /* At least one worker is needed for the submitted tasks to make progress */
+    if (threadsNumber == 0)
+    {
+        threadsNumber = 1;
+    }
+
+    const NumaTopology& numa = (topology != nullptr) ? *topology : GetNumaTopology();
+    if (placement == WorkerPlacement::Automatic)
+    {
+        placement = ((numa.nodeCpus.size() > 1) && (threadsNumber > 1)) ? WorkerPlacement::Numa : WorkerPlacement::None;
+    }
+
+    /* Node and CPU of every worker slot, -1 leaves the thread unpinned */
+    std::vector<size_t> slotNodes(threadsNumber, 0);
+    std::vector<int> slotCpus(threadsNumber, -1);
+    size_t nodesNumber = 1;
+
+    if (placement == WorkerPlacement::Compact)
+    {
+        std::vector<int> cpus;
+        for (const std::vector<int>& nodeCpus : numa.nodeCpus)
+        {
+            cpus.insert(cpus.end(), nodeCpus.begin(), nodeCpus.end());
+        }
+        for (size_t slot = 0; (slot < threadsNumber) && !cpus.empty(); ++slot)
+        {
+            slotCpus[slot] = cpus[slot % cpus.size()];
+        }
+    }
+    else if ((placement == WorkerPlacement::Numa) && !numa.nodeCpus.empty())
+    {
+        nodesNumber = std::min<size_t>(numa.nodeCpus.size(), threadsNumber);
+
+        /* Slots are numbered node by node, node n getting every nodesNumber-th thread */
+        size_t slot = 0;
+        for (size_t node = 0; node < nodesNumber; ++node)
+        {
+            size_t nodeThreads = threadsNumber / nodesNumber + ((node < threadsNumber % nodesNumber) ? 1 : 0);
+            for (size_t i = 0; i < nodeThreads; ++i, ++slot)
+            {
+                slotNodes[slot] = node;
+                slotCpus[slot] = numa.nodeCpus[node][i % numa.nodeCpus[node].size()];
+            }
+        }
+    }
+
+    /* First slot of every node, plus the total as a sentinel */
+    nodeFirstSlots.assign(nodesNumber + 1, threadsNumber);
+    for (size_t slot = threadsNumber; slot-- > 0;)
+    {
+        nodeFirstSlots[slotNodes[slot]] = slot;
+    }
+    workerNodes = slotNodes;
+    queues.resize(nodesNumber);
+    deques = std::vector<WorkerDeque>(threadsNumber);
+
+    workers.reserve(threadsNumber);
+    for (size_t slot = 0; slot < threadsNumber; ++slot)
+    {
+        workers.emplace_back(&WorkerPool::WorkerLoop, this, slot, slotCpus[slot]);
+    }
+}
+
+/********************************************************************
+ * Function: WorkerPool::~WorkerPool
+ * Description:
+ *  Destructor of the worker pool. It lets the workers drain the
+ *  queued tasks then joins them
+ * Returns: void
+ ********************************************************************/
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/********************************************************************
+ * Function: WorkerPool::Submit
+ * Description:
+ *  Queue a task to be executed by one of the worker threads of a
+ *  node. Without the Numa placement there is a single node 0
+ * Inputs:  task    - Task to be executed
+ *          node    - Node whose workers run the task
+ * Returns: void
+ ********************************************************************/
+void WorkerPool::Submit(std::function<void()> task, size_t node)
+{
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        queues[std::min<size_t>(node, queues.size() - 1)].push_back(std::move(task));
+    }
+    AES_COUNT_TASK();
+
+    /* The workers share one condition variable, wake them all so the ones of the node see the task */
+    if (queues.size() > 1)
+    {
+        workAvailable.notify_all();
+    }
+    else
+    {
+        workAvailable.notify_one();
+    }
+}
+
+/********************************************************************
+ * Function: WorkerPool::ParallelFor
+ * Description:
+ *  Run body over [0, count) on the workers and wait for it, see
+ *  ParallelForAsync. Several threads may run ParallelFor on the same
+ *  pool at once. A worker of the pool calling it does not block: it
+ *  runs ranges from its own deque or stolen ones (of any job) until
+ *  its job completes, and only sleeps while no range is queued
+ * Inputs:  count   - Number of items
+ *          grain   - Largest piece handed to body (at least 1)
+ *          body    - Function processing items [first, last)
+ * Returns: void
+ ********************************************************************/
+void WorkerPool::ParallelFor(uint64_t count, uint64_t grain, const std::function<void(uint64_t, uint64_t)>& body)
+{
+    if (currentPool == this)
+    {
+        size_t slot = currentSlot;
+        std::atomic<bool> jobDone(false);
+
+        /* Set under the mutex so the helping worker cannot miss the wake-up between its check and its wait */
+        ParallelForAsync(count, grain, body, [this, &jobDone]()
+        {
+            {
+                std::lock_guard<std::mutex> lock(tasksMutex);
+                jobDone.store(true);
+            }
+            workAvailable.notify_all();
+        });
+
+        while (!jobDone.load())
+        {
+            RangeTask range;
+            if (PopRange(slot, range) || StealRange(slot, range))
+            {
+                RunRange(slot, range);
+                continue;
+            }
+
+            /* The remaining pieces are running on other workers, counting as idle lets them split for us */
+            std::unique_lock<std::mutex> lock(tasksMutex);
+            AES_WAIT_TIMER(InstrumentedWait::DispatcherWait);
+            idleWorkers.fetch_add(1);
+            workAvailable.wait(lock, [this, &jobDone]() { return jobDone.load() || (queuedRanges.load() != 0); });
+            idleWorkers.fetch_sub(1);
+        }
+        return;
+    }
+
+    std::latch jobDone(1);
+    ParallelForAsync(count, grain, body, [&jobDone]() { jobDone.count_down(); });
+
+    /* Wait for all the items to be processed */
+    AES_WAIT_TIMER(InstrumentedWait::DispatcherWait);
+    jobDone.wait();
+}
+
+/********************************************************************
+ * Function: WorkerPool::ParallelForAsync
+ * Description:
+ *  Run body over [0, count) on the workers and return at once. The
+ *  items are first cut into one range per worker (fewer when count
+ *  is below threads * grain), range r going to the deque of the
+ *  worker in slot r * threads / rangesNumber, i.e. to the node given
+ *  by NodeOfRange. From there the ranges are split and stolen by the
+ *  workers, body being called on pieces of at most grain items.
+ *  completion runs exactly once after the last piece, on the worker
+ *  that processed it (or on the caller when count is 0). Exceptions
+ *  thrown by it on a worker are dropped, callers report their
+ *  errors through their own channel
+ * Inputs:  count       - Number of items
+ *          grain       - Largest piece handed to body (at least 1)
+ *          body        - Function processing items [first, last)
+ *          completion  - Function called once all the items are done
+ * Returns: void
+ ********************************************************************/
+void WorkerPool::ParallelForAsync(uint64_t count, uint64_t grain, std::function<void(uint64_t, uint64_t)> body,
+                                  std::function<void()> completion)
+{
+    if (count == 0)
+    {
+        completion();
+        return;
     }
-    for (int col = 0; col < 4; col++) {
-        state[3][col] = rowTemp[col];  // Copy the shifted bytes back to row 3
+    grain = std::max<uint64_t>(grain, 1);
+
+    RangeJob* job = new RangeJob{std::move(body), std::move(completion), grain, count};
+
+    uint64_t rangesNumber = std::clamp<uint64_t>(count / grain, 1, workers.size());
+    uint64_t rangeSize = (count + rangesNumber - 1) / rangesNumber;
+    rangesNumber = (count + rangeSize - 1) / rangeSize;
+    for (uint64_t range = 0; range < rangesNumber; ++range)
+    {
+        uint64_t first = range * rangeSize;
+        PushRange(range * workers.size() / rangesNumber, RangeTask{job, first, std::min<uint64_t>(first + rangeSize, count)}, false);
+    }
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
     }
+    workAvailable.notify_all();
 }
+
 /********************************************************************
- * Function: MixColumns
+ * Function: WorkerPool::PushRange
  * Description:
- *  This function performs AES Mix Columns steps by multipying
- *  the fixed polynomial matrix defined by AES NIST by the input
- *  state. Essentially, it performs 4x4 matrix multiplication in
- *  GF(2^8)
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Outputs: state   - Refernece to Output State Matrix (4x4)
+ *  Queue a range at the back of a worker deque. queuedRanges and
+ *  idleWorkers are sequentially consistent, so either a worker about
+ *  to sleep sees the new range or the pusher sees the idle worker
+ *  and wakes it
+ * Inputs:  slot    - Worker owning the deque
+ *          range   - Range to be queued
+ *          notify  - Wake an idle worker if any
  * Returns: void
  ********************************************************************/
-void MixColumns(uint8_t state[4][4]) 
+void WorkerPool::PushRange(size_t slot, const RangeTask& range, bool notify)
 {
-    /* Define a 4x4 temporary matrix for intermediate computations in order not to corrupt the input matrix */
-    uint8_t temp[4][4];
-
-    /* Initialize the fixed polynomial matrix defined by AES NIST for Mix Columns step */
-    uint8_t fixedMatrix[4][4] = {
-        {0x02, 0x03, 0x01, 0x01},
-        {0x01, 0x02, 0x03, 0x01},
-        {0x01, 0x01, 0x02, 0x03},
-        {0x03, 0x01, 0x01, 0x02}
-    };
+    {
+        std::lock_guard<std::mutex> lock(deques[slot].rangesMutex);
+        deques[slot].ranges.push_back(range);
+    }
+    queuedRanges.fetch_add(1);
+    AES_COUNT_TASK();
 
-    /* Apply GF Multiplication of the Fixed Polynomial Matrix (4x4) by the input State Matrix (4x4) */
-    for (int col = 0; col < 4; ++col) {
-        for (int row = 0; row < 4; ++row) {
-            temp[row][col] = 0;
-            for (int k = 0; k < 4; ++k) {
-                temp[row][col] ^= GaloisFieldMultiplication(fixedMatrix[row][k], state[k][col]);
-            }
+    if (notify && (idleWorkers.load() != 0))
+    {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
         }
+        workAvailable.notify_one();
     }
+}
 
-    /* Copy the result back from the temporary matrix to the output state matrix */
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            state[row][col] = temp[row][col];
-        }
+/* Function to take the newest range of a worker's own deque */
+bool WorkerPool::PopRange(size_t slot, RangeTask& range)
+{
+    std::lock_guard<std::mutex> lock(deques[slot].rangesMutex);
+    if (deques[slot].ranges.empty())
+    {
+        return false;
     }
+    range = deques[slot].ranges.back();
+    deques[slot].ranges.pop_back();
+    queuedRanges.fetch_sub(1);
+    return true;
 }
 
 /********************************************************************
- ********************** Decryption Functions ************************
+ * Function: WorkerPool::StealRange
+ * Description:
+ *  Take the oldest range of another worker's deque, trying the
+ *  workers of the same NUMA node before the remote ones. The oldest
+ *  range is the largest one left by the lazy splitting
+ * Inputs:  slot    - Worker looking for work
+ * Outputs: range   - Stolen range
+ * Returns: true if a range was stolen
  ********************************************************************/
+bool WorkerPool::StealRange(size_t slot, RangeTask& range)
+{
+    size_t threadsNumber = deques.size();
+    for (int pass = 0; (pass < 2) && (queuedRanges.load(std::memory_order_relaxed) != 0); ++pass)
+    {
+        for (size_t i = 1; i < threadsNumber; ++i)
+        {
+            size_t victim = (slot + i) % threadsNumber;
+            if ((workerNodes[victim] == workerNodes[slot]) != (pass == 0))
+            {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(deques[victim].rangesMutex);
+            if (!deques[victim].ranges.empty())
+            {
+                range = deques[victim].ranges.front();
+                deques[victim].ranges.pop_front();
+                queuedRanges.fetch_sub(1);
+                AES_COUNT_STEAL();
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 /********************************************************************
- * Function: InvMixColumns
+ * Function: WorkerPool::RunRange
  * Description:
- *  This function performs AES Inverse Mix Columns steps by multipying
- *  the inverse of the fixed polynomial matrix defined by AES NIST 
- *  by the input state. Essentially, it performs 4x4 matrix 
- *  multiplication in GF(2^8)
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Outputs: state   - Refernece to Output State Matrix (4x4)
+ *  Process a range grain items at a time. Before every piece, if
+ *  some worker is idle and at least two grains are left, the upper
+ *  half of what is left goes back onto the worker's deque where the
+ *  idle worker can steal it. The job is deleted before its
+ *  completion runs, and an exception thrown by the completion is
+ *  dropped
+ * Inputs:  slot    - Worker running the range
+ *          range   - Range to be processed
  * Returns: void
  ********************************************************************/
-void InvMixColumns(uint8_t state[4][4]) 
+void WorkerPool::RunRange(size_t slot, RangeTask range)
 {
-    /* Define a 4x4 temporary matrix for intermediate computations in order not to corrupt the input matrix */
-    uint8_t temp[4][4];
+    RangeJob& job = *range.job;
+    while (range.first < range.last)
+    {
+        if ((range.last - range.first >= 2 * job.grain) && (idleWorkers.load(std::memory_order_relaxed) != 0))
+        {
+            uint64_t middle = range.first + (range.last - range.first) / 2;
+            PushRange(slot, RangeTask{&job, middle, range.last}, true);
+            range.last = middle;
+        }
 
-    /* Initialize the fixed polynomial matrix defined by AES NIST for Mix Columns step */
-    uint8_t fixedMatrix[4][4] = {
-        {0x0E, 0x0B, 0x0D, 0x09},
-        {0x09, 0x0E, 0x0B, 0x0D},
-        {0x0D, 0x09, 0x0E, 0x0B},
-        {0x0B, 0x0D, 0x09, 0x0E}
-    };
+        uint64_t last = std::min<uint64_t>(range.first + job.grain, range.last);
+        job.body(range.first, last);
+        uint64_t done = last - range.first;
+        range.first = last;
 
-    /* Apply GF Multiplication of the Fixed Polynomial Matrix (4x4) by the input State Matrix (4x4) */
-    for (int col = 0; col < 4; ++col) {
-        for (int row = 0; row < 4; ++row) {
-            temp[row][col] = 0;
-            for (int k = 0; k < 4; ++k) {
-                temp[row][col] ^= GaloisFieldMultiplication(fixedMatrix[row][k], state[k][col]);
-            }
-        }
-    }
+        /* The worker finishing the last items completes the job */
+        if (job.itemsLeft.fetch_sub(done) == done)
+        {
+            std::function<void()> completion = std::move(job.completion);
+            delete &job;
 
-    /* Copy the result back from the temporary matrix to the output state matrix */
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            state[row][col] = temp[row][col];
+            /* Nobody can receive an exception on a worker, so a throwing completion must not take the thread down */
+            try
+            {
+                completion();
+            }
+            catch (...)
+            {
+            }
+            return;
         }
     }
 }
 
-
 /********************************************************************
- ************************ Utility Functions *************************
+ * Function: WorkerPool::ThreadsNumber
+ * Description:
+ *  Get the number of worker threads in the pool
+ * Returns: Number of worker threads
  ********************************************************************/
+size_t WorkerPool::ThreadsNumber() const
+{
+    return workers.size();
+}
+
 /********************************************************************
- * Function: printState
+ * Function: WorkerPool::NodesNumber
  * Description:
- *  Function to print the state (4x4) Matrix
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Returns: void
+ *  Get the number of NUMA nodes (task queues) of the pool
+ * Returns: Number of nodes, 1 unless the placement is Numa
  ********************************************************************/
-void printState(const uint8_t state[4][4])
+size_t WorkerPool::NodesNumber() const
 {
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            std::cout << std::hex << static_cast<int>(state[row][col]) << " ";
-        }
-        std::cout << std::endl;
-    }
+    return queues.size();
 }
 
 /********************************************************************
- * Function: IncrementCounter
+ * Function: WorkerPool::NodeOfRange
  * Description:
- *  Function to increment the 16 byte counter considering the carry
- *  propagation
- * Inputs:  counter   - Refernece to the counter array
- * Outputs: counter   - The counter after being incremented
- * Returns: void
+ *  Get the node that processes a range of a buffer split into equal
+ *  contiguous ranges. The split follows the worker slots, so each
+ *  node gets a contiguous share proportional to its workers
+ * Inputs:  range           - Index of the range
+ *          rangesNumber    - Number of ranges of the buffer
+ * Returns: Node to submit the range to
  ********************************************************************/
-void IncrementCounter(std::vector<uint8_t>& counter) 
+size_t WorkerPool::NodeOfRange(size_t range, size_t rangesNumber) const
 {
-    for (size_t i = 0; i < 16; ++i) { // Iterate from LSB to MSB
-        if (++counter[i] != 0) {      // Increment the current byte
-            break;                     // If no overflow, we're done
-        }
-    } // If the loop completes, the counter wrapped around
+    size_t slot = range * workers.size() / rangesNumber;
+    size_t node = 0;
+    while (slot >= nodeFirstSlots[node + 1])
+    {
+        ++node;
+    }
+    return node;
 }
 
-
 /********************************************************************
- * Function: TextPreprocessor
+ * Function: WorkerPool::WorkerLoop
  * Description:
- *  Function to transform text into states for AES manipulation for
- *  either encryption or decryption
- * Inputs:  strText  - text as string either plaintext or ciphertext
- * Outputs: states   - Prepared states
+ *  Body of every worker thread. It pins itself to its CPU if it has
+ *  one, then runs the ranges of its own deque, steals ranges from
+ *  the other workers and runs the tasks queued on its node, sleeping
+ *  when there is nothing left, until the pool is stopped
+ * Inputs:  slot    - Slot of the worker
+ *          cpu     - CPU to pin the worker to, -1 for none
  * Returns: void
  ********************************************************************/
-void TextPreprocessor(const std::string& strText, std::vector<std::vector<std::vector<uint8_t>>>& states) 
+void WorkerPool::WorkerLoop(size_t slot, int cpu)
 {
-    /* Create a copy vector to avoid modifying the original */
-    std::vector<uint8_t> paddedText; 
-
-    /* Transform the string into a vector for manipulation */
-    paddedText.assign(strText.begin(), strText.end());
-    
-    /* Check that the plaintext is multiples of 16 bytes */
-    if (paddedText.size() % 16 != 0) 
+    if (cpu >= 0)
     {
-        /* Pad the plain text by 0x00 until it's a multiple of 16 */
-        paddedText.resize(paddedText.size() + (16 - (paddedText.size() % 16)), 0x00);
+        PinCurrentThread(cpu);
     }
+    currentPool = this;
+    currentSlot = slot;
 
-    /* Store each 16 bytes in the plaintext in each element of the states vector */
-    for (size_t i = 0; i < paddedText.size(); i += 16) 
+    std::deque<std::function<void()>>& tasks = queues[workerNodes[slot]];
+    while (true)
     {
-        /* Create a temporary state to hold the currently extracted state from the plaintext */
-        std::vector<std::vector<uint8_t>> state(4, std::vector<uint8_t>(4));
+        RangeTask range;
+        if (PopRange(slot, range) || StealRange(slot, range))
+        {
+            RunRange(slot, range);
+            continue;
+        }
 
-        /* Extract 16 bytes from the plaintext and store them in the temporary state */
-        for(int j = 0; j < 4; j++) 
+        std::function<void()> task;
         {
-            for(int k = 0; k < 4; k++) 
+            std::unique_lock<std::mutex> lock(tasksMutex);
             {
-                state[j][k] = paddedText[i + (j * 4) + k];
+                AES_WAIT_TIMER(InstrumentedWait::WorkerIdle);
+                idleWorkers.fetch_add(1);
+                workAvailable.wait(lock, [this, &tasks]() { return stopping || (queuedRanges.load() != 0) || !tasks.empty(); });
+                idleWorkers.fetch_sub(1);
+            }
+
+            if (tasks.empty())
+            {
+                /* Exit only once all the work has been drained */
+                if (stopping && (queuedRanges.load() == 0))
+                {
+                    return;
+                }
+                continue;
             }
-        }
 
-        /* Append the state matrix to the states vector (Move Semantics) */
-        states.push_back(std::move(state));
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
     }
 }
 
 /********************************************************************
- * Function: TextPreprocessor
+ * Function: GetWorkerPool
  * Description:
- *  Function to transform states into text to be printed
- * Inputs:  states    - states
- * Outputs: strText   - text to be printed
- * Returns: void
+ *  Get the worker pool shared by the dispatchers. The pool is
+ *  created on first use with CORES_NUMBER workers, or one per usable
+ *  CPU when CORES_NUMBER is 0, placed according to WORKER_PLACEMENT,
+ *  and lives until the program exits
+ * Returns: Reference to the worker pool
  ********************************************************************/
-void TextPostprocessor(const std::vector<std::vector<std::vector<uint8_t>>>& states, std::string& strText) 
+WorkerPool& GetWorkerPool()
 {
-    std::stringstream ss; // Use a stringstream for efficiency
-    for (size_t i = 0; i < states.size(); ++i) {
-        for (int j = 0; j < 4; ++j) {
-            for (int k = 0; k < 4; ++k) {
-                ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(states[i][j][k]);
-            }
-        }
-    }
-    strText = ss.str();
-
+    static WorkerPool pool((CORES_NUMBER != 0U) ? CORES_NUMBER : DetectCpuCount(), WORKER_PLACEMENT);
+    return pool;
 }
 
 /********************************************************************
- * Function: GaloisFieldMultiplication
+ * Function: DetectCpuCount
  * Description:
- *  This function performs Galois Field Multiplication in GF(2^8).
- *  In AES we perform operations in GF(2^8) ensuring that each number
- *  can be represented by a single byte. The irreducable polynomial
- *  defined by AES NIST is m(x) = x^8 + x^4 + x^3 + x + 1 which
- *  corresponds to {01}{1b} in hex format or 283 in decimal format.
- *  GF(2^8) Multiplication steps:
- *      1. Distribute the first operand over the second operand
- *      2. Reduce the result to modulo m(x)
- * Inputs:  firstOperand    - First operand to GF multiplication
- *          secondOperand   - Second operand to GF multiplication
- * Outputs: void
- * Returns: Result of multipling firstOperand by the secondOperand
- *          in GF(2^8)
+ *  Get the number of CPUs the process can keep busy. On Linux this
+ *  is the size of the affinity mask, further capped by the cgroup
+ *  CPU quota (cgroup v2 cpu.max or cgroup v1 cfs_quota_us over
+ *  cfs_period_us, rounded up), so a container limited to 2 CPUs on
+ *  a 64-core host gets 2 workers. Elsewhere it is the hardware
+ *  concurrency
+ * Returns: Number of usable CPUs (at least 1)
  ********************************************************************/
-uint8_t GaloisFieldMultiplication(uint8_t firstOperand, uint8_t secondOperand) 
+size_t DetectCpuCount()
 {
-    /* Initialize a varibale to hold the result incrementally */
-    uint8_t result = 0;
-
-    /* Initialize a variable to hold the MSB during computations */
-    uint8_t high_bit = 0;
+    size_t cpus = std::max<size_t>(1, std::thread::hardware_concurrency());
 
-    /* Distibute the first operand on the second operand through looping over all its terms */
-    while(secondOperand) 
+#if defined(__linux__)
+    cpu_set_t affinity;
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
     {
-        /* If the LSB of the second operand is 1, then when distributed over the first operand a constant term will exist */
-        if ((secondOperand & 1) == 1)
-        {
-            /* This will require mod-2 adding (XOR) the first operand to the previous result */
-            result ^= firstOperand;
-        }
-        
-        /* Maintain the MSB which will be checked to indicate whether the result exceeded GF(2^8) or not */
-        high_bit = firstOperand & 0x80;
-
-        /* Multiply the first Operand by x to consider the next term in the next iteration. Multiplication by x in GF is essentially a simple shift left by 1 */
-        firstOperand <<= 1;
+        cpus = std::max<size_t>(1, static_cast<size_t>(CPU_COUNT(&affinity)));
+    }
 
-        /* Check if the result of multiplication by x exceeded the GF(2^8) which is indicated by the MSB being 1 before multiplication */
-        if(high_bit == 1)
+    /* cgroup v2: "<quota> <period>" or "max <period>" */
+    uint64_t quota = 0;
+    uint64_t period = 0;
+    std::ifstream cpuMax("/sys/fs/cgroup/cpu.max");
+    std::string strQuota;
+    if ((cpuMax >> strQuota >> period) && (strQuota != "max"))
+    {
+        quota = std::strtoull(strQuota.c_str(), nullptr, 10);
+    }
+    else
+    {
+        /* cgroup v1: a quota of -1 means unlimited */
+        std::ifstream cfsQuota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+        std::ifstream cfsPeriod("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+        int64_t v1Quota = -1;
+        if ((cfsQuota >> v1Quota) && (cfsPeriod >> period) && (v1Quota > 0))
         {
-            /* We need to reduce the result by the AES irreducable polynomial (x^8 + x^4 + x^3 + x + 1)
-               This is performed by (firstOperand) mod (0x1b) which can be performed by a single division step
-               as the highest term is x^8 in the firstOperand. This division step is essentially a mod-2 subtraction
-               which is a simple XOR operation */
-            firstOperand ^= 0x1b;
+            quota = static_cast<uint64_t>(v1Quota);
         }
-        
-        /* Move to the next term (bit) to be processed in the second operand */
-        secondOperand >>= 1;
     }
+    if ((quota != 0) && (period != 0))
+    {
+        cpus = std::min<size_t>(cpus, std::max<uint64_t>(1, (quota + period - 1) / period));
+    }
+#endif
 
-    /* Return the final result of multiplication */
-    return result;
+    return cpus;
 }
 
 /********************************************************************
- ********************** Counter Mode Functions **********************
- ********************************************************************/
-/********************************************************************
- * Function: CounterModeInitializer
+ * Function: GetNumaTopology
  * Description:
- *  Function to initialize a counter for the CTR mode of operation
- *  for AES. It generates an 8-byte random number and concatenate it
- *  to a zero-initialized counter. The output counter is then used
- *  for CTR Mode AES
- * Inputs:  counter   - Place holder to hold the output counter
- * Outputs: counter   - The initialized counter
- * Returns: void
+ *  Get the NUMA topology of the machine, read once from sysfs. Only
+ *  the CPUs in the affinity mask are kept and nodes without any are
+ *  dropped. Without NUMA information the machine is a single node
+ *  holding all the hardware threads
+ * Returns: Reference to the topology
  ********************************************************************/
-void CounterModeInitializer(std::vector<uint8_t>& counter)
+const NumaTopology& GetNumaTopology()
 {
-    /* Check if the counter is of size 16 bytes. Resize if its not of the correct size */
-    if (counter.size() != 16)
+    static const NumaTopology topology = []()
     {
-        counter.resize(16);
-    }
+        NumaTopology numa;
 
-    /* Obtain a random seed from the OS */
-    std::random_device rd;
-    std::mt19937_64 gen(rd());  
-    std::uniform_int_distribution<> distrib(0, 255);
+#if defined(__linux__)
+        cpu_set_t affinity;
+        bool hasAffinity = (sched_getaffinity(0, sizeof(affinity), &affinity) == 0);
 
-    for (int i = 0; i < 16; ++i) 
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string strNodes;
+        if (std::getline(online, strNodes))
+        {
+            for (int node : ParseCpuList(strNodes))
+            {
+                std::ifstream cpuList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string strCpus;
+                std::getline(cpuList, strCpus);
+
+                std::vector<int> cpus;
+                for (int cpu : ParseCpuList(strCpus))
+                {
+                    if (!hasAffinity || ((cpu < CPU_SETSIZE) && CPU_ISSET(cpu, &affinity)))
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty())
+                {
+                    numa.nodeCpus.push_back(std::move(cpus));
+                }
+            }
+        }
+#endif
+
+        if (numa.nodeCpus.empty())
+        {
+            numa.nodeCpus.emplace_back();
+            for (unsigned cpu = 0; cpu < std::max(1U, std::thread::hardware_concurrency()); ++cpu)
+            {
+                numa.nodeCpus.back().push_back(static_cast<int>(cpu));
+            }
+        }
+        return numa;
+    }();
+    return topology;
+}
+
+/* Function to parse a sysfs CPU or node list such as "0-3,8,10-11" */
+std::vector<int> ParseCpuList(const std::string& strList)
+{
+    std::vector<int> list;
+    size_t position = 0;
+    while (position < strList.size())
     {
-        if(i < 8)
+        size_t end = strList.find(',', position);
+        if (end == std::string::npos)
         {
-            /* Set the remaining 8 bytes to 0 */
-            counter[i] = 0x00;
+            end = strList.size();
         }
-        else
+        std::string strRange = strList.substr(position, end - position);
+        size_t dash = strRange.find('-');
+        if (!strRange.empty() && (std::isdigit(static_cast<unsigned char>(strRange[0])) != 0))
         {
-            /* Store the random number in the first 8 bytes of the counter */
-            counter[i] = static_cast<uint8_t>(distrib(gen));
+            int first = std::stoi(strRange.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(strRange.substr(dash + 1));
+            for (int value = first; value <= last; ++value)
+            {
+                list.push_back(value);
+            }
         }
+        position = end + 1;
+    }
+    return list;
+}
+
+/* Function to pin the calling thread to a CPU. Failures (e.g. a CPU outside the cgroup) are ignored */
+void PinCurrentThread(int cpu)
+{
+#if defined(__linux__)
+    if ((cpu >= 0) && (cpu < CPU_SETSIZE))
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        (void)sched_setaffinity(0, sizeof(cpuSet), &cpuSet);
     }
+#else
+    (void)cpu;
+#endif
 }
 
 /********************************************************************
- * Function: EncryptionWorker
+ * Function: FirstTouchDispatcher
  * Description:
- *  Function to perform AES 128 encryption in counter mode
- *  for an input 4x4 state. The encrypted block is provided
- *  in the output encryptedState
- * Inputs:  state   - State to be encrypted
- *          counter - Counter to be used in encryption
- * Outputs: encryptedState   - Output state after encryption
+ *  Function to zero a freshly allocated buffer from the workers that
+ *  will process it. Linux places a page on the node of the thread
+ *  that first writes it, and ParallelFor cuts the buffer into one
+ *  range per worker exactly like it cuts a message of the same size
+ *  for StatesDispatcher, so every range later encrypted in place or
+ *  written to ends up local to the node it is dispatched to. The
+ *  grain is about a whole range, so the ranges are not split further.
+ *  Going through ParallelFor also keeps a worker resizing a buffer
+ *  (e.g. in a completion or a coroutine) running ranges itself
+ *  instead of blocking on the pool
+ * Inputs:  pool    - Worker pool that will process the buffer
+ *          data    - Buffer, not touched yet
+ *          length  - Length of the buffer in bytes
+ * Outputs: data    - Zeroed buffer
  * Returns: void
  ********************************************************************/
-void EncryptionWorker(const std::vector<std::vector<uint8_t>>& state, const std::vector<uint8_t> counter, std::vector<std::vector<uint8_t>>& encryptedState)
+void FirstTouchDispatcher(WorkerPool& pool, uint8_t* data, size_t length)
 {
-    /* Declare temporal array to be used during the process */    
-    uint8_t stateArray[4][4];
-    /*******************************TBD*************************************/
-    uint8_t key[32] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-                       0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
-                       0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
-                       0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};  // Example key
-    /* Select AES parameters based on key size */
-    int keySize = 32; // Use 16 for AES-128, 24 for AES-192, 32 for AES-256
-    int Nk = keySize / 4;
-    int Nr = Nk + 6;
-    // Expanded key schedule (NUM_COLUMN * (Nr + 1) words)
-    uint32_t expandedKey[NUM_COLUMN * (Nr + 1)];
-    /*******************************//************************************/
-
-    /* Transform the state vector into an array for efficient access */
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            stateArray[i][j] = state[i][j];
-        }
-    }
-
-    /* Perform AES Encryption rounds */
-    //Simplified encryption process
-    KeyExpansion(key, Nk, Nr, expandedKey);
-    // *** Convert expandedKey to a vector of bytes ***
-    std::vector<uint8_t> roundKey(4 * NUM_COLUMN * (Nr+1)); // Or size: 4 * (NUM_COLUMN * (Nr + 1)
-    for(int i = 0; i < NUM_COLUMN * (Nr + 1); ++i)
-    {
-        roundKey[4*i] = (expandedKey[i] >> 24) & 0xff;
-        roundKey[4*i + 1] = (expandedKey[i] >> 16) & 0xff;
-        roundKey[4*i + 2] = (expandedKey[i] >> 8) & 0xff;
-        roundKey[4*i + 3] = expandedKey[i] & 0xff;
-    }
-    AddRoundKey(stateArray, roundKey);
-    for(int round = 1; round < Nr; ++round)
-    {
-       SubBytes(stateArray);
-       ShiftRows(stateArray);
-       MixColumns(stateArray);  // mixColumns in all but the last round. Implement full matrix multiplication with GaloisField::mul
-       KeyExpansion(key, Nk, Nr, expandedKey);
-       // *** Convert expandedKey to a vector of bytes ***
-        for(int i = 0; i < NUM_COLUMN * (Nr + 1); ++i)
-        {
-            roundKey[4*i] = (expandedKey[i] >> 24) & 0xff;
-            roundKey[4*i + 1] = (expandedKey[i] >> 16) & 0xff;
-            roundKey[4*i + 2] = (expandedKey[i] >> 8) & 0xff;
-            roundKey[4*i + 3] = expandedKey[i] & 0xff;
-        }
-       AddRoundKey(stateArray, roundKey);
-    }
-    SubBytes(stateArray);
-    ShiftRows(stateArray);
-    KeyExpansion(key, Nk, Nr, expandedKey);
-    // *** Convert expandedKey to a vector of bytes ***
-    for(int i = 0; i < NUM_COLUMN * (Nr + 1); ++i)
+    uint64_t blocksNumber = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (blocksNumber == 0)
     {
-        roundKey[4*i] = (expandedKey[i] >> 24) & 0xff;
-        roundKey[4*i + 1] = (expandedKey[i] >> 16) & 0xff;
-        roundKey[4*i + 2] = (expandedKey[i] >> 8) & 0xff;
-        roundKey[4*i + 3] = expandedKey[i] & 0xff;
+        return;
     }
-    AddRoundKey(stateArray, roundKey);
+    /* Rounded down, so ParallelFor still makes one range per worker, each at most one grain and a block */
+    uint64_t grainBlocks = std::max<uint64_t>(blocksNumber / pool.ThreadsNumber(), 1);
 
-    /* Set the encrypted state array to the output vector parameter */
-    
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            encryptedState[i][j] = stateArray[i][j];
-        }
-    }
-    
+    pool.ParallelFor(blocksNumber, grainBlocks, [data, length](uint64_t first, uint64_t last)
+    {
+        size_t offset = first * BLOCK_SIZE;
+        std::memset(data + offset, 0, std::min<size_t>(last * BLOCK_SIZE, length) - offset);
+    });
 }
 
+#if AES_INSTRUMENTATION
+/********************************************************************
+ ******************** Instrumentation Functions *********************
+ ********************************************************************/
+/* Process-wide instrumentation counters, zero-initialized before any thread starts */
+InstrumentationCounters instrumentation;
+
+/* Names of the stages and waits in the JSON report */
+const char* const instrumentedStageNames[] = {"counter_init", "text_preprocess", "dispatch", "worker", "text_postprocess"};
+const char* const instrumentedWaitNames[] = {"worker_idle", "dispatcher_wait"};
+
 /********************************************************************
- * Function: DecryptionWorker
+ * Function: InstrumentationTimer::InstrumentationTimer
  * Description:
- *  Function to perform AES 128 decryption in counter mode
- *  for an input 4x4 state. The decrypted block is provided
- *  in the output decryptedState
- * Inputs:  state   - State to be decrypted
- *          counter - Counter to be used in decryption
- * Outputs: decryptedState   - Output state after decryption
+ *  Start timing a stage call, the call is counted right away
+ * Inputs:  stage   - Stage being timed
  * Returns: void
  ********************************************************************/
-void DecryptionWorker(const std::vector<std::vector<uint8_t>>& state, const std::vector<uint8_t> counter, std::vector<std::vector<uint8_t>>& decryptedState)
+InstrumentationTimer::InstrumentationTimer(InstrumentedStage stage)
+    : target(&instrumentation.stages[static_cast<size_t>(stage)].nanoseconds), start(std::chrono::steady_clock::now())
 {
-    /* Declare temporal array to be used during the process */    
-    uint8_t stateArray[4][4];
-
-    /* Transform the state vector into an array for efficient access */
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            stateArray[i][j] = state[i][j];
-        }
-    }
-
-    /* Perform AES decryption rounds */
-    // //Simplified decryption process
-    // addRoundKey(stateArray, keyExpansion.getRoundKey(/*Number of rounds*/));
-    // invShiftRows(stateArray);
-    // invSubBytes(stateArray);
-
-    // for(int round = /*Number of rounds*/ -1; round > 0; --round)
-    // {
-    //     addRoundKey(stateArray, keyExpansion.getRoundKey(round));
-    //     invMixColumns(stateArray);    // invMixColumns in all but the last round. Implement full matrix multiplication with GaloisField::mul
-    //     invShiftRows(stateArray);
-    //     invSubBytes(stateArray);
-    // }
-    // addRoundKey(stateArray, keyExpansion.getRoundKey(0));
-
-    /* Set the decrypted state array to the output vector parameter */
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            decryptedState[i][j] = stateArray[i][j];
-        }
-    }
+    instrumentation.stages[static_cast<size_t>(stage)].calls.fetch_add(1, std::memory_order_relaxed);
 }
 
 /********************************************************************
- * Function: EncryptionDispatcher
+ * Function: InstrumentationTimer::InstrumentationTimer
  * Description:
- *  Function to perform AES 128 encryption in counter mode
- *  for an input data. This function parallize the encryption
- *  over multiple working encryption threads to speed up the
- *  encryption process
- * Inputs:  states   - States to be encrypted
- *          counter - Counter to be used in encryption
- * Outputs: encryptedStates   - Output states after encryption
+ *  Start timing a wait
+ * Inputs:  wait    - Wait being timed
  * Returns: void
  ********************************************************************/
-void EncryptionDispatcher(const std::vector<std::vector<std::vector<uint8_t>>>& states, std::vector<uint8_t> counter, std::vector<std::vector<std::vector<uint8_t>>>& encryptedStates)
+InstrumentationTimer::InstrumentationTimer(InstrumentedWait wait)
+    : target(&instrumentation.waitNanoseconds[static_cast<size_t>(wait)]), start(std::chrono::steady_clock::now())
 {
-    /* Declare a thread pool with a number of available threads of CORES_NUMBER */
-    std::vector<std::thread> threadPool(CORES_NUMBER);
+}
 
-    /* Initialize an iterator to loop over the states */
-    uint64_t statesIterator = 0;
+/********************************************************************
+ * Function: InstrumentationTimer::~InstrumentationTimer
+ * Description:
+ *  Stop the timer and add the elapsed time to its counter
+ * Returns: void
+ ********************************************************************/
+InstrumentationTimer::~InstrumentationTimer()
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    target->fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+}
 
-    /* Initialize an variable to hold the number of threads currently dispatched */
-    uint8_t threadIterator = 0;
+/* Function to add the blocks and bytes processed by a stage call */
+void CountStage(InstrumentedStage stage, uint64_t blocks, uint64_t bytes)
+{
+    StageCounters& counters = instrumentation.stages[static_cast<size_t>(stage)];
+    counters.blocks.fetch_add(blocks, std::memory_order_relaxed);
+    counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
 
-    /* Loop over all the states in rounds */
-    while(statesIterator < states.size())
-    {
-        /* Increment the counter */
-        IncrementCounter(counter);
+/* Function to count an allocation made by the engine */
+void CountAllocation(uint64_t bytes)
+{
+    instrumentation.allocations.fetch_add(1, std::memory_order_relaxed);
+    instrumentation.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
 
-        /* Dispatch a thread to encrypt the current state */
-        threadPool[threadIterator] = std::thread(EncryptionWorker, std::ref(states[statesIterator]), counter, std::ref(encryptedStates[statesIterator]));
-
-        /* Increment the number of working threads */
-        threadIterator++;
-        
-        /* If all allowed threads have been allocated or reached the last state. Wait for all the in progress thread to finish */
-        if((threadIterator == CORES_NUMBER) || (statesIterator == (states.size() - 1)))
-        {   
-            /* Wait for running threads to finish before dispatching new threads */
-            for(threadIterator; threadIterator > 0; threadIterator--) 
-            {
-                threadPool[threadIterator - 1].join();
-            }
-        }
+/* Function to count a task or range queued on a worker pool */
+void CountTask()
+{
+    instrumentation.tasksSubmitted.fetch_add(1, std::memory_order_relaxed);
+}
 
-        /* Increment the states iterator for the next iteration */
-        statesIterator++;
-    }
+/* Function to count a range stolen by an idle worker */
+void CountSteal()
+{
+    instrumentation.rangesStolen.fetch_add(1, std::memory_order_relaxed);
 }
 
 /********************************************************************
- * Function: DecryptionDispatcher
+ * Function: DumpInstrumentation
  * Description:
- *  Function to perform AES 128 decryption in counter mode
- *  for an input data. This function parallize the decryption
- *  over multiple working decryption threads to speed up the
- *  decryption process
- * Inputs:  states   - States to be decrypted
- *          counter - Counter to be used in decryption
- * Outputs: encryptedStates   - Output states after decryption
+ *  Write a snapshot of the counters as a JSON document. It can be
+ *  called at any time, the counters keep running while they are
+ *  read so a snapshot taken during processing is not atomic as a
+ *  whole
+ * Inputs:  output  - Stream receiving the JSON document
  * Returns: void
  ********************************************************************/
-void DecryptionDispatcher(const std::vector<std::vector<std::vector<uint8_t>>>& states, std::vector<uint8_t> counter, std::vector<std::vector<std::vector<uint8_t>>>& decryptedStates)
+void DumpInstrumentation(std::ostream& output)
 {
-    /* Declare a thread pool with a number of available threads of CORES_NUMBER */
-    std::vector<std::thread> threadPool(CORES_NUMBER);
-
-    /* Initialize an iterator to loop over the states */
-    uint64_t statesIterator = 0;
-
-    /* Initialize an variable to hold the number of threads currently dispatched */
-    uint8_t threadIterator = 0;
-
-    /* Loop over all the states in rounds */
-    while(statesIterator < states.size())
+    output << "{\n  \"stages\": {";
+    for (size_t i = 0; i < static_cast<size_t>(InstrumentedStage::Count); ++i)
     {
-        /* Increment the counter */
-        IncrementCounter(counter);
-
-        /* Dispatch a thread to encrypt the current state */
-        threadPool[threadIterator] = std::thread(DecryptionWorker, std::ref(states[statesIterator]), counter, std::ref(decryptedStates[statesIterator]));
-
-        /* Increment the number of working threads */
-        threadIterator++;
-        
-        /* If all allowed threads have been allocated or reached the last state. Wait for all the in progress thread to finish */
-        if((threadIterator == CORES_NUMBER) || (statesIterator == (states.size() - 1)))
-        {   
-            /* Wait for running threads to finish before dispatching new threads */
-            for(threadIterator; threadIterator > 0; threadIterator--) 
-            {
-                threadPool[threadIterator - 1].join();
-            }
-        }
+        const StageCounters& counters = instrumentation.stages[i];
+        output << ((i == 0) ? "\n" : ",\n") << "    \"" << instrumentedStageNames[i] << "\": {"
+               << "\"calls\": " << counters.calls.load(std::memory_order_relaxed)
+               << ", \"nanoseconds\": " << counters.nanoseconds.load(std::memory_order_relaxed)
+               << ", \"blocks\": " << counters.blocks.load(std::memory_order_relaxed)
+               << ", \"bytes\": " << counters.bytes.load(std::memory_order_relaxed) << "}";
+    }
+    output << "\n  },\n  \"waits_ns\": {";
+    for (size_t i = 0; i < static_cast<size_t>(InstrumentedWait::Count); ++i)
+    {
+        output << ((i == 0) ? "" : ", ") << "\"" << instrumentedWaitNames[i] << "\": "
+               << instrumentation.waitNanoseconds[i].load(std::memory_order_relaxed);
+    }
+    output << "},\n  \"tasks_submitted\": " << instrumentation.tasksSubmitted.load(std::memory_order_relaxed)
+           << ",\n  \"ranges_stolen\": " << instrumentation.rangesStolen.load(std::memory_order_relaxed)
+           << ",\n  \"allocations\": {\"count\": " << instrumentation.allocations.load(std::memory_order_relaxed)
+           << ", \"bytes\": " << instrumentation.allocatedBytes.load(std::memory_order_relaxed) << "}\n}" << std::endl;
+}
 
-        /* Increment the states iterator for the next iteration */
-        statesIterator++;
+/* Function to zero all the counters, e.g. between two measured runs */
+void ResetInstrumentation()
+{
+    for (StageCounters& counters : instrumentation.stages)
+    {
+        counters.calls.store(0, std::memory_order_relaxed);
+        counters.nanoseconds.store(0, std::memory_order_relaxed);
+        counters.blocks.store(0, std::memory_order_relaxed);
+        counters.bytes.store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<uint64_t>& wait : instrumentation.waitNanoseconds)
+    {
+        wait.store(0, std::memory_order_relaxed);
     }
+    instrumentation.tasksSubmitted.store(0, std::memory_order_relaxed);
+    instrumentation.rangesStolen.store(0, std::memory_order_relaxed);
+    instrumentation.allocations.store(0, std::memory_order_relaxed);
+    instrumentation.allocatedBytes.store(0, std::memory_order_relaxed);
 }
 
+/* Write the report at exit when AES_INSTRUMENTATION_FILE names a destination */
+struct InstrumentationReporter
+{
+    ~InstrumentationReporter()
+    {
+        const char* path = std::getenv("AES_INSTRUMENTATION_FILE");
+        if ((path == nullptr) || (*path == '\0'))
+        {
+            return;
+        }
+        if (std::string(path) == "-")
+        {
+            DumpInstrumentation(std::cerr);
+            return;
+        }
+        std::ofstream report(path);
+        DumpInstrumentation(report);
+    }
+} instrumentationReporter;
+#endif
 
 /*******************************TBD*************************************/
 /* Function to perform the SubWord operation */
@@ -847,33 +6300,39 @@ uint32_t RotWord(uint32_t word)
 }
 
 /* AES key expansion function */
-void KeyExpansion(const uint8_t* key, int Nk, int Nr, uint32_t* w) 
+template <size_t KeySize>
+KeySchedule<KeySize> KeyExpansion(const uint8_t* key)
 {
+    constexpr int Nk = AesParameters<KeySize>::Nk;
+    KeySchedule<KeySize> w{};
     uint32_t temp;
     int i = 0;
 
     // Copy the original key into the first Nk words of w
     while (i < Nk) 
     {
-        w[i] = (key[4 * i] << 24) | (key[4 * i + 1] << 16) |
-               (key[4 * i + 2] << 8) | key[4 * i + 3];
+        w[i] = LoadWordBigEndian(key + 4 * i);
         ++i;
     }
 
     // Generate the remaining words for the expanded key
-    while (i < NUM_COLUMN * (Nr + 1)) 
+    while (i < AesParameters<KeySize>::scheduleWords) 
     {
         temp = w[i - 1];
         if (i % Nk == 0) 
         {
             temp = SubWord(RotWord(temp)) ^ (Rcon[i / Nk - 1] << 24);
-        } else if (Nk > 6 && i % Nk == 4) 
+        } else if constexpr (Nk > 6)
         {
-            temp = SubWord(temp);
+            if (i % Nk == 4)
+            {
+                temp = SubWord(temp);
+            }
         }
         w[i] = w[i - Nk] ^ temp;
         ++i;
     }
+    return w;
 }
 
 // Inverse SubBytes: Applies the inverse S-Box to the state
@@ -888,4 +6347,30 @@ void InvSubBytes(uint8_t state[4][4])
     }
 }
 
+/********************************************************************
+ * Function: InvShiftRows
+ * Description:
+ *  This function performs the inverse of the ShiftRows
+ *  transformation. It cyclically shifts row r of the state matrix
+ *  to the right by r bytes
+ * Inputs:  state   - Refernece to Input State Matrix (4x4)
+ * Outputs: state   - Refernece to Output State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+void InvShiftRows(uint8_t state[4][4])
+{
+    uint8_t rowTemp[4];
+
+    /* Row 0 is not shifted, row r is shifted right by r */
+    for (int row = 1; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++) {
+            rowTemp[(col + row) % 4] = state[row][col];
+        }
+        for (int col = 0; col < 4; col++) {
+            state[row][col] = rowTemp[col];
+        }
+    }
+}
+
 /*******************************//************************************/
\ No newline at end of file
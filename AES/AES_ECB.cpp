@@ -2,11 +2,32 @@
 #include <iomanip>
 #include <array>
 #include <vector>
-#include <bitset>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <random>
+
+#include "GaloisField.h"
+
+/********************************************************************
+ *********************** Configurations *****************************
+ ********************************************************************/
+/* Number of threads of the bulk functions. 0 uses one per hardware thread, any other value forces that many */
+#define CORES_NUMBER        (0U)
+/* Minimum number of consecutive blocks handed to a thread as a single range */
+#define BLOCKS_PER_BATCH    (256U)
 
 
 using namespace std;
 
+/* Number of columns (32-bit words) in the state */
+#define NUM_COLUMN          (4)
+/* Size of a single AES block in bytes */
+#define BLOCK_SIZE          (16U)
+/* Maximum number of rounds (AES-256) */
+#define MAX_ROUNDS          (14)
+
 // S-Box for SubBytes step
 const uint8_t sbox[256] = {
         0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76, 
@@ -48,147 +69,187 @@ const uint8_t inv_sbox[256] ={
 // Round constants (for AES key expansion)
 const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
 
+/* Example key (FIPS-197 Appendix B) */
+const uint8_t exampleKey[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+
+/********************************************************************
+ ***************************** Types ********************************
+ ********************************************************************/
+/* Contiguous range of blocks handed to one thread */
+struct BlockRange
+{
+    size_t first;
+    size_t count;
+};
+
 /********************************************************************
- * Function: GaloisFieldMultiplication
+ * Class: EcbKey
  * Description:
- *  This function performs Galois Field Multiplication in GF(2^8).
- *  In AES we perform operations in GF(2^8) ensuring that each number
- *  can be represented by a single byte. The irreducable polynomial
- *  defined by AES NIST is m(x) = x^8 + x^4 + x^3 + x + 1 which
- *  corresponds to {01}{1b} in hex format or 283 in decimal format.
- *  GF(2^8) Multiplication steps:
- *      1. Distribute the first operand over the second operand
- *      2. Reduce the result to modulo m(x)
- * Inputs:  firstOperand    - First operand to GF multiplication
- *          secondOperand   - Second operand to GF multiplication
- * Outputs: void
- * Returns: Result of multipling firstOperand by the secondOperand
- *          in GF(2^8)
+ *  AES key context expanded once and shared read-only by all the
+ *  threads. It holds the encryption round keys and the decryption
+ *  round keys of the equivalent inverse cipher (FIPS-197 section
+ *  5.3.5): the encryption round keys in reverse order with
+ *  InvMixColumns already applied to the inner ones, so decryption
+ *  runs the same round structure as encryption and never has to
+ *  reorder InvMixColumns and AddRoundKey at runtime
  ********************************************************************/
-uint8_t GaloisFieldMultiplication(uint8_t firstOperand, uint8_t secondOperand) 
+class EcbKey
 {
-    /* Initialize a varibale to hold the result incrementally */
-    uint8_t result = 0;
+public:
+    EcbKey(const uint8_t* key, size_t keySize);
 
-    /* Initialize a variable to hold the MSB during computations */
-    uint8_t high_bit = 0;
+    int Rounds() const { return rounds; }
+    const uint8_t* EncryptionRoundKey(int round) const { return encryptionRoundKeys[round]; }
+    const uint8_t* DecryptionRoundKey(int round) const { return decryptionRoundKeys[round]; }
 
-    /* Distibute the first operand on the second operand through looping over all its terms */
-    while(secondOperand) 
-    {
-        /* If the LSB of the second operand is 1, then when distributed over the first operand a constant term will exist */
-        if ((secondOperand & 1) == 1)
-        {
-            /* This will require mod-2 adding (XOR) the first operand to the previous result */
-            result ^= firstOperand;
-        }
-        
-        /* Maintain the MSB which will be checked to indicate whether the result exceeded GF(2^8) or not */
-        high_bit = firstOperand & 0x80;
+private:
+    int rounds;
+    uint8_t encryptionRoundKeys[MAX_ROUNDS + 1][BLOCK_SIZE];
+    uint8_t decryptionRoundKeys[MAX_ROUNDS + 1][BLOCK_SIZE];
+};
 
-        /* Multiply the first Operand by x to consider the next term in the next iteration. Multiplication by x in GF is essentially a simple shift left by 1 */
-        firstOperand <<= 1;
+/********************************************************************
+ ************************* Prototypes *******************************
+ ********************************************************************/
+/* Encryption Functions */
+void AddRoundKey(uint8_t state[4][4], const uint8_t* roundKey);
+void SubBytes(uint8_t state[4][4]);
+void ShiftRows(uint8_t state[4][4]);
+
+/* Decryption Functions (MixColumns and InvMixColumns come from GaloisField.h) */
+void InvSubBytes(uint8_t state[4][4]);
+void InvShiftRows(uint8_t state[4][4]);
+
+/* Key Functions */
+uint32_t SubWord(uint32_t word);
+uint32_t RotWord(uint32_t word);
+void KeyExpansion(const uint8_t* key, int Nk, int Nr, uint32_t* w);
+
+/* Block Functions */
+void AESEncrypt(const EcbKey& key, const uint8_t* plaintext, uint8_t* ciphertext);
+void AESDecrypt(const EcbKey& key, const uint8_t* ciphertext, uint8_t* plaintext);
+
+/* Bulk Functions */
+size_t ThreadsNumber();
+std::vector<BlockRange> SplitBlocks(size_t blocksNumber);
+template <typename Function>
+void ParallelBlocks(const std::vector<BlockRange>& ranges, Function function);
+void EcbEncrypt(const EcbKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+void EcbDecrypt(const EcbKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+void CbcEncrypt(const EcbKey& key, const uint8_t* iv, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+void CbcDecrypt(const EcbKey& key, const uint8_t* iv, const uint8_t* input, uint8_t* output, size_t blocksNumber);
+
+/* Printing Functions */
+void PrintBlocks(const char* label, const uint8_t* blocks, size_t blocksNumber);
 
-        /* Check if the result of multiplication by x exceeded the GF(2^8) which is indicated by the MSB being 1 before multiplication */
-        if(high_bit == 1)
-        {
-            /* We need to reduce the result by the AES irreducable polynomial (x^8 + x^4 + x^3 + x + 1)
-               This is performed by (firstOperand) mod (0x1b) which can be performed by a single division step
-               as the highest term is x^8 in the firstOperand. This division step is essentially a mod-2 subtraction
-               which is a simple XOR operation */
-            firstOperand ^= 0x1b;
-        }
-        
-        /* Move to the next term (bit) to be processed in the second operand */
-        secondOperand >>= 1;
-    }
+/********************************************************************
+ ************************* Main Function ****************************
+ ********************************************************************/
+// Main function to test AES encryption and decryption
+int main() {
 
-    /* Return the final result of multiplication */
-    return result;
-}
+    /* FIPS-197 Appendix B input block */
+    const uint8_t plaintext[16] = {
+        0x32, 0x43, 0xf6, 0xa8,
+        0x88, 0x5a, 0x30, 0x8d,
+        0x31, 0x31, 0x98, 0xa2,
+        0xe0, 0x37, 0x07, 0x34
+    };
 
-void MixColumns(uint8_t state[4][4]) 
-{
-    /* Define a 4x4 temporary matrix for intermediate computations in order not to corrupt the input matrix */
-    uint8_t temp[4][4];
-
-    /* Initialize the fixed polynomial matrix defined by AES NIST for Mix Columns step */
-    uint8_t fixedMatrix[4][4] = {
-        {0x02, 0x03, 0x01, 0x01},
-        {0x01, 0x02, 0x03, 0x01},
-        {0x01, 0x01, 0x02, 0x03},
-        {0x03, 0x01, 0x01, 0x02}
+    /* SP 800-38A F.1/F.2 message of four blocks and CBC IV */
+    const uint8_t message[4 * BLOCK_SIZE] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+        0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
     };
+    const uint8_t iv[BLOCK_SIZE] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
 
-    /* Apply GF Multiplication of the Fixed Polynomial Matrix (4x4) by the input State Matrix (4x4) */
-    for (int col = 0; col < 4; ++col) {
-        for (int row = 0; row < 4; ++row) {
-            temp[row][col] = 0;
-            for (int k = 0; k < 4; ++k) {
-                temp[row][col] ^= GaloisFieldMultiplication(fixedMatrix[row][k], state[k][col]);
-            }
-        }
-    }
+    /* Expected FIPS-197 Appendix B output, SP 800-38A F.1.1 (ECB-AES128) and F.2.1 (CBC-AES128) ciphertexts */
+    const uint8_t expectedCiphertext[BLOCK_SIZE] = {
+        0x39, 0x25, 0x84, 0x1d, 0x02, 0xdc, 0x09, 0xfb, 0xdc, 0x11, 0x85, 0x97, 0x19, 0x6a, 0x0b, 0x32
+    };
+    const uint8_t expectedEcb[4 * BLOCK_SIZE] = {
+        0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60, 0xa8, 0x9e, 0xca, 0xf3, 0x24, 0x66, 0xef, 0x97,
+        0xf5, 0xd3, 0xd5, 0x85, 0x03, 0xb9, 0x69, 0x9d, 0xe7, 0x85, 0x89, 0x5a, 0x96, 0xfd, 0xba, 0xaf,
+        0x43, 0xb1, 0xcd, 0x7f, 0x59, 0x8e, 0xce, 0x23, 0x88, 0x1b, 0x00, 0xe3, 0xed, 0x03, 0x06, 0x88,
+        0x7b, 0x0c, 0x78, 0x5e, 0x27, 0xe8, 0xad, 0x3f, 0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5d, 0xd4
+    };
+    const uint8_t expectedCbc[4 * BLOCK_SIZE] = {
+        0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+        0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+        0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+        0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7
+    };
 
-    /* Copy the result back from the temporary matrix to the output state matrix */
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            state[row][col] = temp[row][col];
-        }
+    /* Expand the key once, both schedules are shared by every call below */
+    EcbKey key(exampleKey, sizeof(exampleKey));
+
+    uint8_t ciphertext[16];
+    uint8_t decryptedText[16];
+
+    // Encrypt the plaintext
+    AESEncrypt(key, plaintext, ciphertext);
+
+    // Decrypt the ciphertext
+    AESDecrypt(key, ciphertext, decryptedText);
+
+    // Output the result
+    PrintBlocks("Plaintext: ", plaintext, 1);
+    PrintBlocks("Ciphertext: ", ciphertext, 1);
+    PrintBlocks("Decrypted text: ", decryptedText, 1);
+    bool blockMatch = (memcmp(ciphertext, expectedCiphertext, BLOCK_SIZE) == 0) && (memcmp(decryptedText, plaintext, BLOCK_SIZE) == 0);
+
+    /* Bulk ECB and CBC over a multi-block message */
+    uint8_t ecbText[sizeof(message)];
+    uint8_t cbcText[sizeof(message)];
+    uint8_t roundTrip[sizeof(message)];
+
+    EcbEncrypt(key, message, ecbText, 4);
+    PrintBlocks("ECB ciphertext: ", ecbText, 4);
+    EcbDecrypt(key, ecbText, roundTrip, 4);
+    PrintBlocks("ECB decrypted: ", roundTrip, 4);
+    bool ecbVectorMatch = (memcmp(ecbText, expectedEcb, sizeof(message)) == 0) && (memcmp(roundTrip, message, sizeof(message)) == 0);
+
+    CbcEncrypt(key, iv, message, cbcText, 4);
+    PrintBlocks("CBC ciphertext: ", cbcText, 4);
+    CbcDecrypt(key, iv, cbcText, roundTrip, 4);
+    PrintBlocks("CBC decrypted: ", roundTrip, 4);
+    bool cbcVectorMatch = (memcmp(cbcText, expectedCbc, sizeof(message)) == 0) && (memcmp(roundTrip, message, sizeof(message)) == 0);
+
+    cout << "Known answers: FIPS-197 " << (blockMatch ? "ok" : "FAILED") << ", ECB " << (ecbVectorMatch ? "ok" : "FAILED")
+         << ", CBC " << (cbcVectorMatch ? "ok" : "FAILED") << endl;
+
+    /* A message large enough to be split across the threads, decrypted in place */
+    std::vector<uint8_t> bulk(64 * BLOCKS_PER_BATCH * BLOCK_SIZE);
+    std::mt19937 generator(std::random_device{}());
+    for (uint8_t& byte : bulk)
+    {
+        byte = static_cast<uint8_t>(generator());
     }
+    std::vector<uint8_t> bulkCopy = bulk;
+    CbcEncrypt(key, iv, bulk.data(), bulk.data(), bulk.size() / BLOCK_SIZE);
+    CbcDecrypt(key, iv, bulk.data(), bulk.data(), bulk.size() / BLOCK_SIZE);
+    bool cbcMatch = (bulk == bulkCopy);
+    EcbEncrypt(key, bulk.data(), bulk.data(), bulk.size() / BLOCK_SIZE);
+    EcbDecrypt(key, bulk.data(), bulk.data(), bulk.size() / BLOCK_SIZE);
+    bool ecbMatch = (bulk == bulkCopy);
+    cout << "Bulk round trip (" << dec << bulk.size() << " bytes): ECB " << (ecbMatch ? "ok" : "FAILED")
+         << ", CBC " << (cbcMatch ? "ok" : "FAILED") << endl;
+
+    return (blockMatch && ecbVectorMatch && cbcVectorMatch && ecbMatch && cbcMatch) ? 0 : 1;
 }
 
 /********************************************************************
- ********************** Decryption Functions ************************
+ ********************** Encryption Functions ************************
  ********************************************************************/
-/********************************************************************
- * Function: InvMixColumns
- * Description:
- *  This function performs AES Inverse Mix Columns steps by multipying
- *  the inverse of the fixed polynomial matrix defined by AES NIST 
- *  by the input state. Essentially, it performs 4x4 matrix 
- *  multiplication in GF(2^8)
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Outputs: state   - Refernece to Output State Matrix (4x4)
- * Returns: void
- ********************************************************************/
-void InvMixColumns(uint8_t state[4][4]) 
-{
-    /* Define a 4x4 temporary matrix for intermediate computations in order not to corrupt the input matrix */
-    uint8_t temp[4][4];
-
-    /* Initialize the fixed polynomial matrix defined by AES NIST for Mix Columns step */
-    uint8_t fixedMatrix[4][4] = {
-        {0x0E, 0x0B, 0x0D, 0x09},
-        {0x09, 0x0E, 0x0B, 0x0D},
-        {0x0D, 0x09, 0x0E, 0x0B},
-        {0x0B, 0x0D, 0x09, 0x0E}
-    };
-
-    /* Apply GF Multiplication of the Fixed Polynomial Matrix (4x4) by the input State Matrix (4x4) */
+// AddRoundKey: XORs the state with a round key stored column by column (used for both encryption and decryption)
+void AddRoundKey(uint8_t state[4][4], const uint8_t* roundKey) {
     for (int col = 0; col < 4; ++col) {
         for (int row = 0; row < 4; ++row) {
-            temp[row][col] = 0;
-            for (int k = 0; k < 4; ++k) {
-                temp[row][col] ^= GaloisFieldMultiplication(fixedMatrix[row][k], state[k][col]);
-            }
-        }
-    }
-
-    /* Copy the result back from the temporary matrix to the output state matrix */
-    for (int row = 0; row < 4; ++row) {
-        for (int col = 0; col < 4; ++col) {
-            state[row][col] = temp[row][col];
-        }
-    }
-}
-
-
-// AddRoundKey: XORs the state with the round key used for both encryption and decryption
-void AddRoundKey(uint8_t state[4][4], uint8_t roundKey[4][4]) {
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            state[i][j] ^= roundKey[i][j];
+            state[row][col] ^= roundKey[4 * col + row];
         }
     }
 }
@@ -202,15 +263,6 @@ void SubBytes(uint8_t state[4][4]) {
     }
 }
 
-// Inverse SubBytes: Applies the inverse S-Box to the state
-void InvSubBytes(uint8_t state[4][4]) {
-    for (int i = 0; i < 4; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            state[i][j] = inv_sbox[state[i][j]];
-        }
-    }
-}
-
 // ShiftRows: Performs the row shift in the AES process
 void ShiftRows(uint8_t state[4][4]) {
     uint8_t temp;
@@ -229,12 +281,24 @@ void ShiftRows(uint8_t state[4][4]) {
     state[2][1] = state[2][3];
     state[2][3] = temp;
 
-    // Row 3: Left shift by 3
-    temp = state[3][0];
-    for (int i = 0; i < 3; ++i) {
-        state[3][i] = state[3][i + 1];
+    // Row 3: Left shift by 3 (right shift by 1)
+    temp = state[3][3];
+    for (int i = 3; i > 0; --i) {
+        state[3][i] = state[3][i - 1];
+    }
+    state[3][0] = temp;
+}
+
+/********************************************************************
+ ********************** Decryption Functions ************************
+ ********************************************************************/
+// Inverse SubBytes: Applies the inverse S-Box to the state
+void InvSubBytes(uint8_t state[4][4]) {
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            state[i][j] = inv_sbox[state[i][j]];
+        }
     }
-    state[3][3] = temp;
 }
 
 // Inverse ShiftRows: Performs the inverse row shift for decryption
@@ -255,213 +319,402 @@ void InvShiftRows(uint8_t state[4][4]) {
     state[2][2] = state[2][0];
     state[2][0] = temp;
 
-    // Row 3: Right shift by 3
-    temp = state[3][3];
-    for (int i = 3; i > 0; --i) {
-        state[3][i] = state[3][i - 1];
+    // Row 3: Right shift by 3 (left shift by 1)
+    temp = state[3][0];
+    for (int i = 0; i < 3; ++i) {
+        state[3][i] = state[3][i + 1];
     }
-    state[3][0] = temp;
+    state[3][3] = temp;
+}
+
+/********************************************************************
+ ************************** Key Functions ***************************
+ ********************************************************************/
+/* Function to perform the SubWord operation */
+uint32_t SubWord(uint32_t word)
+{
+    return (static_cast<uint32_t>(sbox[word >> 24]) << 24) | (static_cast<uint32_t>(sbox[(word >> 16) & 0xff]) << 16) |
+           (static_cast<uint32_t>(sbox[(word >> 8) & 0xff]) << 8) | static_cast<uint32_t>(sbox[word & 0xff]);
+}
+
+/* Function to perform the RotWord operation */
+uint32_t RotWord(uint32_t word)
+{
+    /* Rotate left by 8 bits */
+    return (word << 8) | (word >> 24);
 }
 
 /********************************************************************
- * Function: MixColumns
+ * Function: KeyExpansion
  * Description:
- *  This function performs AES Mix Columns steps by multipying
- *  the fixed polynomial matrix defined by AES NIST by the input
- *  state. Essentially, it performs 4x4 matrix multiplication in
- *  GF(2^8)
- * Inputs:  state   - Refernece to Input State Matrix (4x4)
- * Outputs: state   - Refernece to Output State Matrix (4x4)
+ *  AES key expansion (FIPS-197 section 5.2) producing the
+ *  NUM_COLUMN * (Nr + 1) words of the encryption key schedule
+ * Inputs:  key     - Cipher key (4 * Nk bytes)
+ *          Nk      - Number of 32-bit words in the key
+ *          Nr      - Number of rounds
+ * Outputs: w       - Key schedule
  * Returns: void
  ********************************************************************/
-
-// KeyExpansion to generate round keys
-void KeyExpansion(uint8_t key[16], uint8_t roundKeys[11][4][4]) 
+void KeyExpansion(const uint8_t* key, int Nk, int Nr, uint32_t* w)
 {
-    uint8_t temp[4]; // Temporary storage for the column being processed
-    int i = 0;
+    // Copy the original key into the first Nk words of w
+    for (int i = 0; i < Nk; ++i)
+    {
+        w[i] = (static_cast<uint32_t>(key[4 * i]) << 24) | (static_cast<uint32_t>(key[4 * i + 1]) << 16) |
+               (static_cast<uint32_t>(key[4 * i + 2]) << 8) | static_cast<uint32_t>(key[4 * i + 3]);
+    }
 
-    // Copy the original key as the first round key
-    for (int r = 0; r < 4; ++r) {
-        for (int c = 0; c < 4; ++c) {
-            roundKeys[0][c][r] = key[i++];
+    // Generate the remaining words for the expanded key
+    for (int i = Nk; i < NUM_COLUMN * (Nr + 1); ++i)
+    {
+        uint32_t temp = w[i - 1];
+        if (i % Nk == 0)
+        {
+            temp = SubWord(RotWord(temp)) ^ (static_cast<uint32_t>(rcon[i / Nk - 1]) << 24);
         }
+        else if ((Nk > 6) && (i % Nk == 4))
+        {
+            temp = SubWord(temp);
+        }
+        w[i] = w[i - Nk] ^ temp;
     }
+}
 
-    // Generate the rest of the round keys
-    for (int round = 1; round <= 10; ++round) {
-        // Step 1: Get the last column from the previous round key
-        for (int row = 0; row < 4; ++row) {
-            temp[row] = roundKeys[round - 1][3][row];
-        }
+/********************************************************************
+ * Function: EcbKey::EcbKey
+ * Description:
+ *  Constructor of the key context. It runs the key expansion once,
+ *  stores the encryption round keys column by column and derives
+ *  the decryption round keys of the equivalent inverse cipher
+ * Inputs:  key     - Cipher key
+ *          keySize - Size of the cipher key in bytes (16, 24 or 32)
+ * Returns: void
+ ********************************************************************/
+EcbKey::EcbKey(const uint8_t* key, size_t keySize)
+{
+    if ((keySize != 16) && (keySize != 24) && (keySize != 32))
+    {
+        throw std::invalid_argument("AES key size must be 16, 24 or 32 bytes.");
+    }
+    int Nk = static_cast<int>(keySize / 4);
+    rounds = Nk + 6;
 
-        // Step 2: Rotate the column (Word rotation)
-        uint8_t t = temp[0];
-        temp[0] = temp[1];
-        temp[1] = temp[2];
-        temp[2] = temp[3];
-        temp[3] = t;
+    // Expanded key schedule (NUM_COLUMN * (Nr + 1) words)
+    uint32_t expandedKey[NUM_COLUMN * (MAX_ROUNDS + 1)];
+    KeyExpansion(key, Nk, rounds, expandedKey);
 
-        // Step 3: Apply SubBytes to the column
-        for (int row = 0; row < 4; ++row) {
-            temp[row] = sbox[temp[row]];
+    /* Encryption round keys, each word most significant byte first */
+    for (int i = 0; i < NUM_COLUMN * (rounds + 1); ++i)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            encryptionRoundKeys[i / NUM_COLUMN][4 * (i % NUM_COLUMN) + row] = static_cast<uint8_t>(expandedKey[i] >> (24 - 8 * row));
         }
+    }
 
-        // Step 4: XOR the first element with the round constant
-        temp[0] ^= rcon[round - 1];
-
-        // Step 5: Compute the first column of the current round key
-        for (int row = 0; row < 4; ++row) {
-            roundKeys[round][0][row] = roundKeys[round - 1][0][row] ^ temp[row];
+    /* Decryption round keys: reversed, with InvMixColumns folded into the inner ones */
+    for (int round = 0; round <= rounds; ++round)
+    {
+        uint8_t roundKeyState[4][4];
+        for (int col = 0; col < 4; ++col)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                roundKeyState[row][col] = encryptionRoundKeys[rounds - round][4 * col + row];
+            }
         }
-
-        // Step 6: Compute the remaining columns of the current round key
-        for (int col = 1; col < 4; ++col) {
-            for (int row = 0; row < 4; ++row) {
-                roundKeys[round][col][row] = roundKeys[round - 1][col][row] ^ roundKeys[round][col - 1][row];
+        if ((round != 0) && (round != rounds))
+        {
+            InvMixColumns(roundKeyState);
+        }
+        for (int col = 0; col < 4; ++col)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                decryptionRoundKeys[round][4 * col + row] = roundKeyState[row][col];
             }
         }
     }
 }
 
+/********************************************************************
+ ************************* Block Functions **************************
+ ********************************************************************/
 // AESEncrypt function
-void AESEncrypt(uint8_t plaintext[16], uint8_t ciphertext[16], uint8_t roundKeys[11][4][4]) {
+void AESEncrypt(const EcbKey& key, const uint8_t* plaintext, uint8_t* ciphertext) {
     uint8_t state[4][4];
+    int Nr = key.Rounds();
 
-    // Copy plaintext into state array (row-major to column-major format)
-    int idx = 0;
+    // Copy plaintext into the state array, column by column
     for (int col = 0; col < 4; ++col) {
         for (int row = 0; row < 4; ++row) {
-            state[row][col] = plaintext[idx++];
+            state[row][col] = plaintext[4 * col + row];
         }
     }
 
     // Initial round key addition
-    AddRoundKey(state, roundKeys[0]);
+    AddRoundKey(state, key.EncryptionRoundKey(0));
 
     // Main rounds
-    for (int round = 1; round <= 9; ++round) {
+    for (int round = 1; round < Nr; ++round) {
         SubBytes(state);
         ShiftRows(state);
         MixColumns(state);
-        AddRoundKey(state, roundKeys[round]);
+        AddRoundKey(state, key.EncryptionRoundKey(round));
     }
 
     // Final round (no MixColumns)
     SubBytes(state);
     ShiftRows(state);
-    AddRoundKey(state, roundKeys[10]);
+    AddRoundKey(state, key.EncryptionRoundKey(Nr));
 
     // Copy state to ciphertext
-    idx = 0;
     for (int col = 0; col < 4; ++col) {
         for (int row = 0; row < 4; ++row) {
-            ciphertext[idx++] = state[row][col];
+            ciphertext[4 * col + row] = state[row][col];
         }
     }
 }
-// AESDecrypt function
-void AESDecrypt(uint8_t ciphertext[16], uint8_t plaintext[16], uint8_t roundKeys[11][4][4]) {
+
+// AESDecrypt function: equivalent inverse cipher, same round structure as AESEncrypt
+void AESDecrypt(const EcbKey& key, const uint8_t* ciphertext, uint8_t* plaintext) {
     uint8_t state[4][4];
+    int Nr = key.Rounds();
 
-    // Copy ciphertext into state array (row-major to column-major format)
-    int idx = 0;
+    // Copy ciphertext into the state array, column by column
     for (int col = 0; col < 4; ++col) {
         for (int row = 0; row < 4; ++row) {
-            state[row][col] = ciphertext[idx++];
+            state[row][col] = ciphertext[4 * col + row];
         }
     }
 
     // Initial round key addition
-    AddRoundKey(state, roundKeys[10]);
-
+    AddRoundKey(state, key.DecryptionRoundKey(0));
 
-
-    // Main rounds
-    for (int round = 9; round >= 1; --round) {
-        InvShiftRows(state);
+    // Main rounds, InvMixColumns is already folded into the round keys
+    for (int round = 1; round < Nr; ++round) {
         InvSubBytes(state);
-        AddRoundKey(state, roundKeys[round]);
+        InvShiftRows(state);
         InvMixColumns(state);
+        AddRoundKey(state, key.DecryptionRoundKey(round));
     }
 
-    
-    InvShiftRows(state);
-    InvSubBytes(state);
     // Final round (no InvMixColumns)
-    AddRoundKey(state, roundKeys[0]);
+    InvSubBytes(state);
+    InvShiftRows(state);
+    AddRoundKey(state, key.DecryptionRoundKey(Nr));
 
     // Copy state to plaintext
-    idx = 0;
     for (int col = 0; col < 4; ++col) {
         for (int row = 0; row < 4; ++row) {
-            plaintext[idx++] = state[row][col];
+            plaintext[4 * col + row] = state[row][col];
         }
     }
 }
 
+/********************************************************************
+ ************************** Bulk Functions **************************
+ ********************************************************************/
+/********************************************************************
+ * Function: ThreadsNumber
+ * Description:
+ *  Function to get the number of threads the bulk functions split
+ *  their blocks over: CORES_NUMBER, or the hardware concurrency when
+ *  CORES_NUMBER is 0
+ * Returns: Number of threads (at least 1)
+ ********************************************************************/
+size_t ThreadsNumber()
+{
+    static const size_t threadsNumber = (CORES_NUMBER != 0U) ? CORES_NUMBER
+                                                             : std::max<size_t>(1, std::thread::hardware_concurrency());
+    return threadsNumber;
+}
 
-// Main function to test AES encryption and decryption
-int main() {
+/********************************************************************
+ * Function: SplitBlocks
+ * Description:
+ *  Function to split blocksNumber blocks into contiguous ranges of
+ *  at least BLOCKS_PER_BATCH blocks, at most one per thread. The
+ *  blocks are spread evenly, the first ranges taking one extra block
+ *  each. A message too small to be split is a single range
+ * Inputs:  blocksNumber    - Number of blocks
+ * Returns: The ranges in block order
+ ********************************************************************/
+std::vector<BlockRange> SplitBlocks(size_t blocksNumber)
+{
+    size_t rangesNumber = std::clamp<size_t>(blocksNumber / BLOCKS_PER_BATCH, 1, ThreadsNumber());
+    size_t rangeSize = blocksNumber / rangesNumber;
+    size_t extraBlocks = blocksNumber % rangesNumber;
 
-    uint8_t key[16] = {
-        0x2b, 0x7e, 0x15, 0x16,
-        0x28, 0xae, 0xd2, 0xa6,
-        0xab, 0xf7, 0xcf, 0xa5,
-        0x30, 0x8d, 0x31, 0x32
-    };
-    
-    uint8_t plaintext[16] = {
-        0x32, 0x88, 0x31, 0xe0,
-        0x43, 0x5a, 0x31, 0x37,
-        0xf6, 0x30, 0x98, 0x07,
-        0xa8, 0x8d, 0xa2, 0x34
-    };
-    
-    uint8_t ciphertext[16];
-    uint8_t decryptedText[16];
-    uint8_t roundKeys[11][4][4];
-    // Expanded key schedule (NUM_COLUMN * (Nr + 1) words)
-    uint32_t expandedKey[NUM_COLUMN * (Nr + 1)];
-    // Perform key expansion
-    KeyExpansion(key, 4, 10, expandedKey);
-    cout << "Round keys";
-    for(int i=0;i<11;i++)
+    std::vector<BlockRange> ranges(rangesNumber);
+    size_t first = 0;
+    for (size_t range = 0; range < rangesNumber; ++range)
     {
-        for (int col = 0; col < 4; ++col)
+        ranges[range].first = first;
+        ranges[range].count = rangeSize + ((range < extraBlocks) ? 1 : 0);
+        first += ranges[range].count;
+    }
+    return ranges;
+}
+
+/********************************************************************
+ * Function: ParallelBlocks
+ * Description:
+ *  Function to run function(range index, first block, number of
+ *  blocks) once per range, every range but the last on a thread of
+ *  its own and the last one on the calling thread. A single range
+ *  runs on the calling thread only. Every thread is joined before
+ *  returning, also when an exception leaves the function
+ * Inputs:  ranges      - Ranges from SplitBlocks
+ *          function    - Range worker
+ * Returns: void
+ ********************************************************************/
+template <typename Function>
+void ParallelBlocks(const std::vector<BlockRange>& ranges, Function function)
+{
+    /* jthreads join on destruction, so the threads started so far are joined while an exception unwinds too */
+    std::vector<std::jthread> threads;
+    threads.reserve(ranges.size() - 1);
+    for (size_t range = 0; range + 1 < ranges.size(); ++range)
+    {
+        threads.emplace_back(function, range, ranges[range].first, ranges[range].count);
+    }
+    function(ranges.size() - 1, ranges.back().first, ranges.back().count);
+}
+
+/********************************************************************
+ * Function: EcbEncrypt
+ * Description:
+ *  Function to encrypt consecutive blocks in ECB mode. Every block is
+ *  independent, so the blocks are spread over the threads. input and
+ *  output may be the same buffer
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be encrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Encrypted blocks
+ * Returns: void
+ ********************************************************************/
+void EcbEncrypt(const EcbKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    ParallelBlocks(SplitBlocks(blocksNumber), [&key, input, output](size_t, size_t first, size_t count)
+    {
+        for (size_t i = first; i < first + count; ++i)
         {
-            for (int row = 0; row < 4; ++row) 
-            {
-                 cout << hex << setw(2) << setfill('0') << (int)plaintext[i][col][row] << " ";
-            }
-            cout << "\n";
+            AESEncrypt(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
         }
-        cout << "\n";
-    }
-    // Encrypt the plaintext
-    AESEncrypt(plaintext, ciphertext, roundKeys);
-    
-    // Decrypt the ciphertext
-    AESDecrypt(ciphertext, decryptedText, roundKeys);
-    
-    // Output the result
-    cout << "Plaintext: ";
-    for (int i = 0; i < 16; ++i) {
-        cout << hex << setw(2) << setfill('0') << (int)plaintext[i] << " ";
+    });
+}
+
+/********************************************************************
+ * Function: EcbDecrypt
+ * Description:
+ *  Function to decrypt consecutive blocks in ECB mode, spread over
+ *  the threads like EcbEncrypt. input and output may be the same
+ *  buffer
+ * Inputs:  key             - Expanded key
+ *          input           - Blocks to be decrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Decrypted blocks
+ * Returns: void
+ ********************************************************************/
+void EcbDecrypt(const EcbKey& key, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    ParallelBlocks(SplitBlocks(blocksNumber), [&key, input, output](size_t, size_t first, size_t count)
+    {
+        for (size_t i = first; i < first + count; ++i)
+        {
+            AESDecrypt(key, input + i * BLOCK_SIZE, output + i * BLOCK_SIZE);
+        }
+    });
+}
+
+/********************************************************************
+ * Function: CbcEncrypt
+ * Description:
+ *  Function to encrypt consecutive blocks in CBC mode. Every block
+ *  is chained to the previous ciphertext block, so encryption is
+ *  inherently sequential. input and output may be the same buffer
+ * Inputs:  key             - Expanded key
+ *          iv              - Initialization vector (16 bytes)
+ *          input           - Blocks to be encrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Encrypted blocks
+ * Returns: void
+ ********************************************************************/
+void CbcEncrypt(const EcbKey& key, const uint8_t* iv, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    uint8_t chain[BLOCK_SIZE];
+    std::memcpy(chain, iv, BLOCK_SIZE);
+    for (size_t i = 0; i < blocksNumber; ++i)
+    {
+        for (size_t j = 0; j < BLOCK_SIZE; ++j)
+        {
+            chain[j] ^= input[i * BLOCK_SIZE + j];
+        }
+        AESEncrypt(key, chain, chain);
+        std::memcpy(output + i * BLOCK_SIZE, chain, BLOCK_SIZE);
     }
-    cout << endl;
-    
-    cout << "Ciphertext: ";
-    for (int i = 0; i < 16; ++i) {
-        cout << hex << setw(2) << setfill('0') << (int)ciphertext[i] << " ";
+}
+
+/********************************************************************
+ * Function: CbcDecrypt
+ * Description:
+ *  Function to decrypt consecutive blocks in CBC mode. Plaintext
+ *  block i is D(C[i]) ^ C[i - 1] and only depends on ciphertext, so
+ *  the blocks are spread over the threads. The ciphertext block
+ *  preceding every range is saved before any thread starts, which
+ *  keeps in-place decryption (input == output) correct across the
+ *  range boundaries; inside a range the previous ciphertext block is
+ *  carried in a local copy
+ * Inputs:  key             - Expanded key
+ *          iv              - Initialization vector (16 bytes)
+ *          input           - Blocks to be decrypted
+ *          blocksNumber    - Number of blocks
+ * Outputs: output          - Decrypted blocks
+ * Returns: void
+ ********************************************************************/
+void CbcDecrypt(const EcbKey& key, const uint8_t* iv, const uint8_t* input, uint8_t* output, size_t blocksNumber)
+{
+    /* Ciphertext block preceding every range, saved before any range is decrypted in place */
+    std::vector<BlockRange> ranges = SplitBlocks(blocksNumber);
+    std::vector<std::array<uint8_t, BLOCK_SIZE>> boundaries(ranges.size());
+    for (size_t range = 0; range < ranges.size(); ++range)
+    {
+        const uint8_t* previous = (ranges[range].first == 0) ? iv : input + (ranges[range].first - 1) * BLOCK_SIZE;
+        std::memcpy(boundaries[range].data(), previous, BLOCK_SIZE);
     }
-    cout << endl;
-    
-    cout << "Decrypted text: ";
-    for (int i = 0; i < 16; ++i) {
-        cout << hex << setw(2) << setfill('0') << (int)decryptedText[i] << " ";
+
+    ParallelBlocks(ranges, [&](size_t range, size_t first, size_t count)
+    {
+        uint8_t chain[BLOCK_SIZE];
+        uint8_t cipherBlock[BLOCK_SIZE];
+        std::memcpy(chain, boundaries[range].data(), BLOCK_SIZE);
+
+        for (size_t i = first; i < first + count; ++i)
+        {
+            std::memcpy(cipherBlock, input + i * BLOCK_SIZE, BLOCK_SIZE);
+            AESDecrypt(key, cipherBlock, output + i * BLOCK_SIZE);
+            for (size_t j = 0; j < BLOCK_SIZE; ++j)
+            {
+                output[i * BLOCK_SIZE + j] ^= chain[j];
+            }
+            std::memcpy(chain, cipherBlock, BLOCK_SIZE);
+        }
+    });
+}
+
+/********************************************************************
+ ************************ Printing Functions ************************
+ ********************************************************************/
+/* Function to print blocks as hex, one line per block after the label */
+void PrintBlocks(const char* label, const uint8_t* blocks, size_t blocksNumber)
+{
+    cout << label;
+    for (size_t i = 0; i < blocksNumber * BLOCK_SIZE; ++i) {
+        if ((i != 0) && (i % BLOCK_SIZE == 0)) {
+            cout << "\n" << setw(static_cast<int>(strlen(label))) << setfill(' ') << "";
+        }
+        cout << hex << setw(2) << setfill('0') << static_cast<int>(blocks[i]) << " ";
     }
     cout << endl;
-
-    return 0;
-}
\ No newline at end of file
+}
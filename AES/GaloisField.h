@@ -0,0 +1,192 @@
+#ifndef AES_GALOIS_FIELD_H
+#define AES_GALOIS_FIELD_H
+
+#include <cstdint>
+#include <array>
+
+/********************************************************************
+ * GF(2^8) arithmetic and the (Inv)MixColumns steps shared by
+ * AES_CTR.cpp and AES_ECB.cpp
+ *
+ * In AES we perform operations in GF(2^8) ensuring that each number
+ * can be represented by a single byte. The irreducable polynomial
+ * defined by AES NIST is m(x) = x^8 + x^4 + x^3 + x + 1 which
+ * corresponds to {01}{1b} in hex format. Everything below is either
+ * generated at compile time or branch-free, so the software backends
+ * never run the bit-serial multiplication loop at runtime.
+ ********************************************************************/
+
+/********************************************************************
+ * Function: GaloisFieldXtime
+ * Description:
+ *  Multiplication by x ({02}) in GF(2^8). The reduction by m(x) is
+ *  applied through a mask built from the MSB instead of a branch
+ * Inputs:  value   - Byte to be multiplied
+ * Returns: value * {02} in GF(2^8)
+ ********************************************************************/
+constexpr uint8_t GaloisFieldXtime(uint8_t value)
+{
+    return static_cast<uint8_t>((value << 1) ^ (0x1b & (0U - (value >> 7))));
+}
+
+/********************************************************************
+ * Function: GaloisFieldMultiplyBitwise
+ * Description:
+ *  Compile-time GF(2^8) multiplication by distributing the first
+ *  operand over the bits of the second one. It is only used to
+ *  generate the tables below
+ * Inputs:  firstOperand    - First operand to GF multiplication
+ *          secondOperand   - Second operand to GF multiplication
+ * Returns: firstOperand * secondOperand in GF(2^8)
+ ********************************************************************/
+constexpr uint8_t GaloisFieldMultiplyBitwise(uint8_t firstOperand, uint8_t secondOperand)
+{
+    uint8_t result = 0;
+    while (secondOperand)
+    {
+        if (secondOperand & 1)
+        {
+            result ^= firstOperand;
+        }
+        firstOperand = GaloisFieldXtime(firstOperand);
+        secondOperand >>= 1;
+    }
+    return result;
+}
+
+/********************************************************************
+ * Function: GenerateMultiplicationTable
+ * Description:
+ *  Compile-time generation of the table of the products of every
+ *  byte by a fixed factor
+ * Inputs:  factor  - Fixed factor
+ * Returns: The 256-entry table, entry x holding x * factor
+ ********************************************************************/
+constexpr std::array<uint8_t, 256> GenerateMultiplicationTable(uint8_t factor)
+{
+    std::array<uint8_t, 256> table{};
+    for (int x = 0; x < 256; ++x)
+    {
+        table[x] = GaloisFieldMultiplyBitwise(static_cast<uint8_t>(x), factor);
+    }
+    return table;
+}
+
+/* Products by the MixColumns ({02}, {03}) and InvMixColumns ({09}, {0b}, {0d}, {0e}) coefficients */
+inline constexpr std::array<uint8_t, 256> gfMul2  = GenerateMultiplicationTable(0x02);
+inline constexpr std::array<uint8_t, 256> gfMul3  = GenerateMultiplicationTable(0x03);
+inline constexpr std::array<uint8_t, 256> gfMul9  = GenerateMultiplicationTable(0x09);
+inline constexpr std::array<uint8_t, 256> gfMul11 = GenerateMultiplicationTable(0x0b);
+inline constexpr std::array<uint8_t, 256> gfMul13 = GenerateMultiplicationTable(0x0d);
+inline constexpr std::array<uint8_t, 256> gfMul14 = GenerateMultiplicationTable(0x0e);
+
+/********************************************************************
+ * Function: GaloisFieldXtimeWord
+ * Description:
+ *  Branch-free multiplication by {02} of the four bytes of a 32-bit
+ *  word at once
+ * Inputs:  word    - Four bytes to be multiplied
+ * Returns: Each byte of word multiplied by {02}
+ ********************************************************************/
+inline uint32_t GaloisFieldXtimeWord(uint32_t word)
+{
+    return ((word & 0x7f7f7f7fU) << 1) ^ (((word >> 7) & 0x01010101U) * 0x1bU);
+}
+
+/********************************************************************
+ * Function: RotateWordLeft
+ * Description:
+ *  Rotation of a 32-bit column word by a number of bytes
+ * Inputs:  word    - Column word
+ *          bytes   - Number of bytes (1 to 3)
+ * Returns: The rotated word
+ ********************************************************************/
+inline uint32_t RotateWordLeft(uint32_t word, int bytes)
+{
+    return (word << (8 * bytes)) | (word >> (32 - 8 * bytes));
+}
+
+/********************************************************************
+ * Function: MixColumnWord
+ * Description:
+ *  MixColumns of one column packed in a 32-bit word, row 0 in the
+ *  most significant byte. Row i becomes
+ *  {02}a[i] ^ {03}a[i+1] ^ a[i+2] ^ a[i+3]
+ *  = xtime(a[i] ^ a[i+1]) ^ a[i+1] ^ a[i+2] ^ a[i+3],
+ *  computed for the four rows at once with byte rotations
+ * Inputs:  column  - Column word
+ * Returns: The mixed column word
+ ********************************************************************/
+inline uint32_t MixColumnWord(uint32_t column)
+{
+    uint32_t rotated = RotateWordLeft(column, 1);
+    return GaloisFieldXtimeWord(column ^ rotated) ^ rotated ^ RotateWordLeft(column, 2) ^ RotateWordLeft(column, 3);
+}
+
+/********************************************************************
+ * Function: InvMixColumnWord
+ * Description:
+ *  InvMixColumns of one column packed in a 32-bit word. The inverse
+ *  matrix factors into MixColumns after adding {04}(a[i] ^ a[i+2])
+ *  to every row, which only needs two more xtime steps
+ * Inputs:  column  - Column word
+ * Returns: The unmixed column word
+ ********************************************************************/
+inline uint32_t InvMixColumnWord(uint32_t column)
+{
+    uint32_t correction = GaloisFieldXtimeWord(GaloisFieldXtimeWord(column ^ RotateWordLeft(column, 2)));
+    return MixColumnWord(column ^ correction);
+}
+
+/********************************************************************
+ * Function: MixColumns
+ * Description:
+ *  This function performs AES Mix Columns steps by multipying
+ *  the fixed polynomial matrix defined by AES NIST by the input
+ *  state. Essentially, it performs 4x4 matrix multiplication in
+ *  GF(2^8), done column by column on 32-bit words with row 0 as the
+ *  most significant byte (see MixColumnWord)
+ * Inputs:  state   - Refernece to Input State Matrix (4x4)
+ * Outputs: state   - Refernece to Output State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+inline void MixColumns(uint8_t state[4][4])
+{
+    for (int col = 0; col < 4; ++col)
+    {
+        uint32_t column = (static_cast<uint32_t>(state[0][col]) << 24) | (static_cast<uint32_t>(state[1][col]) << 16) |
+                          (static_cast<uint32_t>(state[2][col]) << 8) | static_cast<uint32_t>(state[3][col]);
+        column = MixColumnWord(column);
+        for (int row = 0; row < 4; ++row)
+        {
+            state[row][col] = static_cast<uint8_t>(column >> (24 - 8 * row));
+        }
+    }
+}
+
+/********************************************************************
+ * Function: InvMixColumns
+ * Description:
+ *  This function performs AES Inverse Mix Columns steps by multipying
+ *  the inverse of the fixed polynomial matrix defined by AES NIST
+ *  by the input state, column by column on 32-bit words (see
+ *  InvMixColumnWord)
+ * Inputs:  state   - Refernece to Input State Matrix (4x4)
+ * Outputs: state   - Refernece to Output State Matrix (4x4)
+ * Returns: void
+ ********************************************************************/
+inline void InvMixColumns(uint8_t state[4][4])
+{
+    for (int col = 0; col < 4; ++col)
+    {
+        uint32_t column = (static_cast<uint32_t>(state[0][col]) << 24) | (static_cast<uint32_t>(state[1][col]) << 16) |
+                          (static_cast<uint32_t>(state[2][col]) << 8) | static_cast<uint32_t>(state[3][col]);
+        column = InvMixColumnWord(column);
+        for (int row = 0; row < 4; ++row)
+        {
+            state[row][col] = static_cast<uint8_t>(column >> (24 - 8 * row));
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,368 @@
+/*********************************************************************
+ * @file AES_CTR_Benchmark.cpp
+ * @brief
+ *        Throughput and latency benchmark of the AES CTR engine of
+ *        AES_CTR.cpp. Every combination of message size, number of
+ *        worker threads, backend and key size is timed through the
+ *        same StatesDispatcher used by the program, and the results
+ *        are written as JSON.
+ *
+ *        Build: g++ -std=c++20 -O2 AES_CTR_Benchmark.cpp -lpthread
+ *        Usage: AES_CTR_Benchmark [--min-size N] [--max-size N]
+ *                                 [--max-threads N] [--output file]
+ ********************************************************************/
+/********************************************************************
+ ************************** Included ********************************
+ ********************************************************************/
+/* The engine is compiled in as is, its interactive main is renamed out of the way */
+#define main AesCtrMain
+#include "../AES_CTR.cpp"
+#undef main
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+/********************************************************************
+ *********************** Configurations *****************************
+ ********************************************************************/
+/* Smallest and largest message sizes of the sweep, the size is multiplied by BENCH_SIZE_STEP between points */
+#define BENCH_MIN_SIZE          (16ULL)
+#define BENCH_MAX_SIZE          (4ULL * 1024ULL * 1024ULL * 1024ULL)
+#define BENCH_SIZE_STEP         (4ULL)
+/* Bytes processed per measurement point, small messages are repeated until they add up to it */
+#define BENCH_TARGET_BYTES      (64ULL * 1024ULL * 1024ULL)
+/* Bounds on the number of timed calls per measurement point */
+#define BENCH_MIN_ITERATIONS    (3ULL)
+#define BENCH_MAX_ITERATIONS    (100000ULL)
+/* Untimed calls made before every measurement point */
+#define BENCH_WARMUP_ITERATIONS (2ULL)
+
+/********************************************************************
+ ***************************** Types ********************************
+ ********************************************************************/
+/* Results of one measurement point */
+struct BenchmarkResult
+{
+    AesBackend backend;
+    size_t keySize;
+    size_t threadsNumber;
+    uint64_t messageSize;
+    uint64_t iterations;
+    double cyclesPerByte;
+    double gigabytesPerSecond;
+    double latencyP50;
+    double latencyP99;
+};
+
+/* Command line settings of the sweep */
+struct BenchmarkSettings
+{
+    uint64_t minSize;
+    uint64_t maxSize;
+    size_t maxThreads;
+    std::string outputPath;
+};
+
+/********************************************************************
+ ************************* Prototypes *******************************
+ ********************************************************************/
+uint64_t ReadTimestampCounter();
+const char* BackendName(AesBackend backend);
+std::vector<AesBackend> AvailableBackends();
+std::vector<size_t> ThreadCounts(size_t maxThreads);
+double Percentile(std::vector<double>& samples, double percentile);
+BenchmarkResult MeasurePoint(WorkerPool& pool, const AesKey& key, BlockBuffer& buffer, uint64_t messageSize);
+void ParseSettings(int argc, char* argv[], BenchmarkSettings& settings);
+void WriteJson(std::ostream& output, const std::vector<BenchmarkResult>& results);
+
+/********************************************************************
+ ************************* Main Function ****************************
+ ********************************************************************/
+int main(int argc, char* argv[])
+{
+    BenchmarkSettings settings;
+    ParseSettings(argc, argv, settings);
+
+    /* One buffer for the largest message, processed in place so 4 GB messages only need 4 GB */
+    BlockBuffer buffer;
+    try
+    {
+        buffer.Resize(settings.maxSize);
+    }
+    catch (const std::bad_alloc&)
+    {
+        std::cerr << "Cannot allocate " << settings.maxSize << " bytes, lower --max-size" << std::endl;
+        return 1;
+    }
+    std::mt19937_64 generator(1);
+    for (size_t i = 0; i < buffer.Length(); i += sizeof(uint64_t))
+    {
+        uint64_t value = generator();
+        std::memcpy(buffer.Data() + i, &value, std::min<size_t>(sizeof(value), buffer.Length() - i));
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (size_t threadsNumber : ThreadCounts(settings.maxThreads))
+    {
+        /* A dedicated pool per thread count, the engine's own pool has a fixed size */
+        WorkerPool pool(threadsNumber);
+
+        for (AesBackend backend : AvailableBackends())
+        {
+            for (size_t keySize : {16U, 24U, 32U})
+            {
+                AesKey key(exampleKey, keySize, backend);
+
+                for (uint64_t messageSize = settings.minSize; messageSize <= settings.maxSize; messageSize *= BENCH_SIZE_STEP)
+                {
+                    BenchmarkResult result = MeasurePoint(pool, key, buffer, messageSize);
+                    result.threadsNumber = threadsNumber;
+                    results.push_back(result);
+
+                    std::cerr << BackendName(backend) << " AES-" << 8 * keySize << " threads=" << threadsNumber
+                              << " size=" << messageSize << ": " << std::fixed << std::setprecision(2)
+                              << result.cyclesPerByte << " cycles/byte, " << result.gigabytesPerSecond << " GB/s" << std::endl;
+                }
+            }
+        }
+    }
+
+    if (settings.outputPath.empty())
+    {
+        WriteJson(std::cout, results);
+    }
+    else
+    {
+        std::ofstream output(settings.outputPath);
+        if (!output)
+        {
+            std::cerr << "Cannot open " << settings.outputPath << std::endl;
+            return 1;
+        }
+        WriteJson(output, results);
+    }
+    return 0;
+}
+
+/********************************************************************
+ ********************** Measurement Functions ***********************
+ ********************************************************************/
+/********************************************************************
+ * Function: ReadTimestampCounter
+ * Description:
+ *  Read the time stamp counter. On x86 it counts reference cycles at
+ *  the nominal frequency, elsewhere the steady clock in nanoseconds
+ *  is returned instead
+ * Returns: Current counter value
+ ********************************************************************/
+uint64_t ReadTimestampCounter()
+{
+#if AES_X86
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/* Function to get the name of a backend as written in the report */
+const char* BackendName(AesBackend backend)
+{
+    switch (backend)
+    {
+    case AesBackend::Reference:
+        return "reference";
+    case AesBackend::TTable:
+        return "ttable";
+    case AesBackend::AesNi:
+        return "aesni";
+    case AesBackend::Bitsliced:
+        return "bitsliced";
+    default:
+        return "automatic";
+    }
+}
+
+/********************************************************************
+ * Function: AvailableBackends
+ * Description:
+ *  Function to list the backends runnable on this machine. AES-NI
+ *  is skipped when the CPU lacks it, since SelectAesBackend would
+ *  silently measure a software backend under its name
+ * Returns: The backends to be measured
+ ********************************************************************/
+std::vector<AesBackend> AvailableBackends()
+{
+    std::vector<AesBackend> backends = {AesBackend::Reference, AesBackend::TTable, AesBackend::Bitsliced};
+    if (GetCpuFeatures().aesNi)
+    {
+        backends.push_back(AesBackend::AesNi);
+    }
+    return backends;
+}
+
+/********************************************************************
+ * Function: ThreadCounts
+ * Description:
+ *  Function to list the thread counts of the sweep: the powers of
+ *  two up to maxThreads, plus maxThreads itself. maxThreads defaults
+ *  to the CPUs usable by the process
+ * Inputs:  maxThreads  - Largest number of threads
+ * Returns: The thread counts to be measured
+ ********************************************************************/
+std::vector<size_t> ThreadCounts(size_t maxThreads)
+{
+    std::vector<size_t> counts;
+    for (size_t threadsNumber = 1; threadsNumber < maxThreads; threadsNumber *= 2)
+    {
+        counts.push_back(threadsNumber);
+    }
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+/* Function to get a percentile (0 to 100) of the samples by the nearest-rank method, the samples are reordered */
+double Percentile(std::vector<double>& samples, double percentile)
+{
+    size_t rank = static_cast<size_t>(percentile / 100.0 * static_cast<double>(samples.size()) + 0.5);
+    rank = std::clamp<size_t>(rank, 1, samples.size());
+    std::nth_element(samples.begin(), samples.begin() + (rank - 1), samples.end());
+    return samples[rank - 1];
+}
+
+/********************************************************************
+ * Function: MeasurePoint
+ * Description:
+ *  Function to time repeated CTR calls over the first messageSize
+ *  bytes of the buffer. Every call is timed on its own for the
+ *  latency percentiles, while the cycles per byte and the throughput
+ *  are taken over all the timed calls together
+ * Inputs:  pool        - Worker pool running the ranges
+ *          key         - Expanded key selecting the backend
+ *          buffer      - Message buffer, encrypted in place
+ *          messageSize - Number of bytes per call
+ * Returns: The measured point (threadsNumber is left to the caller)
+ ********************************************************************/
+BenchmarkResult MeasurePoint(WorkerPool& pool, const AesKey& key, BlockBuffer& buffer, uint64_t messageSize)
+{
+    BenchmarkResult result{};
+    result.backend = key.Backend();
+    result.keySize = key.KeySize();
+    result.messageSize = messageSize;
+    result.iterations = std::clamp<uint64_t>(BENCH_TARGET_BYTES / messageSize, BENCH_MIN_ITERATIONS, BENCH_MAX_ITERATIONS);
+
+    ConstBlockView states(buffer.Data(), messageSize);
+    BlockView outputStates{buffer.Data(), states.blocksNumber, messageSize};
+    CounterBlock counter{};
+
+    for (uint64_t i = 0; i < BENCH_WARMUP_ITERATIONS; ++i)
+    {
+        StatesDispatcher(pool, key, states, counter, outputStates);
+    }
+
+    std::vector<double> latencies(result.iterations);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startCycles = ReadTimestampCounter();
+    for (uint64_t i = 0; i < result.iterations; ++i)
+    {
+        auto callStart = std::chrono::steady_clock::now();
+        StatesDispatcher(pool, key, states, counter, outputStates);
+        latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - callStart).count();
+    }
+    uint64_t cycles = ReadTimestampCounter() - startCycles;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double totalBytes = static_cast<double>(messageSize) * static_cast<double>(result.iterations);
+    result.cyclesPerByte = static_cast<double>(cycles) / totalBytes;
+    result.gigabytesPerSecond = totalBytes / seconds / 1e9;
+    result.latencyP50 = Percentile(latencies, 50.0);
+    result.latencyP99 = Percentile(latencies, 99.0);
+    return result;
+}
+
+/********************************************************************
+ ************************* Report Functions *************************
+ ********************************************************************/
+/********************************************************************
+ * Function: ParseSettings
+ * Description:
+ *  Function to read the command line into the sweep settings. Sizes
+ *  are in bytes, unknown options abort the program
+ * Inputs:  argc, argv  - Command line
+ * Outputs: settings    - Sweep settings
+ * Returns: void
+ ********************************************************************/
+void ParseSettings(int argc, char* argv[], BenchmarkSettings& settings)
+{
+    settings.minSize = BENCH_MIN_SIZE;
+    settings.maxSize = BENCH_MAX_SIZE;
+    settings.maxThreads = DetectCpuCount();
+    settings.outputPath.clear();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+        {
+            throw std::invalid_argument("Missing value for " + option);
+        }
+        std::string value = argv[++i];
+
+        if (option == "--min-size")
+        {
+            settings.minSize = std::stoull(value);
+        }
+        else if (option == "--max-size")
+        {
+            settings.maxSize = std::stoull(value);
+        }
+        else if (option == "--max-threads")
+        {
+            settings.maxThreads = std::stoul(value);
+        }
+        else if (option == "--output")
+        {
+            settings.outputPath = value;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown option " + option);
+        }
+    }
+
+    if ((settings.minSize == 0) || (settings.minSize > settings.maxSize) || (settings.maxThreads == 0))
+    {
+        throw std::invalid_argument("Invalid benchmark settings");
+    }
+}
+
+/* Function to write the results as a JSON document */
+void WriteJson(std::ostream& output, const std::vector<BenchmarkResult>& results)
+{
+    const CpuFeatures& features = GetCpuFeatures();
+
+    output << std::fixed << std::setprecision(4);
+    output << "{\n";
+    output << "  \"cpu\": {\"aesni\": " << (features.aesNi ? "true" : "false")
+           << ", \"avx2\": " << (features.avx2 ? "true" : "false")
+           << ", \"pclmul\": " << (features.pclmul ? "true" : "false")
+           << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << "},\n";
+    output << "  \"cycle_source\": \"" << (AES_X86 ? "rdtsc" : "steady_clock_ns") << "\",\n";
+    output << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchmarkResult& result = results[i];
+        output << ((i == 0) ? "\n" : ",\n");
+        output << "    {\"backend\": \"" << BackendName(result.backend) << "\""
+               << ", \"key_bits\": " << 8 * result.keySize
+               << ", \"threads\": " << result.threadsNumber
+               << ", \"message_bytes\": " << result.messageSize
+               << ", \"iterations\": " << result.iterations
+               << ", \"cycles_per_byte\": " << result.cyclesPerByte
+               << ", \"gb_per_s\": " << result.gigabytesPerSecond
+               << ", \"latency_p50_us\": " << result.latencyP50
+               << ", \"latency_p99_us\": " << result.latencyP99 << "}";
+    }
+    output << "\n  ]\n}" << std::endl;
+}
@@ -0,0 +1,608 @@
+/*********************************************************************
+ * @file AES_CTR_Test.cpp
+ * @brief
+ *        Known-answer and consistency test of the block backends and
+ *        the CTR engine of AES_CTR.cpp. Every backend available on
+ *        the machine is checked at every key size against:
+ *          - FIPS-197 appendix C.1-C.3 (single block encrypt/decrypt)
+ *          - SP 800-38A F.5.1, F.5.3 and F.5.5 (CTR-AES128/192/256)
+ *          - the reference backend on 1 to 19 blocks, which covers
+ *            every tail of the interleaved multi-block kernels
+ *          - a counter whose low 64 bits carry into the nonce
+ *        and AesCtrStream split updates, Seek and DecryptRange are
+ *        checked against one-shot encryption of the same message.
+ *        The streaming pipeline must match it too, and must join its
+ *        reader and writer threads when the middle stage throws.
+ *
+ *        Build: g++ -std=c++20 -O2 AES_CTR_Test.cpp -lpthread
+ *        Usage: AES_CTR_Test (returns 0 when every check passes)
+ ********************************************************************/
+/********************************************************************
+ ************************** Included ********************************
+ ********************************************************************/
+/* The engine is compiled in as is, its interactive main is renamed out of the way */
+#define main AesCtrMain
+#include "../AES_CTR.cpp"
+#undef main
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+/********************************************************************
+ *********************** Configurations *****************************
+ ********************************************************************/
+/* Largest number of blocks of the tail test, above two full interleave groups of every kernel */
+#define TEST_MAX_TAIL_BLOCKS    (19U)
+/* Length of the messages of the stream and random-access tests */
+#define TEST_MESSAGE_SIZE       (300007U)
+/* Number of random splits, seeks and ranges tried on the message */
+#define TEST_RANDOM_ITERATIONS  (200U)
+/* Time given to a pipeline to return before the test declares its threads stuck */
+#define TEST_PIPELINE_TIMEOUT   (std::chrono::seconds(60))
+
+/********************************************************************
+ ***************************** Types ********************************
+ ********************************************************************/
+/* One single-block known answer, every field in hex */
+struct BlockTestCase
+{
+    const char* name;
+    const char* key;
+    const char* plainText;
+    const char* cipherText;
+};
+
+/* One CTR known answer, every field in hex */
+struct CtrTestCase
+{
+    const char* name;
+    const char* key;
+    const char* counter;
+    const char* plainText;
+    const char* cipherText;
+};
+
+/********************************************************************
+ **************************** GLOBALS *******************************
+ ********************************************************************/
+/* FIPS-197 appendix C */
+const BlockTestCase blockTestCases[] =
+{
+    {"FIPS-197 C.1 AES-128",
+     "000102030405060708090a0b0c0d0e0f",
+     "00112233445566778899aabbccddeeff",
+     "69c4e0d86a7b0430d8cdb78070b4c55a"},
+    {"FIPS-197 C.2 AES-192",
+     "000102030405060708090a0b0c0d0e0f1011121314151617",
+     "00112233445566778899aabbccddeeff",
+     "dda97ca4864cdfe06eaf70a0ec0d7191"},
+    {"FIPS-197 C.3 AES-256",
+     "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+     "00112233445566778899aabbccddeeff",
+     "8ea2b7ca516745bfeafc49904b496089"},
+};
+
+/* SP 800-38A appendix F.5 */
+const CtrTestCase ctrTestCases[] =
+{
+    {"SP 800-38A F.5.1 CTR-AES128",
+     "2b7e151628aed2a6abf7158809cf4f3c",
+     "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+     "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+     "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+     "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff"
+     "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"},
+    {"SP 800-38A F.5.3 CTR-AES192",
+     "8e73b0f7da0e6452c810f32b809079e562f8ead2522c6b7b",
+     "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+     "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+     "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+     "1abc932417521ca24f2b0459fe7e6e0b090339ec0aa6faefd5ccc2c6f4ce8e94"
+     "1e36b26bd1ebc670d1bd1d665620abf74f78a7f6d29809585a97daec58c6b050"},
+    {"SP 800-38A F.5.5 CTR-AES256",
+     "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4",
+     "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+     "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+     "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+     "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+     "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6"},
+};
+
+/********************************************************************
+ ************************* Prototypes *******************************
+ ********************************************************************/
+std::vector<uint8_t> HexToBytes(const char* hex);
+const char* BackendName(AesBackend backend);
+BlockView OutputView(std::vector<uint8_t>& output);
+void ReferenceCtr(const uint8_t* key, size_t keySize, const CounterBlock& counter, const uint8_t* input, uint8_t* output, size_t length);
+bool Report(bool passed, const std::string& name);
+size_t TestBlockVectors(AesBackend backend);
+size_t TestCtrVectors(AesBackend backend);
+size_t TestTails(AesBackend backend);
+size_t TestCounterCarry(AesBackend backend);
+size_t TestStream();
+size_t TestPipeline();
+
+/********************************************************************
+ ************************* Main Function ****************************
+ ********************************************************************/
+int main()
+{
+    /* Backends missing on this CPU are skipped, the engine would silently run a software one instead */
+    std::vector<AesBackend> backends = {AesBackend::Reference, AesBackend::TTable, AesBackend::Bitsliced};
+    if (GetCpuFeatures().aesNi)
+    {
+        backends.push_back(AesBackend::AesNi);
+    }
+    else
+    {
+        std::cout << "Skipped the AES-NI backend this CPU lacks" << std::endl;
+    }
+
+    size_t failures = 0;
+    for (AesBackend backend : backends)
+    {
+        failures += TestBlockVectors(backend);
+        failures += TestCtrVectors(backend);
+        failures += TestTails(backend);
+        failures += TestCounterCarry(backend);
+    }
+    failures += TestStream();
+    failures += TestPipeline();
+
+    std::cout << ((failures == 0) ? "All CTR tests passed" : "Some CTR tests failed") << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
+
+/********************************************************************
+ ********************** Helper Functions ****************************
+ ********************************************************************/
+/********************************************************************
+ * Function: HexToBytes
+ * Description:
+ *  Function to decode a test vector field from hex
+ * Inputs:  hex - Hex digits (an even number of them)
+ * Returns: The decoded bytes
+ ********************************************************************/
+std::vector<uint8_t> HexToBytes(const char* hex)
+{
+    size_t length = std::strlen(hex);
+    std::vector<uint8_t> bytes(length / 2);
+    if (((length % 2) != 0) || !HexDecode(hex, length, bytes.data()))
+    {
+        throw std::invalid_argument(std::string("Malformed test vector ") + hex);
+    }
+    return bytes;
+}
+
+/* Function to get the name of a backend as printed in the report */
+const char* BackendName(AesBackend backend)
+{
+    switch (backend)
+    {
+    case AesBackend::Reference:
+        return "reference";
+    case AesBackend::TTable:
+        return "ttable";
+    case AesBackend::AesNi:
+        return "aesni";
+    case AesBackend::Bitsliced:
+        return "bitsliced";
+    default:
+        return "automatic";
+    }
+}
+
+/* Function to view a byte vector as output states */
+BlockView OutputView(std::vector<uint8_t>& output)
+{
+    return BlockView{output.data(), (output.size() + BLOCK_SIZE - 1) / BLOCK_SIZE, output.size()};
+}
+
+/********************************************************************
+ * Function: ReferenceCtr
+ * Description:
+ *  Straightforward CTR used as the expected result: one block at a
+ *  time through the reference backend, the counter advanced with
+ *  IncrementCounter
+ * Inputs:  key         - Key bytes
+ *          keySize     - Key size in bytes
+ *          counter     - Counter of the first block
+ *          input       - Data to be processed
+ *          length      - Number of bytes
+ * Outputs: output      - Processed data
+ * Returns: void
+ ********************************************************************/
+void ReferenceCtr(const uint8_t* key, size_t keySize, const CounterBlock& counter, const uint8_t* input, uint8_t* output, size_t length)
+{
+    AesKey referenceKey(key, keySize, AesBackend::Reference);
+    CounterBlock blockCounter = counter;
+    uint8_t keystream[BLOCK_SIZE];
+
+    for (size_t offset = 0; offset < length; offset += BLOCK_SIZE)
+    {
+        AesEncryptBlock(referenceKey, blockCounter.data(), keystream);
+        IncrementCounter(blockCounter);
+        for (size_t i = offset; i < std::min<size_t>(length, offset + BLOCK_SIZE); ++i)
+        {
+            output[i] = input[i] ^ keystream[i - offset];
+        }
+    }
+}
+
+/* Function to print the outcome of a check */
+bool Report(bool passed, const std::string& name)
+{
+    std::cout << (passed ? "PASS " : "FAIL ") << name << std::endl;
+    return passed;
+}
+
+/********************************************************************
+ *********************** Test Functions *****************************
+ ********************************************************************/
+/********************************************************************
+ * Function: TestBlockVectors
+ * Description:
+ *  Function to check single-block encryption and decryption of a
+ *  backend against FIPS-197 appendix C, alone and as the first
+ *  block of a multi-block call
+ * Inputs:  backend - Backend under test
+ * Returns: Number of failed checks
+ ********************************************************************/
+size_t TestBlockVectors(AesBackend backend)
+{
+    size_t failures = 0;
+    for (const BlockTestCase& testCase : blockTestCases)
+    {
+        std::vector<uint8_t> key = HexToBytes(testCase.key);
+        std::vector<uint8_t> plainText = HexToBytes(testCase.plainText);
+        std::vector<uint8_t> cipherText = HexToBytes(testCase.cipherText);
+        AesKey aesKey(key.data(), key.size(), backend);
+
+        uint8_t output[BLOCK_SIZE];
+        AesEncryptBlock(aesKey, plainText.data(), output);
+        bool passed = (std::memcmp(output, cipherText.data(), BLOCK_SIZE) == 0);
+        AesDecryptBlock(aesKey, cipherText.data(), output);
+        passed = passed && (std::memcmp(output, plainText.data(), BLOCK_SIZE) == 0);
+
+        /* The same block repeated goes through the multi-block kernels */
+        std::vector<uint8_t> blocks(TEST_MAX_TAIL_BLOCKS * BLOCK_SIZE);
+        std::vector<uint8_t> encrypted(blocks.size());
+        for (size_t i = 0; i < TEST_MAX_TAIL_BLOCKS; ++i)
+        {
+            std::memcpy(blocks.data() + i * BLOCK_SIZE, plainText.data(), BLOCK_SIZE);
+        }
+        AesEncryptBlocks(aesKey, blocks.data(), encrypted.data(), TEST_MAX_TAIL_BLOCKS);
+        for (size_t i = 0; i < TEST_MAX_TAIL_BLOCKS; ++i)
+        {
+            passed = passed && (std::memcmp(encrypted.data() + i * BLOCK_SIZE, cipherText.data(), BLOCK_SIZE) == 0);
+        }
+        AesDecryptBlocks(aesKey, encrypted.data(), encrypted.data(), TEST_MAX_TAIL_BLOCKS);
+        passed = passed && (encrypted == blocks);
+
+        failures += Report(passed, std::string(testCase.name) + " [" + BackendName(backend) + "]") ? 0 : 1;
+    }
+    return failures;
+}
+
+/********************************************************************
+ * Function: TestCtrVectors
+ * Description:
+ *  Function to check the CTR engine of a backend against SP 800-38A
+ *  F.5 for every message length from 0 to the full 64 bytes, so
+ *  partial last blocks are covered, then decrypt the ciphertext back
+ * Inputs:  backend - Backend under test
+ * Returns: Number of failed checks
+ ********************************************************************/
+size_t TestCtrVectors(AesBackend backend)
+{
+    size_t failures = 0;
+    for (const CtrTestCase& testCase : ctrTestCases)
+    {
+        std::vector<uint8_t> key = HexToBytes(testCase.key);
+        std::vector<uint8_t> counterBytes = HexToBytes(testCase.counter);
+        std::vector<uint8_t> plainText = HexToBytes(testCase.plainText);
+        std::vector<uint8_t> cipherText = HexToBytes(testCase.cipherText);
+        AesKey aesKey(key.data(), key.size(), backend);
+        CounterBlock counter;
+        std::memcpy(counter.data(), counterBytes.data(), counter.size());
+
+        bool passed = true;
+        for (size_t length = 0; length <= plainText.size(); ++length)
+        {
+            std::vector<uint8_t> output(length);
+            EncryptionDispatcher(aesKey, ConstBlockView(plainText.data(), length), counter, OutputView(output));
+            passed = passed && std::equal(output.begin(), output.end(), cipherText.begin());
+
+            DecryptionDispatcher(aesKey, ConstBlockView(output.data(), length), counter, OutputView(output));
+            passed = passed && std::equal(output.begin(), output.end(), plainText.begin());
+        }
+
+        failures += Report(passed, std::string(testCase.name) + " [" + BackendName(backend) + "]") ? 0 : 1;
+    }
+    return failures;
+}
+
+/********************************************************************
+ * Function: TestTails
+ * Description:
+ *  Function to compare the CTR engine and the multi-block kernels
+ *  of a backend with the reference on 1 to TEST_MAX_TAIL_BLOCKS
+ *  blocks at every key size. The interleaved kernels process groups
+ *  of blocks and finish with a shorter tail, every tail length is
+ *  hit, with and without a partial last block
+ * Inputs:  backend - Backend under test
+ * Returns: Number of failed checks
+ ********************************************************************/
+size_t TestTails(AesBackend backend)
+{
+    std::mt19937 generator(1);
+    size_t failures = 0;
+
+    for (size_t keySize : {16U, 24U, 32U})
+    {
+        uint8_t key[32];
+        for (uint8_t& keyByte : key)
+        {
+            keyByte = static_cast<uint8_t>(generator());
+        }
+        AesKey aesKey(key, keySize, backend);
+        AesKey referenceKey(key, keySize, AesBackend::Reference);
+        CounterBlock counter;
+        for (uint8_t& counterByte : counter)
+        {
+            counterByte = static_cast<uint8_t>(generator());
+        }
+
+        bool passed = true;
+        for (size_t blocksNumber = 1; blocksNumber <= TEST_MAX_TAIL_BLOCKS; ++blocksNumber)
+        {
+            std::vector<uint8_t> input(blocksNumber * BLOCK_SIZE);
+            for (uint8_t& inputByte : input)
+            {
+                inputByte = static_cast<uint8_t>(generator());
+            }
+
+            /* Raw multi-block encryption and decryption */
+            std::vector<uint8_t> output(input.size());
+            std::vector<uint8_t> expected(input.size());
+            AesEncryptBlocks(aesKey, input.data(), output.data(), blocksNumber);
+            AesEncryptBlocks(referenceKey, input.data(), expected.data(), blocksNumber);
+            passed = passed && (output == expected);
+            AesDecryptBlocks(aesKey, input.data(), output.data(), blocksNumber);
+            AesDecryptBlocks(referenceKey, input.data(), expected.data(), blocksNumber);
+            passed = passed && (output == expected);
+
+            /* The whole CTR path, full and with 5 bytes of the last block missing */
+            for (size_t length : {input.size(), input.size() - 5})
+            {
+                std::vector<uint8_t> ctrOutput(length);
+                std::vector<uint8_t> ctrExpected(length);
+                CounterModeWorker(aesKey, ConstBlockView(input.data(), length), counter, OutputView(ctrOutput));
+                ReferenceCtr(key, keySize, counter, input.data(), ctrExpected.data(), length);
+                passed = passed && (ctrOutput == ctrExpected);
+            }
+        }
+
+        failures += Report(passed, "Tails 1-" + std::to_string(TEST_MAX_TAIL_BLOCKS) + " blocks AES-" + std::to_string(8 * keySize) +
+                                   " [" + BackendName(backend) + "]") ? 0 : 1;
+    }
+    return failures;
+}
+
+/********************************************************************
+ * Function: TestCounterCarry
+ * Description:
+ *  Function to check that the counter is a 128-bit big-endian
+ *  integer: starting a few blocks below 2^64 in the low half, the
+ *  keystream must continue into nonce + 1 || 0 instead of wrapping
+ *  to nonce || 0. The expected counter blocks are written out by
+ *  hand, and the message is large enough for the dispatcher to
+ *  split it across the workers
+ * Inputs:  backend - Backend under test
+ * Returns: Number of failed checks
+ ********************************************************************/
+size_t TestCounterCarry(AesBackend backend)
+{
+    const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    AesKey aesKey(key, sizeof(key), backend);
+    AesKey referenceKey(key, sizeof(key), AesBackend::Reference);
+
+    /* nonce 0x00000000000000ff, low half 2^64 - 3 */
+    CounterBlock counter = {0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfd};
+    const CounterBlock carried = {0, 0, 0, 0, 0, 0, 0x01, 0x00, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    /* Blocks 0-2 use the old nonce, block 3 is the first one after the carry */
+    std::vector<uint8_t> zeros(64 * 1024 * BLOCK_SIZE + 7, 0);
+    std::vector<uint8_t> keystream(zeros.size());
+    EncryptionDispatcher(aesKey, ConstBlockView(zeros.data(), zeros.size()), counter, OutputView(keystream));
+
+    uint8_t expected[BLOCK_SIZE];
+    AesEncryptBlock(referenceKey, carried.data(), expected);
+    bool passed = (std::memcmp(keystream.data() + 3 * BLOCK_SIZE, expected, BLOCK_SIZE) == 0);
+
+    CounterBlock lastBeforeCarry = counter;
+    lastBeforeCarry[15] = 0xff;
+    AesEncryptBlock(referenceKey, lastBeforeCarry.data(), expected);
+    passed = passed && (std::memcmp(keystream.data() + 2 * BLOCK_SIZE, expected, BLOCK_SIZE) == 0);
+
+    /* Every other block follows the reference counter arithmetic */
+    std::vector<uint8_t> reference(zeros.size());
+    ReferenceCtr(key, sizeof(key), counter, zeros.data(), reference.data(), zeros.size());
+    passed = passed && (keystream == reference);
+
+    return Report(passed, std::string("Counter carry into the nonce [") + BackendName(backend) + "]") ? 0 : 1;
+}
+
+/********************************************************************
+ * Function: TestStream
+ * Description:
+ *  Function to check that AesCtrStream produces the one-shot result
+ *  whatever the split of the updates (including tiny ones within a
+ *  block and in-place ones), that Seek followed by Update decrypts
+ *  from any offset, and that DecryptRange decrypts any byte range.
+ *  The counter starts just below the 64-bit boundary so the carry
+ *  is crossed inside the message
+ * Returns: Number of failed checks
+ ********************************************************************/
+size_t TestStream()
+{
+    std::mt19937 generator(2);
+    uint8_t key[32];
+    for (uint8_t& keyByte : key)
+    {
+        keyByte = static_cast<uint8_t>(generator());
+    }
+    AesKey aesKey(key, sizeof(key));
+
+    CounterBlock nonce;
+    for (uint8_t& nonceByte : nonce)
+    {
+        nonceByte = static_cast<uint8_t>(generator());
+    }
+    std::fill(nonce.begin() + 8, nonce.end(), 0xff);
+    nonce[15] = 0x00;
+
+    std::vector<uint8_t> plainText(TEST_MESSAGE_SIZE);
+    for (uint8_t& plainByte : plainText)
+    {
+        plainByte = static_cast<uint8_t>(generator());
+    }
+    std::vector<uint8_t> cipherText(plainText.size());
+    EncryptionDispatcher(aesKey, ConstBlockView(plainText.data(), plainText.size()), nonce, OutputView(cipherText));
+
+    /* Split updates, out of place and in place */
+    bool splitPassed = true;
+    for (size_t iteration = 0; iteration < 20; ++iteration)
+    {
+        std::vector<uint8_t> output(plainText.size());
+        std::vector<uint8_t> inPlace = plainText;
+        AesCtrStream stream;
+        AesCtrStream inPlaceStream;
+        stream.Init(aesKey, nonce);
+        inPlaceStream.Init(aesKey, nonce);
+
+        size_t maxChunk = ((iteration % 2) == 0) ? 40 : 40000;
+        for (size_t position = 0; position < plainText.size();)
+        {
+            size_t chunk = std::min<size_t>(plainText.size() - position, generator() % maxChunk);
+            stream.Update(plainText.data() + position, output.data() + position, chunk);
+            inPlaceStream.Update(inPlace.data() + position, inPlace.data() + position, chunk);
+            position += chunk;
+        }
+        stream.Final();
+        inPlaceStream.Final();
+        splitPassed = splitPassed && (output == cipherText) && (inPlace == cipherText);
+    }
+    size_t failures = Report(splitPassed, "AesCtrStream split updates") ? 0 : 1;
+
+    /* Seek then Update, backwards and forwards on one stream */
+    bool seekPassed = true;
+    AesCtrStream seekStream;
+    seekStream.Init(aesKey, nonce);
+    for (size_t iteration = 0; iteration < TEST_RANDOM_ITERATIONS; ++iteration)
+    {
+        size_t offset = generator() % plainText.size();
+        size_t length = std::min<size_t>(plainText.size() - offset, generator() % 5000);
+        std::vector<uint8_t> output(length);
+        seekStream.Seek(offset);
+        seekStream.Update(cipherText.data() + offset, output.data(), length);
+        seekPassed = seekPassed && std::equal(output.begin(), output.end(), plainText.begin() + offset);
+    }
+    seekStream.Final();
+    failures += Report(seekPassed, "AesCtrStream Seek") ? 0 : 1;
+
+    /* DecryptRange on unaligned ranges */
+    bool rangePassed = true;
+    for (size_t iteration = 0; iteration < TEST_RANDOM_ITERATIONS; ++iteration)
+    {
+        size_t offset = generator() % plainText.size();
+        size_t maxLength = ((iteration % 2) == 0) ? 50 : 100000;
+        size_t length = std::min<size_t>(plainText.size() - offset, generator() % maxLength);
+        std::vector<uint8_t> output(length);
+        DecryptRange(aesKey, nonce, offset, cipherText.data() + offset, output.data(), length);
+        rangePassed = rangePassed && std::equal(output.begin(), output.end(), plainText.begin() + offset);
+    }
+    failures += Report(rangePassed, "DecryptRange") ? 0 : 1;
+
+    return failures;
+}
+
+/********************************************************************
+ * Function: TestPipeline
+ * Description:
+ *  Function to check that PipelineDispatcher produces the one-shot
+ *  result on a stream of several times the buffers in flight, and
+ *  that RunPipeline rethrows an exception of stage 2 thrown on the
+ *  first, a middle or the final (empty) buffer. The reader is then
+ *  blocked on a free buffer and the writer on a processed one, so
+ *  returning at all means the shutdown reached and joined both
+ * Returns: Number of failed checks
+ ********************************************************************/
+size_t TestPipeline()
+{
+    std::mt19937 generator(3);
+    uint8_t key[16];
+    for (uint8_t& keyByte : key)
+    {
+        keyByte = static_cast<uint8_t>(generator());
+    }
+    AesKey aesKey(key, sizeof(key));
+    CounterBlock nonce = {};
+
+    std::string plainText((2 * PIPELINE_DEPTH + 1) * PIPELINE_BUFFER_SIZE + 777, '\0');
+    for (char& plainByte : plainText)
+    {
+        plainByte = static_cast<char>(generator());
+    }
+    std::string cipherText(plainText.size(), '\0');
+    EncryptionDispatcher(aesKey, ConstBlockView(reinterpret_cast<const uint8_t*>(plainText.data()), plainText.size()), nonce,
+                         BlockView{reinterpret_cast<uint8_t*>(cipherText.data()), cipherText.size() / BLOCK_SIZE, cipherText.size()});
+
+    std::istringstream input(plainText);
+    std::ostringstream output;
+    PipelineDispatcher(aesKey, nonce, input, output);
+    size_t failures = Report(output.str() == cipherText, "PipelineDispatcher") ? 0 : 1;
+
+    /* Buffer index at which stage 2 throws; the last one is the empty end marker */
+    size_t buffersNumber = plainText.size() / PIPELINE_BUFFER_SIZE + 2;
+    for (size_t throwAt : {size_t(0), size_t(PIPELINE_DEPTH + 1), buffersNumber - 1})
+    {
+        std::future<bool> result = std::async(std::launch::async, [&plainText, throwAt]()
+        {
+            std::istringstream throwInput(plainText);
+            std::ostringstream throwOutput;
+            size_t processed = 0;
+            try
+            {
+                RunPipeline(throwInput, throwOutput, [&processed, throwAt](uint8_t*, size_t)
+                {
+                    if (processed == throwAt)
+                    {
+                        throw std::runtime_error("stage 2 failure");
+                    }
+                    ++processed;
+                });
+            }
+            catch (const std::runtime_error& error)
+            {
+                /* Nothing past the failing buffer may have been written */
+                return (std::string(error.what()) == "stage 2 failure") &&
+                       (throwOutput.str().size() <= throwAt * PIPELINE_BUFFER_SIZE);
+            }
+            return false;
+        });
+
+        if (result.wait_for(TEST_PIPELINE_TIMEOUT) != std::future_status::ready)
+        {
+            /* The future would wait for the stuck threads forever on destruction */
+            Report(false, "RunPipeline stage 2 exception at buffer " + std::to_string(throwAt));
+            std::cout << "Some CTR tests failed" << std::endl;
+            std::_Exit(1);
+        }
+        failures += Report(result.get(), "RunPipeline stage 2 exception at buffer " + std::to_string(throwAt)) ? 0 : 1;
+    }
+
+    return failures;
+}
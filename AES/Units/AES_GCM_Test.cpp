@@ -0,0 +1,252 @@
+/*********************************************************************
+ * @file AES_GCM_Test.cpp
+ * @brief
+ *        Known-answer test of the AES-GCM mode of AES_CTR.cpp against
+ *        test cases 1-6 and 16 of the GCM specification (McGrew and
+ *        Viega, "The Galois/Counter Mode of Operation"). Every case
+ *        is run on every AES backend available on the machine with
+ *        both GHASH implementations: the ciphertext and the tag must
+ *        match, decryption must restore the plaintext, and a tag with
+ *        a single flipped bit must be rejected.
+ *
+ *        Build: g++ -std=c++20 -O2 AES_GCM_Test.cpp -lpthread
+ *        Usage: AES_GCM_Test (returns 0 when every check passes)
+ ********************************************************************/
+/********************************************************************
+ ************************** Included ********************************
+ ********************************************************************/
+/* The engine is compiled in as is, its interactive main is renamed out of the way */
+#define main AesCtrMain
+#include "../AES_CTR.cpp"
+#undef main
+
+#include <string>
+#include <vector>
+
+/********************************************************************
+ ***************************** Types ********************************
+ ********************************************************************/
+/* One test case of the GCM specification, every field in hex */
+struct GcmTestCase
+{
+    const char* name;
+    const char* key;
+    const char* iv;
+    const char* plainText;
+    const char* aad;
+    const char* cipherText;
+    const char* tag;
+};
+
+/********************************************************************
+ **************************** GLOBALS *******************************
+ ********************************************************************/
+/* Test cases 1-6 (AES-128, including the 64-bit and 480-bit IVs) and 16 (AES-256) */
+const GcmTestCase gcmTestCases[] =
+{
+    {"Test Case 1",
+     "00000000000000000000000000000000",
+     "000000000000000000000000",
+     "",
+     "",
+     "",
+     "58e2fccefa7e3061367f1d57a4e7455a"},
+    {"Test Case 2",
+     "00000000000000000000000000000000",
+     "000000000000000000000000",
+     "00000000000000000000000000000000",
+     "",
+     "0388dace60b6a392f328c2b971b2fe78",
+     "ab6e47d42cec13bdf53a67b21257bddf"},
+    {"Test Case 3",
+     "feffe9928665731c6d6a8f9467308308",
+     "cafebabefacedbaddecaf888",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+     "",
+     "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+     "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+     "4d5c2af327cd64a62cf35abd2ba6fab4"},
+    {"Test Case 4",
+     "feffe9928665731c6d6a8f9467308308",
+     "cafebabefacedbaddecaf888",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+     "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+     "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+     "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+     "5bc94fbc3221a5db94fae95ae7121a47"},
+    {"Test Case 5",
+     "feffe9928665731c6d6a8f9467308308",
+     "cafebabefacedbad",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+     "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+     "61353b4c2806934a777ff51fa22a4755699b2a714fcdc6f83766e5f97b6c7423"
+     "73806900e49f24b22b097544d4896b424989b5e1ebac0f07c23f4598",
+     "3612d2e79e3b0785561be14aaca2fccb"},
+    {"Test Case 6",
+     "feffe9928665731c6d6a8f9467308308",
+     "9313225df88406e555909c5aff5269aa6a7a9538534f7da1e4c303d2a318a728"
+     "c3c0c95156809539fcf0e2429a6b525416aedbf5a0de6a57a637b39b",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+     "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+     "8ce24998625615b603a033aca13fb894be9112a5c3a211a8ba262a3cca7e2ca7"
+     "01e4a9a4fba43c90ccdcb281d48c7c6fd62875d2aca417034c34aee5",
+     "619cc5aefffe0bfa462af43c1699d050"},
+    {"Test Case 16",
+     "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+     "cafebabefacedbaddecaf888",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+     "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+     "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+     "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+     "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+     "76fc6ece0f4e1768cddf8853bb2d551b"},
+};
+
+/********************************************************************
+ ************************* Prototypes *******************************
+ ********************************************************************/
+std::vector<uint8_t> HexToBytes(const char* hex);
+const char* BackendName(AesBackend backend);
+const char* GhashBackendName(GhashBackend backend);
+bool RunGcmTestCase(const GcmTestCase& testCase, AesBackend backend, GhashBackend ghashBackend);
+
+/********************************************************************
+ ************************* Main Function ****************************
+ ********************************************************************/
+int main()
+{
+    /* Backends missing on this CPU are skipped, the engine would silently run a software one instead */
+    std::vector<AesBackend> backends = {AesBackend::Reference, AesBackend::TTable, AesBackend::Bitsliced};
+    if (GetCpuFeatures().aesNi)
+    {
+        backends.push_back(AesBackend::AesNi);
+    }
+    std::vector<GhashBackend> ghashBackends = {GhashBackend::Shoup};
+    if (GetCpuFeatures().pclmul)
+    {
+        ghashBackends.push_back(GhashBackend::Clmul);
+    }
+
+    size_t failures = 0;
+    for (const GcmTestCase& testCase : gcmTestCases)
+    {
+        for (AesBackend backend : backends)
+        {
+            for (GhashBackend ghashBackend : ghashBackends)
+            {
+                bool passed = RunGcmTestCase(testCase, backend, ghashBackend);
+                failures += passed ? 0 : 1;
+                std::cout << (passed ? "PASS " : "FAIL ") << testCase.name << " [" << BackendName(backend) << ", "
+                          << GhashBackendName(ghashBackend) << "]" << std::endl;
+            }
+        }
+    }
+
+    if (!GetCpuFeatures().aesNi || !GetCpuFeatures().pclmul)
+    {
+        std::cout << "Skipped the hardware backends this CPU lacks" << std::endl;
+    }
+    std::cout << ((failures == 0) ? "All GCM test cases passed" : "Some GCM test cases failed") << std::endl;
+    return (failures == 0) ? 0 : 1;
+}
+
+/********************************************************************
+ *********************** Test Functions *****************************
+ ********************************************************************/
+/********************************************************************
+ * Function: HexToBytes
+ * Description:
+ *  Function to decode a test vector field from hex
+ * Inputs:  hex - Hex digits (an even number of them)
+ * Returns: The decoded bytes
+ ********************************************************************/
+std::vector<uint8_t> HexToBytes(const char* hex)
+{
+    size_t length = std::strlen(hex);
+    std::vector<uint8_t> bytes(length / 2);
+    if (((length % 2) != 0) || !HexDecode(hex, length, bytes.data()))
+    {
+        throw std::invalid_argument(std::string("Malformed test vector ") + hex);
+    }
+    return bytes;
+}
+
+/* Function to get the name of an AES backend as printed in the report */
+const char* BackendName(AesBackend backend)
+{
+    switch (backend)
+    {
+    case AesBackend::Reference:
+        return "reference";
+    case AesBackend::TTable:
+        return "ttable";
+    case AesBackend::AesNi:
+        return "aesni";
+    case AesBackend::Bitsliced:
+        return "bitsliced";
+    default:
+        return "automatic";
+    }
+}
+
+/* Function to get the name of a GHASH backend as printed in the report */
+const char* GhashBackendName(GhashBackend backend)
+{
+    switch (backend)
+    {
+    case GhashBackend::Shoup:
+        return "shoup";
+    case GhashBackend::Clmul:
+        return "clmul";
+    default:
+        return "automatic";
+    }
+}
+
+/********************************************************************
+ * Function: RunGcmTestCase
+ * Description:
+ *  Function to run one test case on one pair of backends. It checks
+ *  the ciphertext and the tag of the encryption, the plaintext
+ *  released by the decryption, and that the decryption rejects the
+ *  expected tag with its lowest bit flipped
+ * Inputs:  testCase        - Test vectors
+ *          backend         - AES backend
+ *          ghashBackend    - GHASH backend
+ * Returns: true if every check passed
+ ********************************************************************/
+bool RunGcmTestCase(const GcmTestCase& testCase, AesBackend backend, GhashBackend ghashBackend)
+{
+    std::vector<uint8_t> key = HexToBytes(testCase.key);
+    std::vector<uint8_t> iv = HexToBytes(testCase.iv);
+    std::vector<uint8_t> plainText = HexToBytes(testCase.plainText);
+    std::vector<uint8_t> aad = HexToBytes(testCase.aad);
+    std::vector<uint8_t> cipherText = HexToBytes(testCase.cipherText);
+    std::vector<uint8_t> tag = HexToBytes(testCase.tag);
+
+    AesKey aesKey(key.data(), key.size(), backend);
+    AesGcm gcm(aesKey, ghashBackend);
+
+    /* Encryption */
+    std::vector<uint8_t> output(plainText.size());
+    uint8_t outputTag[GCM_TAG_SIZE];
+    gcm.Encrypt(iv.data(), iv.size(), aad.data(), aad.size(), plainText.data(), output.data(), plainText.size(), outputTag);
+    bool passed = (output == cipherText) && (std::memcmp(outputTag, tag.data(), GCM_TAG_SIZE) == 0);
+
+    /* Decryption of the expected ciphertext */
+    std::vector<uint8_t> decrypted(cipherText.size());
+    passed = passed && gcm.Decrypt(iv.data(), iv.size(), aad.data(), aad.size(), cipherText.data(), decrypted.data(),
+                                   cipherText.size(), tag.data());
+    passed = passed && (decrypted == plainText);
+
+    /* A forged tag must be rejected */
+    std::vector<uint8_t> forgedTag = tag;
+    forgedTag[GCM_TAG_SIZE - 1] ^= 0x01;
+    passed = passed && !gcm.Decrypt(iv.data(), iv.size(), aad.data(), aad.size(), cipherText.data(), decrypted.data(),
+                                    cipherText.size(), forgedTag.data());
+    return passed;
+}